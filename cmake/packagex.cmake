@@ -8,6 +8,18 @@ install(TARGETS boxmalloc
     LIBRARY DESTINATION ${CMAKE_INSTALL_LIBDIR}
 )
 
+if(TARGET boxmalloc_preload)
+    install(TARGETS boxmalloc_preload
+        LIBRARY DESTINATION ${CMAKE_INSTALL_LIBDIR}
+    )
+endif()
+
+if(TARGET box_replay)
+    install(TARGETS box_replay
+        RUNTIME DESTINATION ${CMAKE_INSTALL_BINDIR}
+    )
+endif()
+
 # install public headers
 install(DIRECTORY ${CMAKE_CURRENT_LIST_DIR}/../include/ DESTINATION ${CMAKE_INSTALL_INCLUDEDIR})
 
@@ -1,6 +1,6 @@
 /*
 boxmalloc 是一个基于伙伴系统（buddy system）的存储分配器，用于高效管理任意size的obj。
-它接收两块独立的完整内存：meta区（存储管理box系统的元数据）和obj区（存放实际obj数据），初始化后不再支持扩展2个区域的大小。
+它接收两块独立的完整内存：meta区（存储管理box系统的元数据）和obj区（存放实际obj数据），初始化后可以通过 box_extend_meta/box_extend_obj 扩大2个区域。
 
 box可以看作16叉树，obj可以占据连续的几个树子节点，一旦被obj占据，则不能再分割子树。
 
@@ -14,7 +14,8 @@ boxmalloc的设计目标，不仅仅是作为程序的内存分配器，还希
 关于meta区：
 meta区依赖blockmalloc(https://github.com/miaobyte/blockmalloc)。
 meta区的大小=sizeof(box_meta_t)+boxcount*sizeof(box_head_t)
-meta区的大小约束了box的node数量，进而约束了obj的数量，需要根据实际需求进行合理配置
+meta区的大小约束了box的node数量，进而约束了obj的数量，需要根据实际需求进行合理配置，
+可以用 box_meta_bytes_required/box_meta_bytes_worst_case 计算
 
 关于obj区：
 obj区不会存放任何box系统的元数据（如对象地址、对象数据长度，这些会在meta区找到），完全分配给obj使用，但是obj实际分配会对齐到alloced_size=X*(16^N)*8字节,X∈[1,15],N>=0
@@ -39,6 +40,14 @@ box深度为8，时间复杂度为O(8*(1~16）)=O(8~128)
 
 关于obj释放：
 释放obj时，boxmalloc会检查所在node slots的状态，发现node的slots全部空闲，则释放该node，并递归检查和释放其parent node，直到root node
+释放的node归还给blockmalloc，其在parent中的槽位重新变为空闲，可以再分配更大的obj。
+box_options_t.empty_keep 可以保留若干个空node不回收，避免分配/释放在同一边界上反复时频繁格式化/回收；
+保留的node仍占据parent的槽位，直到再次被使用。
+
+关于并发：
+box_alloc/box_free/box_allocated_size 可以被多线程同时调用，无需外部加锁。
+每个box_head_t有自己的读写锁：分配从根到叶逐级加锁（hand-over-hand），容量变化从叶到根逐个节点更新，
+不同子树上的分配和释放可以并行。
 */
 
 
@@ -80,12 +89,347 @@ box区：
 #ifndef BOX_MALLOC_H
 #define BOX_MALLOC_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 int box_init(void *metaptr,  const size_t boxhead_bytessize, const size_t box_bytessize);
+
+/*
+放置策略：
+BOX_FIRST_FIT 选择第一个放得下的子节点/连续空闲槽位，速度最快。
+BOX_BEST_FIT  选择容量超出请求最少的子节点/连续空闲槽位，小obj不轻易拆分能容纳大obj的空闲槽位。
+*/
+typedef enum
+{
+    BOX_FIRST_FIT = 0,
+    BOX_BEST_FIT = 1,
+} box_policy_t;
+
+/*
+box_init 的可选参数，全部为0时与 box_init 相同。
+empty_keep：释放后最多保留多少个全部空闲的node不回收，0=立即回收。
+policy：box_alloc、box_alloc_n、box_alloc_aligned 默认的放置策略；box_alloc_near 按hint_offset放置，不使用policy。
+index_chunk：offset→box_head_t 索引的粒度（字节），须为 8*16^n（n>=1，如2K、32K、512K），0=不建索引。
+    索引在meta区中占 4*(box_bytessize/index_chunk) 字节，记录每个chunk对应的节点；
+    box_free/box_allocated_size 从该节点开始查找，不必从根逐层下降。建索引时box_init会清零整个meta区。
+journal_slots：撤销日志的槽数，最多64，0=不记日志；meta区放在mmap的文件上、需要在进程崩溃后 box_attach 时使用。
+    每个槽约660字节，同一时刻最多journal_slots个线程在修改树的结构，其余线程等待空闲的槽。
+*/
+typedef struct
+{
+    uint32_t empty_keep;
+    box_policy_t policy;
+    uint64_t index_chunk;
+    uint32_t journal_slots;
+} box_options_t;
+int box_init_ex(void *metaptr, const size_t boxhead_bytessize, const size_t box_bytessize, const box_options_t *options);
+
+/*
+meta区大小估算，返回boxhead_bytessize应取的字节数（含box_meta_t、索引和blockmalloc每个block的开销），参数无效或obj放不下时返回0。
+- box_meta_bytes_worst_case：obj不小于min_obj_size时，任意分配状态下都不会因meta区耗尽而失败的大小
+- box_meta_bytes_required：按histogram中各size的obj数量估算，每种size的obj各自装满节点；
+  分配、释放交替造成的碎片需要另留余量
+options与box_init_ex相同，可以为NULL。
+boxhead_bytessize小于 box_meta_bytes_worst_case(box_bytessize, 8, options) 时，box_init会打印警告。
+*/
+typedef struct
+{
+    size_t size;
+    uint64_t count;
+} box_size_count_t;
+size_t box_meta_bytes_required(const size_t box_bytessize, const box_size_count_t *histogram, const size_t n, const box_options_t *options);
+size_t box_meta_bytes_worst_case(const size_t box_bytessize, const size_t min_obj_size, const box_options_t *options);
+
+/*
+扩大meta区和obj区，成功返回0：
+- box_extend_meta：meta区已由调用者扩大到new_boxhead_bytessize（如mremap），新增部分作为新的block池，最多追加8次。
+  meta区地址不变时可以与其它调用并发；mremap移动了meta区时，调用者需保证期间没有其它线程访问。
+- box_extend_obj：obj区扩大到new_box_bytessize（8*16^n*x，x∈[1,15]），已有obj的offset不变。
+  同一层时根节点增加槽位；更高一层时在原根节点之上新建根节点，原根节点成为其slot 0。可以与其它调用并发。
+  新增的区域不在box_options_t.index_chunk的索引范围内。
+*/
+int box_extend_meta(void *metaptr, const size_t new_boxhead_bytessize);
+int box_extend_obj(void *metaptr, const size_t new_box_bytessize);
+
+/*
+重新打开已初始化的meta区（如mmap的文件、块设备），成功返回0；magic、布局版本或校验和不符时返回-1。
+- box_detach 正常关闭后，box_attach 只检查头部，O(1)。box_detach 前须停止所有调用并 box_tcache_flush。
+- 进程崩溃后（没有 box_detach），box_attach 按撤销日志回滚未完成的修改、补做已提交的节点回收，
+  再遍历一次meta区中的所有节点，清除残留的锁并重新汇总容量和索引，耗时与节点数成正比。
+  崩溃时正在进行的分配/释放要么完成、要么没有发生；没有日志（journal_slots=0）时只做遍历，可能留下半完成的修改。
+- 只保证进程崩溃时的一致性：掉电时写入meta区的顺序取决于页缓存，不在保证范围内。
+- 崩溃恰好发生在blockmalloc分配block之后、记入日志之前时，该block泄漏。
+*/
+int box_attach(void *metaptr);
+int box_detach(void *metaptr);
+
+/*
+分配器的统计信息，计数器在分配/释放时增量维护，box_stats 的开销为O(1)，不遍历树。
+各项分别读取，并发分配/释放时彼此之间不是同一时刻的快照。
+- allocated_bytes：当前已分配obj的字节数（对齐到 X*16^N*8 之后），线程缓存（box_tcache）中的obj也计为已分配
+- requested_total/rounded_total：累计的请求字节数及其对齐后的字节数，两者之差即对齐造成的内部浪费；
+  释放时不知道原来请求的size，只能累计统计。原地 box_realloc 也计为一次请求
+- objects[n]：当前大小为 x*16^n*8 的obj数（n>=15的计入objects[15]）
+- nodes/nodes_capacity：已格式化的box_head_t数，以及meta区（含 box_extend_meta 的部分）最多能容纳的数量
+- largest_free：当前能分配的最大obj的字节数
+- free_runs[k]：最长连续空闲槽位数为k的节点数，k=0为槽位已全部占用（或全部为子节点）的节点
+meta区未初始化时返回-1。
+*/
+#define BOX_STATS_LEVELS 16
+typedef struct
+{
+    uint64_t box_bytessize;
+    uint64_t allocated_bytes;
+    uint64_t requested_total;
+    uint64_t rounded_total;
+    uint64_t objects[BOX_STATS_LEVELS];
+    uint64_t nodes;
+    uint64_t nodes_capacity;
+    uint64_t largest_free;
+    uint64_t free_runs[17];
+} box_stats_t;
+int box_stats(void *metaptr, box_stats_t *out);
+
+// size为0时与malloc(0)相同，返回一个可以释放的最小obj（8字节）
 uint64_t box_alloc(void *metaptr,const size_t size);
+// 按指定策略分配，忽略box_init时设置的默认策略
+uint64_t box_alloc_policy(void *metaptr, const size_t size, const box_policy_t policy);
 uint64_t box_allocated_size(void *metaptr, const uint64_t obj_offset);
 void box_free(void *metaptr, const uint64_t obj_offset);
 
+/*
+调整obj的大小，返回调整后的offset：
+- 等于obj_offset：在所在node内原地完成（扩大时占用后续空闲槽位，缩小时释放尾部槽位），数据无需移动
+- 不等于obj_offset：原地无法扩大，已另行分配new_size的obj，旧obj保持不变；
+  调用者复制数据后自行 box_free 旧obj
+- BOX_FAILED（(uint64_t)-1）：obj不存在或空间不足，旧obj保持不变
+*/
+uint64_t box_realloc(void *metaptr, const uint64_t obj_offset, const size_t new_size);
+
+/*
+批量分配count个相同size的obj，offset写入out，返回实际分配的个数（meta区或obj区不足时小于count）。
+批量释放会原地排序offsets，使同一节点内的obj只加锁、更新一次。
+*/
+size_t box_alloc_n(void *metaptr, const size_t size, const size_t count, uint64_t *out);
+void box_free_n(void *metaptr, uint64_t *offsets, const size_t count);
+
+/*
+按位置约束分配：
+- box_alloc_aligned：obj起始offset按align（2的幂）对齐，如4K、2M、1G
+- box_alloc_near：优先放在hint_offset所在的子树，其次是离hint_offset最近的槽位
+两者在下降时逐层取得写锁并可回溯，比 box_alloc 慢，适合DMA缓冲、块设备extent等场景。
+*/
+uint64_t box_alloc_aligned(void *metaptr, const size_t size, const size_t align);
+uint64_t box_alloc_near(void *metaptr, const size_t size, const uint64_t hint_offset);
+
+/*
+碎片整理：boxmalloc不移动obj，box_compact_plan 只给出搬移计划，由调用者复制数据，可以在后台逐步进行。
+- box_compact_plan：找出搬走后能腾出target_size连续空间的一组obj（搬移字节数最少），
+  并为每个obj预先分配好新位置，写入moves，返回搬移的个数；
+  已经能分配target_size时返回0，找不到不超过max_moves个obj的方案或空间不足时返回 BOX_COMPACT_FAILED。
+- 调用者把 old_offset 处的size字节复制到 new_offset 后，调用 box_commit_move 释放旧obj；
+  旧obj或新位置已不是计划时的大小则返回-1，不释放任何obj。放弃某个搬移时，调用者 box_free(new_offset)。
+- 计划是某一时刻的估计，并发的分配可能再次占用腾出的空间；empty_keep 保留的空node仍占据槽位，可能使腾出的空间不连续。
+*/
+#define BOX_COMPACT_FAILED ((size_t)-1)
+typedef struct
+{
+    uint64_t old_offset;
+    uint64_t new_offset;
+    uint64_t size; // 对齐后的大小，即 box_allocated_size
+} box_move_t;
+size_t box_compact_plan(void *metaptr, const size_t target_size, box_move_t *moves, const size_t max_moves);
+int box_commit_move(void *metaptr, const box_move_t *move);
+
+/*
+把空闲的obj区交还给操作系统或存储设备，使RSS随已分配的数据减少，而不是停在历史最高值。
+- box_free 等使槽位变为空闲时只做记录；box_purge 把记录下来的、不小于min_bytes的连续空闲区域
+  逐个交给 fn(ctx, offset, bytes)，返回交还的字节数。小于min_bytes的区域留待以后与相邻区域合并
+- fn 返回实际交还的字节数。没有全部交还时（例如 box_purge_madvise 只交还区域内的整页）保留整段区域的记录，
+  以后与相邻的空闲槽位合并后再次报告；box_purge 的返回值是各次 fn 返回值之和
+- fn 执行期间该区域所在节点持有写锁，不会被并发分配；fn 不能调用同一个meta区的 box_* 函数
+- box_purge_madvise 是现成的fn：ctx为obj区的起始地址，对区域内的整页执行 madvise(MADV_DONTNEED)；
+  文件映射的obj区可以在fn中改用 fallocate(FALLOC_FL_PUNCH_HOLE)
+- 交还后的区域再次分配时，内容不保证为0，也不保证保留原有内容
+*/
+typedef uint64_t (*box_purge_fn)(void *ctx, const uint64_t offset, const uint64_t bytes);
+size_t box_purge(void *metaptr, const size_t min_bytes, box_purge_fn fn, void *ctx);
+uint64_t box_purge_madvise(void *ctx, const uint64_t offset, const uint64_t bytes);
+
+/*
+按offset顺序遍历已分配的obj和空闲区域，用于快照、备份和存储巡检：
+- box_iter_begin 初始化调用者提供的游标，只报告起始offset不小于offset的obj，包含offset的空闲区域从offset处截断；
+  分段遍历时，下一段从上一段最后报告的区域的末尾开始即可衔接
+- box_iter_next 每次报告一个区域，没有更多区域时返回false；相邻槽位和兄弟子树中的空闲区域合并为最长的一段
+- 遍历中的游标使当前路径上的节点暂不回收；没有遍历到box_iter_next返回false就停止时，须调用 box_iter_end，
+  之后游标不能再使用。遍历结束后调用 box_iter_end 也没有影响
+- 不分配内存，每个节点只读取一次；可以与分配/释放并发，此时结果不是同一时刻的快照，
+  遍历期间分配、释放的obj可能报告也可能不报告
+*/
+#define BOX_ITER_OBJ 1
+#define BOX_ITER_FREE 2
+typedef struct
+{
+    uint64_t offset;
+    uint64_t bytes; // obj为对齐后的大小，即 box_allocated_size
+    uint32_t kind;  // BOX_ITER_OBJ/BOX_ITER_FREE
+    uint32_t reserved; // 0，补齐结构体，可以整体用memcmp比较
+} box_extent_t;
+// 游标的内部状态，调用者不应访问
+typedef struct
+{
+    uint64_t opaque[200];
+} box_iter_t;
+int box_iter_begin(void *metaptr, box_iter_t *iter, const uint64_t offset);
+bool box_iter_next(box_iter_t *iter, box_extent_t *out);
+void box_iter_end(box_iter_t *iter);
+
+/*
+分配跟踪：把对metaptr的分配/释放/box_allocated_size 调用记入trace文件，用 box_replay 工具离线重放。
+- box_trace_start 创建path（已存在时清空），最多记录max_records条，超出的只计入 dropped；同一时刻只能跟踪一个meta区
+- box_trace_stop 写入记录数并截断文件，返回记录数；可以在其它线程仍在调用 box_* 时停止
+- box_alloc/box_alloc_policy/box_alloc_n/box_alloc_aligned/box_alloc_near 记为ALLOC（失败时offset为 (uint64_t)-1），
+  box_free/box_free_n 记为FREE，box_allocated_size 记为SIZE（size为返回值）；box_realloc 的原地调整不记录
+- 没有正常 box_trace_stop 的trace文件 records 为0，读取时按 op 不为0的记录计
+*/
+#define BOX_TRACE_MAGIC "boxtrace"
+#define BOX_TRACE_VERSION 1
+#define BOX_TRACE_ALLOC 1
+#define BOX_TRACE_FREE 2
+#define BOX_TRACE_SIZE 3
+typedef struct
+{
+    uint8_t magic[8]; // "boxtrace"
+    uint32_t version;
+    uint32_t record_bytes;
+    uint64_t box_bytessize;     // 开始跟踪时的obj区大小
+    uint64_t boxhead_bytessize; // 开始跟踪时的meta区大小
+    uint64_t records;
+    uint64_t dropped;
+    uint8_t reserved[16];
+} box_trace_header_t;
+typedef struct
+{
+    uint64_t time_ns; // CLOCK_MONOTONIC
+    uint64_t size;    // ALLOC为请求的字节数，SIZE为 box_allocated_size 的返回值
+    uint64_t offset;
+    uint32_t thread;  // 线程id（gettid）
+    uint8_t op;
+    uint8_t reserved[3];
+} box_trace_record_t;
+int box_trace_start(void *metaptr, const char *path, const uint64_t max_records);
+uint64_t box_trace_stop(void);
+
+/*
+一致性检查：并行遍历整棵树，检查每个节点的链接、槽位状态和容量字段，用于崩溃后或共享的meta区投入使用之前。
+- nthreads为0时使用全部在线CPU；调用期间不能有其它线程访问meta区。未经 box_attach 的崩溃镜像可能因未完成的修改报告错误
+- repair为true时自下而上修复容量字段（max_obj_capacity、child_max_obj_capacity、child_cap），
+  结构错误只报告不修复，出错的子树按没有空闲空间计算，之后的分配不会进入
+- out中记录前 BOX_VERIFY_ERRORS 个错误的种类、节点的block id和offset（SLOTS为出错槽位的offset），
+  没有错误或已全部修复时返回0，仍有错误时返回1，参数无效或内存不足时返回-1
+*/
+#define BOX_VERIFY_MAX_CAPACITY 1   // max_obj_capacity 与最长的连续空闲槽位数不符
+#define BOX_VERIFY_CHILD_CAPACITY 2 // child_max_obj_capacity 或 child_cap 与子节点的容量不符
+#define BOX_VERIFY_LINK 3           // block id越界，或节点的state/objlevel/parent与父节点不符
+#define BOX_VERIFY_SLOTS 4          // 槽位位图重叠或超出avliable_slot，OBJ_CONTINUED 之前不是obj，0层节点有子节点
+#define BOX_VERIFY_ERRORS 16
+typedef struct
+{
+    uint32_t kind;
+    int32_t block_id;
+    uint64_t offset;
+} box_verify_error_t;
+typedef struct
+{
+    uint64_t nodes;      // 检查的节点数
+    uint64_t violations; // 发现的错误数
+    uint64_t repaired;   // 其中已修复的错误数
+    uint32_t reported;   // error中有效的项数
+    box_verify_error_t error[BOX_VERIFY_ERRORS];
+} box_verify_report_t;
+int box_verify(void *metaptr, const unsigned nthreads, const bool repair, box_verify_report_t *out);
+
+/*
+运行时统计：box_instr_enable(true) 之后，box_alloc/box_alloc_policy/box_free 按线程累计下列计数，
+box_instr_snapshot 汇总所有线程（含已退出的线程），可以定期读取。关闭时开销为每个埋点一次分支。
+统计是进程级的，不区分meta区；box_instr_reset 与并发的计数同时进行时可能漏掉个别计数。
+- allocs/frees：计入统计的分配、释放次数；retries：box_alloc 因容量信息过期从根重新查找的次数
+- blocks_alloc：为新节点向blockmalloc申请block的次数
+- fail_too_large：请求比整个box还大；fail_no_run：没有足够长的连续空闲槽位；fail_meta：meta区耗尽
+- alloc_ns/free_ns：耗时直方图，第k项为 [2^k, 2^(k+1)) 纳秒
+- depth：每次分配下降经过的节点数；scanned：每次分配检查的候选子节点数（>=31的计入最后一项）
+- propagation：每次分配/释放时 update_parent 向上更新的节点数
+*/
+#define BOX_INSTR_BUCKETS 32
+#define BOX_INSTR_LEVELS 17
+typedef struct
+{
+    uint64_t allocs;
+    uint64_t frees;
+    uint64_t retries;
+    uint64_t blocks_alloc;
+    uint64_t fail_too_large;
+    uint64_t fail_no_run;
+    uint64_t fail_meta;
+    uint64_t alloc_ns[BOX_INSTR_BUCKETS];
+    uint64_t free_ns[BOX_INSTR_BUCKETS];
+    uint64_t depth[BOX_INSTR_LEVELS];
+    uint64_t scanned[BOX_INSTR_BUCKETS];
+    uint64_t propagation[BOX_INSTR_LEVELS];
+} box_instr_t;
+void box_instr_enable(const bool enable);
+void box_instr_snapshot(box_instr_t *out);
+void box_instr_reset(void);
+
+/*
+指针接口：box_heap_create 把meta区和obj区的起始地址base绑定为一个heap，之后用指针代替offset。
+- box_heap_t 占用meta区开头的64字节，其余部分按 box_init_ex 初始化，options可以为NULL；base须按16字节对齐
+- box_heap_malloc 与malloc相同：大于8字节的分配按16字节对齐，失败返回NULL
+- box_heap_realloc 优先原地调整，否则分配新obj、复制数据后释放旧obj；失败时旧obj保持不变
+- box_heap_aligned_alloc 按align（2的幂）对齐；align超过base实际的对齐时返回NULL
+- box_heap_meta 返回box的meta区，可以对它调用其它 box_* 函数（如 box_stats）
+- box_heap_purge 用 box_purge_madvise 交还不小于min_bytes的空闲区域，返回交还的字节数
+libboxmalloc_preload.so 在此之上实现了 malloc/free/realloc/calloc/posix_memalign/malloc_usable_size，可以用 LD_PRELOAD 加载。
+*/
+typedef struct box_heap box_heap_t;
+box_heap_t *box_heap_create(void *metaptr, const size_t meta_bytes, void *base, const size_t bytes, const box_options_t *options);
+void *box_heap_meta(box_heap_t *heap);
+void *box_heap_malloc(box_heap_t *heap, const size_t size);
+void box_heap_free(box_heap_t *heap, void *ptr);
+size_t box_heap_usable_size(box_heap_t *heap, const void *ptr);
+void *box_heap_realloc(box_heap_t *heap, void *ptr, const size_t size);
+void *box_heap_aligned_alloc(box_heap_t *heap, const size_t align, const size_t size);
+bool box_heap_contains(box_heap_t *heap, const void *ptr);
+size_t box_heap_purge(box_heap_t *heap, const size_t min_bytes);
+
+/*
+多arena：把obj区分成arenas段，每段是一棵独立的box树，线程按所在CPU（sched_getcpu）选择arena，
+多核同时分配时不再争用同一个根节点。
+- box_arena_t 占用meta区开头的64字节，其余部分平分给各arena，每个arena按 box_init_ex(options) 初始化
+- 每段的大小为 box_bytessize/arenas 向下取整到 8*16^n*x，取整剩下的尾部不使用
+- box_arena_alloc 返回整个obj区内的offset，所在arena空间不足时依次尝试后面的arena
+- box_arena_free/box_arena_allocated_size 按offset所在的段找到arena
+- box_arena_meta 返回第i个arena的meta区，可以对它调用 box_stats 等函数（offset须减去 i*段大小）
+*/
+typedef struct box_arena box_arena_t;
+box_arena_t *box_arena_create(void *metaptr, const size_t boxhead_bytessize, const size_t box_bytessize, const uint32_t arenas, const box_options_t *options);
+uint32_t box_arena_count(box_arena_t *arena);
+void *box_arena_meta(box_arena_t *arena, const uint32_t i);
+uint64_t box_arena_alloc(box_arena_t *arena, const size_t size);
+void box_arena_free(box_arena_t *arena, const uint64_t obj_offset);
+uint64_t box_arena_allocated_size(box_arena_t *arena, const uint64_t obj_offset);
+
+/*
+线程私有的小对象缓存（<=128字节），命中时不访问共享meta区、不加锁。
+- box_tcache_free 需要传入分配时的size，用于确定缓存类别，>128字节直接转给 box_free
+- 每个线程同一时刻只绑定一个meta区，切换meta区会先归还旧缓存
+- 线程退出时自动归还缓存；box_tcache_flush 可以提前归还当前线程的缓存
+- box_tcache_set_depth 设置每个尺寸的缓存深度（全局生效），范围[1,256]，默认64
+*/
+uint64_t box_tcache_alloc(void *metaptr, const size_t size);
+void box_tcache_free(void *metaptr, const uint64_t obj_offset, const size_t size);
+void box_tcache_flush(void *metaptr);
+void box_tcache_set_depth(size_t depth);
+
 #endif // BOX_MALLOC_H
\ No newline at end of file
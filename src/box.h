@@ -1,18 +1,171 @@
 #ifndef BOX_H
 #define BOX_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include <blockmalloc/blockmalloc.h>
 #include "obj_usage.h"
 
+#define BOX_FAILED (uint64_t)-1
+
+/*
+box_stats 的计数器，分配/释放、新建/回收节点时增量维护（relaxed原子操作），读取时不遍历树。
+崩溃后由 box_attach 的遍历重新汇总（累计值除外）。
+*/
+typedef struct
+{
+    atomic_uint_fast64_t allocated_bytes; // 当前已分配obj的字节数（对齐后）
+    atomic_uint_fast64_t requested_total; // 累计请求的字节数
+    atomic_uint_fast64_t rounded_total;   // 累计请求对齐后的字节数
+    atomic_uint_fast64_t nodes;           // 已格式化的box_head_t数
+    atomic_uint_fast64_t objects[16];     // 各level的obj数
+    atomic_uint_fast64_t free_runs[17];   // 按 max_obj_capacity 统计的节点数
+} box_counters_t;
+
 typedef struct
 {
-    #define BOX_MAGIC "boxmalloc"
-    uint8_t magic[16]; // "boxmalloc"
-    uint64_t boxhead_bytessize; // 伙伴系统的总size
-    uint64_t box_bytessize;  // 总内存大小，不可变，内存长度必须=16^n*x,n>=1，x=[1,15]
+    /*
+    最初的布局（magic为16字节的"boxmalloc"，box_head_t按packed排列、rw_lock不在首位，box_meta_t没有blocks_lock）
+    与现在的不兼容，改用新的magic，这样的meta区在box_attach时被拒绝，而不是被误读。
+    */
+    #define BOX_MAGIC "boxmalloc2"
+    uint8_t magic[12]; // "boxmalloc2"
+    // 槽位位图 + parent中缓存子节点容量 + blocks之前的ext；布局有变化时递增，box_attach 只接受当前版本
+    #define BOX_LAYOUT_VERSION 3
+    uint32_t layout_version;
+    uint64_t boxhead_bytessize; // 伙伴系统的总size，box_extend_meta 后为扩展后的大小
+    uint64_t box_bytessize;  // 总内存大小，只能由 box_extend_obj 增大，内存长度必须=16^n*x,n>=1，x=[1,15]
+    atomic_int_fast64_t blocks_lock; // 保护blocks_alloc/blocks_free
     blocks_meta_t blocks;
+
+    /*
+    扩展字段，blocks区随之后移。
+    ext_bytessize 记录初始化时扩展部分的大小，box_attach 要求与 sizeof(ext) 相同，增删字段时需要递增 BOX_LAYOUT_VERSION。
+    */
+    struct
+    {
+        uint64_t ext_bytessize;
+        uint32_t empty_keep;     // 最多保留多少个空节点不回收，0=立即回收
+        atomic_uint empty_kept;  // 当前保留的空节点数
+        uint32_t policy;         // box_alloc 默认的 box_policy_t
+        // offset→box_head_t 索引：每 8*16^index_level 字节一项，记录objlevel为index_level-1的节点的block id。
+        // 索引数组紧跟在ext之后，blocks区再随之后移。index_level为0表示没有索引
+        uint32_t index_level;
+        uint64_t index_entries;
+        /*
+        box_extend_meta 在meta区末尾追加的block池，最多 BOX_META_EXTENTS 个。
+        第k个池的 blocks_meta_t 位于meta区 extent_offset[k] 处，其后是池的blocks区；
+        池内block的id加上 extent_first_id[k] 才是box_head_t中记录的id，各池的id区间互不重叠。
+        */
+        #define BOX_META_EXTENTS 8
+        atomic_uint extents;
+        uint32_t reserved;
+        uint64_t extent_offset[BOX_META_EXTENTS];
+        int64_t extent_first_id[BOX_META_EXTENTS];
+        // 根节点的block id；box_extend_obj 在原根节点之上新建根节点后更新
+        atomic_int_least32_t root_id;
+        /*
+        持久化：meta区放在mmap的文件或块设备上时，box_attach 重新打开。
+        journal_slots 个 box_journal_slot_t 紧跟在索引数组之后；open_state 为 BOX_CLOSED 时说明上次由 box_detach 正常关闭。
+        checksum 覆盖初始化后不再变化的字段，见 box_meta_checksum。
+        */
+        #define BOX_JOURNAL_MAX_SLOTS 64
+        uint32_t journal_slots;
+        #define BOX_OPEN 1
+        #define BOX_CLOSED 2
+        uint32_t open_state;
+        atomic_uint_fast64_t journal_busy; // 正在使用的日志槽，box_attach 时清零
+        uint64_t checksum;
+        box_counters_t counters;
+    } ext;
 } box_meta_t;
 
+// 索引数组，没有索引时返回NULL
+static inline atomic_int_least32_t *box_index(const box_meta_t *meta)
+{
+    if (meta->ext.index_level == 0)
+        return NULL;
+    return (atomic_int_least32_t *)((uint8_t *)meta + offsetof(box_meta_t, ext) + meta->ext.ext_bytessize);
+}
+
+/*
+一次修改（创建/回收子节点、占用/释放槽位、扩展obj区）的撤销日志。
+修改前保存涉及的字节（前像），全部写完后提交：
+- active 不为0时崩溃：box_attach 按逆序恢复前像，并归还本次新分配的block（撤销）
+- 已提交但 free_id>=0：box_attach 补做归还（重做）
+*/
+#define BOX_JOURNAL_IMAGES 4
+#define BOX_JOURNAL_BLOCKS 16
+typedef struct
+{
+    uint64_t offset; // 相对meta区起始的偏移
+    uint32_t bytes;
+    uint32_t reserved;
+    uint8_t data[128];
+} box_journal_image_t;
+
+typedef struct
+{
+    atomic_uint active;
+    atomic_uint images;
+    uint32_t blocks;
+    int32_t free_id;
+    int32_t alloc_ids[BOX_JOURNAL_BLOCKS];
+    box_journal_image_t image[BOX_JOURNAL_IMAGES];
+} box_journal_slot_t;
+
+static inline size_t box_index_bytes(const box_meta_t *meta)
+{
+    return box_index(meta) ? (meta->ext.index_entries * sizeof(atomic_int_least32_t) + 7) / 8 * 8 : 0;
+}
+
+// 日志槽数组，没有日志时返回NULL
+static inline box_journal_slot_t *box_journal(const box_meta_t *meta)
+{
+    if (meta->ext.journal_slots == 0)
+        return NULL;
+    return (box_journal_slot_t *)((uint8_t *)meta + offsetof(box_meta_t, ext) + meta->ext.ext_bytessize + box_index_bytes(meta));
+}
+
+// blocks区（box_head_t数组）的起始地址
+static inline void *box_boxhead(const box_meta_t *meta)
+{
+    size_t offset = offsetof(box_meta_t, ext) + meta->ext.ext_bytessize;
+    offset += box_index_bytes(meta);
+    if (box_journal(meta))
+        offset += meta->ext.journal_slots * sizeof(box_journal_slot_t);
+    return (uint8_t *)meta + offset;
+}
+
+// meta区是否由 box_init 初始化，是时返回0
+static inline int box_check_magic(const box_meta_t *meta)
+{
+    return memcmp(meta->magic, BOX_MAGIC, sizeof(BOX_MAGIC) - 1) == 0 ? 0 : -1;
+}
+
+/*
+分配跟踪（box_trace.c）：box_trace_meta 为正在跟踪的meta区，NULL表示不跟踪。
+box_alloc 类函数在分配之后记录，box_free 类函数在释放之前记录，
+保证同一offset的释放记录总在分配记录之后、再次分配的记录之前。
+*/
+extern void *_Atomic box_trace_meta;
+void box_trace_record(const void *metaptr, uint8_t op, uint64_t size, uint64_t offset);
+
+static inline void box_trace(const void *metaptr, uint8_t op, uint64_t size, uint64_t offset)
+{
+    if (__builtin_expect(atomic_load_explicit(&box_trace_meta, memory_order_relaxed) == metaptr, 0))
+        box_trace_record(metaptr, op, size, offset);
+}
+
 typedef enum
 {
     BOX_UNUSED = 0,    // 未用（可以分配 obj、box）
@@ -21,34 +174,289 @@ typedef enum
     OBJ_CONTINUED = 3  // obj_continued
 } BoxState;
 
+/*
+槽位位图，16字节。
+bit i 对应槽位i，四种状态：
+BOX_UNUSED     free_mask=1
+BOX_FORMATTED  formatted_mask=1
+OBJ_START      start_mask=1
+OBJ_CONTINUED  三个mask均为0
+超出 avliable_slot 的位均为0。
+*/
 typedef struct
 {
-    uint8_t state : 2;       // 0=未用（可以分配obj、box）,1=已格式化为box，2=obj
-    int8_t continue_max : 6; // 连续的最大空闲obj,[0~16]
-} __attribute__((packed)) box_child_t;
+    uint16_t free_mask;
+    uint16_t start_mask;
+    uint16_t formatted_mask;
+    uint8_t kept_empty; // 全部空闲但按 empty_keep 保留、未回收的节点
+    uint8_t reserved;
+    uint32_t index_chunk; // 被索引的节点在索引中的序号
+    uint16_t dirty_mask;  // 变为空闲后还没有被 box_purge 交还的槽位
+    uint8_t reserved2[2];
+} __attribute__((packed)) box_slots_bitmap_t;
 
 typedef struct
 {
-    uint8_t state : 2;           // 0=未用（可以分配obj、box）,1=已格式化为box，2=obj
-    int8_t max_obj_capacity : 6; // 连续的最大空闲obj,[0~16]
-
-    // lock
-    atomic_int_fast64_t rw_lock;  // 0=无锁，1=读锁，2=写锁（简化实现）
+    // lock，放在首位保证8字节对齐
+    atomic_int_fast64_t rw_lock;  // lock.h 的读写锁：读者数、写锁、futex睡眠、等待的写者、pin，编码见 lock.h
 
     // parent
     int32_t parent; // parent_blockid
 
+    uint8_t state : 2;           // 0=未用（可以分配obj、box）,1=已格式化为box，2=obj
+    int8_t max_obj_capacity : 6; // 连续的最大空闲obj,[0~16]
+
     // box
     uint8_t objlevel; //[0,16] boxlevel=本层的objlevel+1
 
     // obj,childbox usage
     uint8_t avliable_slot;            // 【2，16】
     obj_usage child_max_obj_capacity; // 下层的最大对象容量
-    box_child_t used_slots[16];
+    box_slots_bitmap_t slots;
 
     // childbox
     int32_t childs_blockid[16];
 
-} __attribute__((packed)) box_head_t; //
+    // 各子节点 box_and_child_max_obj_capacity 的 obj_usage_key，非子节点为0
+    uint8_t child_cap[16];
+
+} box_head_t; // 字段按自然对齐排列，无需packed
+
+_Static_assert(sizeof(box_head_t) <= sizeof(((box_journal_image_t *)0)->data), "journal image must hold a box_head_t");
+
+// 第k个追加池的blocks区起始地址
+static inline uint8_t *box_extent_data(box_meta_t *meta, unsigned k)
+{
+    return (uint8_t *)meta + meta->ext.extent_offset[k] + (sizeof(blocks_meta_t) + 7) / 8 * 8;
+}
+
+static inline unsigned box_extents(box_meta_t *meta)
+{
+    return atomic_load_explicit(&meta->ext.extents, memory_order_acquire);
+}
+
+// block id → box_head_t
+static inline box_head_t *box_node(box_meta_t *meta, int64_t block_id)
+{
+    for (unsigned k = box_extents(meta); k-- > 0;)
+    {
+        if (block_id >= meta->ext.extent_first_id[k])
+        {
+            blocks_meta_t *pool = (blocks_meta_t *)((uint8_t *)meta + meta->ext.extent_offset[k]);
+            return (box_head_t *)(box_extent_data(meta, k) + blockdata_offset(pool, block_id - meta->ext.extent_first_id[k]));
+        }
+    }
+    return (box_head_t *)((uint8_t *)box_boxhead(meta) + blockdata_offset(&meta->blocks, block_id));
+}
+
+// box_head_t → block id
+static inline int64_t box_node_id(box_meta_t *meta, const box_head_t *node)
+{
+    for (unsigned k = box_extents(meta); k-- > 0;)
+    {
+        uint8_t *data = box_extent_data(meta, k);
+        if ((const uint8_t *)node >= data)
+        {
+            blocks_meta_t *pool = (blocks_meta_t *)((uint8_t *)meta + meta->ext.extent_offset[k]);
+            return meta->ext.extent_first_id[k] + blockid_bydataoffset(pool, (const uint8_t *)node - data);
+        }
+    }
+    return blockid_bydataoffset(&meta->blocks, (const uint8_t *)node - (uint8_t *)box_boxhead(meta));
+}
+
+static inline int32_t box_root_id(box_meta_t *meta)
+{
+    return atomic_load_explicit(&meta->ext.root_id, memory_order_acquire);
+}
+
+/*
+ * 取得根节点的锁：exclusive 为真时是写锁，否则是读锁。
+ * box_extend_obj 可能在加锁之前把根节点换成新建的上层节点，加锁后确认节点仍是根节点（没有parent）。
+ */
+box_head_t *box_lock_root(box_meta_t *meta, bool exclusive);
+
+/*
+ * 撤销只读遍历对node的pin（见 lock_unpin）。pin期间node变空、回收被跳过时，
+ * 与 box_free 相同地通知parent回收node并向上更新容量。
+ * 线程安全需求：调用者不持有任何锁。
+ */
+void box_unpin(box_meta_t *meta, box_head_t *node);
+
+static inline uint8_t box_slot_state(const box_head_t *node, int i)
+{
+    uint16_t bit = (uint16_t)(1u << i);
+    if (node->slots.free_mask & bit)
+        return BOX_UNUSED;
+    if (node->slots.formatted_mask & bit)
+        return BOX_FORMATTED;
+    if (node->slots.start_mask & bit)
+        return OBJ_START;
+    return OBJ_CONTINUED;
+}
+
+static inline void box_set_slot_state(box_head_t *node, int i, uint8_t state)
+{
+    uint16_t bit = (uint16_t)(1u << i);
+    if (state == BOX_UNUSED)
+        node->slots.dirty_mask |= bit;
+    node->slots.free_mask = state == BOX_UNUSED ? node->slots.free_mask | bit : node->slots.free_mask & ~bit;
+    node->slots.formatted_mask = state == BOX_FORMATTED ? node->slots.formatted_mask | bit : node->slots.formatted_mask & ~bit;
+    node->slots.start_mask = state == OBJ_START ? node->slots.start_mask | bit : node->slots.start_mask & ~bit;
+}
+
+// 节点的槽位全部空闲：没有obj，也没有子节点
+static inline bool box_node_empty(const box_head_t *node)
+{
+    return node->slots.free_mask == (uint16_t)((1u << node->avliable_slot) - 1);
+}
+
+// 位图中最长的连续1
+static inline uint8_t bitmap_longest_run(uint32_t x)
+{
+    uint8_t n = 0;
+    while (x)
+    {
+        x &= x >> 1;
+        n++;
+    }
+    return n;
+}
+
+// 位图中长度>=len的连续1的起始位掩码
+static inline uint32_t bitmap_run_starts(uint32_t x, uint8_t len)
+{
+    // 倍增：每轮之后，bit i 表示从i开始至少有 step 个连续1
+    uint8_t step = 1;
+    while (x && step * 2 <= len)
+    {
+        x &= x >> step;
+        step *= 2;
+    }
+    if (step < len)
+        x &= x >> (len - step);
+    return x;
+}
+
+// starts中的起始位里，所在的x的连续1最短的一个（长度相同时取低位），starts为0时返回-1
+static inline int bitmap_best_start(uint32_t x, uint32_t starts)
+{
+    int best = -1;
+    uint8_t best_len = 33;
+    while (x)
+    {
+        int start = __builtin_ctz(x);
+        uint8_t run = (uint8_t)__builtin_ctz(~(x >> start));
+        uint32_t mask = (uint32_t)(((1ull << run) - 1) << start);
+        if ((starts & mask) && run < best_len)
+        {
+            best = __builtin_ctz(starts & mask);
+            best_len = run;
+        }
+        x &= ~mask;
+    }
+    return best;
+}
+
+// 已格式化为子节点的槽位掩码
+static inline uint16_t box_formatted_mask(const box_head_t *node)
+{
+    return node->slots.formatted_mask;
+}
+
+// mask中离bit h最近的位（距离相同时取低位），h<0时取最低位；mask为0时返回-1
+static inline int bitmap_nearest(uint32_t mask, int h)
+{
+    if (!mask)
+        return -1;
+    if (h < 0)
+        return __builtin_ctz(mask);
+    uint32_t above = mask >> h;
+    uint32_t below = mask & ((1u << h) - 1);
+    if (!below)
+        return h + __builtin_ctz(above);
+    int lo = 31 - __builtin_clz(below);
+    if (!above)
+        return lo;
+    int hi = h + __builtin_ctz(above);
+    return hi - h < h - lo ? hi : lo;
+}
+
+// 空闲槽位掩码
+static inline uint16_t box_free_mask(const box_head_t *node)
+{
+    return node->slots.free_mask;
+}
+
+// 从bit i+1开始连续的1的个数
+static inline uint8_t bitmap_run_after(uint32_t x, int i)
+{
+    // x只有低16位，右移后高位补0，取反后一定有1
+    return (uint8_t)__builtin_ctz(~(x >> (i + 1)));
+}
+
+/*
+ * OBJ_CONTINUED 状态的槽位：三个mask均为0，且不超出 avliable_slot。
+ * 线程安全需求：调用者持有node的锁。
+ */
+static inline uint16_t box_slots_continued(const box_head_t *node)
+{
+    uint16_t avliable = (uint16_t)((1u << node->avliable_slot) - 1);
+    return ~(node->slots.free_mask | node->slots.start_mask | node->slots.formatted_mask) & avliable;
+}
+
+/*
+ * 从slot_index开始的obj占据的槽位数。
+ * 线程安全需求：调用者持有node的锁。
+ */
+static inline uint8_t box_obj_slots(const box_head_t *node, uint8_t slot_index)
+{
+    return 1 + bitmap_run_after(box_slots_continued(node), slot_index);
+}
+
+// child_cap[i] >= key 的槽位掩码
+static inline uint16_t caps_fit_mask(const uint8_t caps[16], uint8_t key)
+{
+#if defined(__SSE2__)
+    __m128i v = _mm_loadu_si128((const __m128i *)caps);
+    __m128i k = _mm_set1_epi8((char)key);
+    // 无符号比较：v>=k 等价于 max(v,k)==v
+    return (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(v, k), v));
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    static const uint8_t bits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+    uint8x16_t ge = vcgeq_u8(vld1q_u8(caps), vdupq_n_u8(key));
+    uint8x16_t m = vandq_u8(ge, vld1q_u8(bits));
+    return (uint16_t)(vaddv_u8(vget_low_u8(m)) | (vaddv_u8(vget_high_u8(m)) << 8));
+#else
+    uint16_t mask = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        if (caps[i] >= key)
+            mask |= (uint16_t)(1u << i);
+    }
+    return mask;
+#endif
+}
+
+static inline uint8_t caps_max(const uint8_t caps[16])
+{
+#if defined(__SSE2__)
+    __m128i v = _mm_loadu_si128((const __m128i *)caps);
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 8));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 4));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 2));
+    v = _mm_max_epu8(v, _mm_srli_si128(v, 1));
+    return (uint8_t)_mm_cvtsi128_si32(v);
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    return vmaxvq_u8(vld1q_u8(caps));
+#else
+    uint8_t max = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        if (caps[i] > max)
+            max = caps[i];
+    }
+    return max;
+#endif
+}
 
 #endif // BOX_H
\ No newline at end of file
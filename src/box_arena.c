@@ -0,0 +1,153 @@
+/*
+多arena前端：把obj区切成N段，每段是一棵独立的box树，有自己的meta区切片。
+
+所有分配都从根节点开始下降，且 update_parent 最终都会写根节点的容量缓存，
+多核同时分配时根节点所在的cache line在各核之间来回传递。分成N棵树后，
+线程按所在CPU选择arena，不同CPU上的分配访问不同的根节点。
+
+box_arena_t 与 box_heap_t 一样放在调用者提供的meta区开头，其后是N个等长的meta切片（按cache line对齐）。
+对外的offset是整个obj区内的offset：arena i 的obj区从 i*slice 开始，
+box_arena_free/box_arena_allocated_size 按offset所在的段找到arena。
+*/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sched.h>
+
+#include <boxmalloc/boxmalloc.h>
+#include "logutil.h"
+#include "box.h"
+
+#define BOX_ARENA_HEADER 64
+#define BOX_ARENA_MAX 256
+#define BOX_ARENA_CACHELINE 64
+
+struct box_arena
+{
+    uint32_t arenas;
+    uint32_t reserved;
+    uint64_t slice;       // 每个arena的obj区字节数
+    uint64_t meta_slice;  // 每个arena的meta区字节数
+    uint64_t box_bytessize; // arenas*slice，不足调用者给出的obj区时，尾部不使用
+};
+_Static_assert(sizeof(box_arena_t) <= BOX_ARENA_HEADER, "box_arena_t must fit in its header");
+
+// n个8字节单位向下取整到 x*16^level，x∈[1,15]
+static uint64_t box_arena_floor(uint64_t n)
+{
+    uint32_t shift = 4 * int_log16(n);
+    return (n >> shift) << shift;
+}
+
+static inline uint8_t *box_arena_slice_meta(box_arena_t *arena, uint32_t i)
+{
+    return (uint8_t *)arena + BOX_ARENA_HEADER + (uint64_t)i * arena->meta_slice;
+}
+
+box_arena_t *box_arena_create(void *metaptr, const size_t boxhead_bytessize, const size_t box_bytessize, const uint32_t arenas, const box_options_t *options)
+{
+    if (!metaptr || arenas == 0 || arenas > BOX_ARENA_MAX || box_bytessize / arenas < 8 * 16)
+    {
+        LOG("[ERROR] invalid arena count %u for box_bytessize %zu", arenas, box_bytessize);
+        return NULL;
+    }
+    uint64_t meta_slice = boxhead_bytessize > BOX_ARENA_HEADER ? (boxhead_bytessize - BOX_ARENA_HEADER) / arenas : 0;
+    meta_slice = meta_slice / BOX_ARENA_CACHELINE * BOX_ARENA_CACHELINE;
+    if (meta_slice == 0)
+    {
+        LOG("[ERROR] meta area %zu too small for %u arenas", boxhead_bytessize, arenas);
+        return NULL;
+    }
+    box_arena_t *arena = metaptr;
+    uint64_t slice = box_arena_floor(box_bytessize / arenas / 8) * 8;
+    *arena = (box_arena_t){
+        .arenas = arenas,
+        .slice = slice,
+        .meta_slice = meta_slice,
+        .box_bytessize = slice * arenas,
+    };
+    if (arena->box_bytessize != box_bytessize)
+    {
+        LOG("[WARN] %u arenas of %lu bytes use %lu of %zu bytes", arenas, slice, arena->box_bytessize, box_bytessize);
+    }
+    for (uint32_t i = 0; i < arenas; i++)
+    {
+        if (box_init_ex(box_arena_slice_meta(arena, i), meta_slice, slice, options) != 0)
+        {
+            LOG("[ERROR] failed to initialize arena %u", i);
+            return NULL;
+        }
+    }
+    return arena;
+}
+
+uint32_t box_arena_count(box_arena_t *arena)
+{
+    return arena ? arena->arenas : 0;
+}
+
+void *box_arena_meta(box_arena_t *arena, const uint32_t i)
+{
+    if (!arena || i >= arena->arenas)
+        return NULL;
+    return box_arena_slice_meta(arena, i);
+}
+
+// 当前线程优先使用的arena：所在CPU，sched_getcpu 不可用时按线程分散
+static uint32_t box_arena_home(box_arena_t *arena)
+{
+    int cpu = sched_getcpu();
+    if (cpu < 0)
+    {
+        static _Thread_local uint8_t anchor;
+        cpu = (int)(((uintptr_t)&anchor >> 12) & 0x7fffffff);
+    }
+    return (uint32_t)cpu % arena->arenas;
+}
+
+uint64_t box_arena_alloc(box_arena_t *arena, const size_t size)
+{
+    if (!arena)
+        return BOX_FAILED;
+    // 所在arena不足时依次尝试后面的arena
+    uint32_t home = box_arena_home(arena);
+    for (uint32_t k = 0; k < arena->arenas; k++)
+    {
+        uint32_t i = (home + k) % arena->arenas;
+        uint64_t offset = box_alloc(box_arena_slice_meta(arena, i), size);
+        if (offset != BOX_FAILED)
+            return offset + i * arena->slice;
+    }
+    return BOX_FAILED;
+}
+
+// offset所在的arena，超出范围时返回 arenas
+static uint32_t box_arena_of(box_arena_t *arena, uint64_t obj_offset)
+{
+    if (obj_offset >= arena->box_bytessize)
+        return arena->arenas;
+    return (uint32_t)(obj_offset / arena->slice);
+}
+
+void box_arena_free(box_arena_t *arena, const uint64_t obj_offset)
+{
+    if (!arena)
+        return;
+    uint32_t i = box_arena_of(arena, obj_offset);
+    if (i == arena->arenas)
+    {
+        LOG("[ERROR] offset %lu outside the arenas", obj_offset);
+        return;
+    }
+    box_free(box_arena_slice_meta(arena, i), obj_offset - i * arena->slice);
+}
+
+uint64_t box_arena_allocated_size(box_arena_t *arena, const uint64_t obj_offset)
+{
+    if (!arena)
+        return 0;
+    uint32_t i = box_arena_of(arena, obj_offset);
+    if (i == arena->arenas)
+        return 0;
+    return box_allocated_size(box_arena_slice_meta(arena, i), obj_offset - i * arena->slice);
+}
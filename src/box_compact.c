@@ -0,0 +1,309 @@
+/*
+压缩计划：boxmalloc自身不移动obj，这里只给出搬移哪些obj，由调用者复制数据。
+
+box_compact_plan 在objlevel为目标level的节点中，找连续 target.multiple 个槽位组成的窗口，
+窗口内的obj（含子树中的obj）全部搬走后，窗口即可容纳目标大小的obj。
+选择需要搬移的字节数最少（其次obj数最少）的窗口，再为窗口内的每个obj预先分配窗口之外的新位置。
+
+为了让新位置不落在窗口内，分配到窗口内的offset先作为占位保留，全部新位置分配完成后再释放占位。
+
+遍历与 box_purge_walk 相同，逐层交替加锁：持有父节点的读锁时给子节点加读锁，再pin住父节点、释放其读锁，
+子节点处理完后重新加读锁并撤销pin。pin期间父节点不会被回收，子节点的block id始终来自仍持有锁的父节点。
+窗口更优时在同一把读锁下收集其中的obj，计划中的offset与选中窗口时节点的状态一致。
+计划是某一时刻的估计，并发分配/释放可能使窗口再次被占用，box_commit_move 会重新确认。
+*/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#include <boxmalloc/boxmalloc.h>
+#include "obj_usage.h"
+#include "logutil.h"
+#include "lock.h"
+#include "box.h"
+
+// 选中的窗口：节点的block id、节点起始offset、窗口的起始槽位，以及搬移代价
+typedef struct
+{
+    int64_t node_id;
+    uint64_t base;
+    uint8_t slot;
+    uint64_t bytes;
+    uint64_t count;
+} box_window_t;
+
+// objlevel层上n个槽位的字节数
+static uint64_t box_slots_bytes(uint8_t objlevel, uint8_t n)
+{
+    return n * obj_offset((obj_usage){.level = objlevel, .multiple = 1});
+}
+
+/*
+ * node子树中已分配的字节数和obj数。
+ * 线程安全需求：调用者持有node的锁；子节点加读锁，锁顺序从父到子。
+ */
+static void box_subtree_usage(box_meta_t *meta, box_head_t *node, uint64_t *bytes, uint64_t *count)
+{
+    for (int i = 0; i < node->avliable_slot; i++)
+    {
+        uint8_t state = box_slot_state(node, i);
+        if (state == OBJ_START)
+        {
+            *bytes += box_slots_bytes(node->objlevel, box_obj_slots(node, i));
+            (*count)++;
+        }
+        else if (state == BOX_FORMATTED)
+        {
+            box_head_t *child = box_node(meta, node->childs_blockid[i]);
+            rlock(&child->rw_lock);
+            box_subtree_usage(meta, child, bytes, count);
+            runlock(&child->rw_lock);
+        }
+    }
+}
+
+/*
+ * 在node的每个 multiple 个槽位的窗口中，找搬移代价最小的窗口，优于best时更新best并返回true。
+ * 窗口与某个obj的槽位相交时整个obj都要搬走。
+ * 线程安全需求：调用者持有node的读锁。
+ */
+static bool box_plan_windows(box_meta_t *meta, box_head_t *node, int64_t node_id, uint64_t base,
+                             uint8_t multiple, size_t max_moves, box_window_t *best)
+{
+    uint8_t first[16], last[16];
+    uint64_t bytes[16], count[16];
+    int items = 0;
+    for (int i = 0; i < node->avliable_slot; i++)
+    {
+        uint8_t state = box_slot_state(node, i);
+        if (state == BOX_UNUSED || state == OBJ_CONTINUED)
+            continue;
+        first[items] = i;
+        bytes[items] = 0;
+        count[items] = 0;
+        if (state == OBJ_START)
+        {
+            last[items] = i + box_obj_slots(node, i) - 1;
+            bytes[items] = box_slots_bytes(node->objlevel, last[items] - i + 1);
+            count[items] = 1;
+        }
+        else
+        {
+            last[items] = i;
+            box_head_t *child = box_node(meta, node->childs_blockid[i]);
+            rlock(&child->rw_lock);
+            box_subtree_usage(meta, child, &bytes[items], &count[items]);
+            runlock(&child->rw_lock);
+        }
+        items++;
+    }
+
+    bool updated = false;
+    for (int w = 0; w + multiple <= node->avliable_slot; w++)
+    {
+        uint64_t window_bytes = 0, window_count = 0;
+        for (int k = 0; k < items; k++)
+        {
+            if (first[k] < w + multiple && last[k] >= w)
+            {
+                window_bytes += bytes[k];
+                window_count += count[k];
+            }
+        }
+        // 搬移的字节数不小于窗口本身时没有意义
+        if (window_count > max_moves || window_bytes >= box_slots_bytes(node->objlevel, multiple))
+            continue;
+        if (best->node_id < 0 || window_bytes < best->bytes || (window_bytes == best->bytes && window_count < best->count))
+        {
+            *best = (box_window_t){.node_id = node_id, .base = base, .slot = w, .bytes = window_bytes, .count = window_count};
+            updated = true;
+        }
+    }
+    return updated;
+}
+
+/*
+ * 收集node（起始于base）中与槽位 [from, to] 相交的obj，子节点中的obj全部收集。
+ * 线程安全需求：调用者持有node的锁；子节点加读锁，锁顺序从父到子。
+ * 超过max个obj时返回false。
+ */
+static bool box_plan_collect(box_meta_t *meta, box_head_t *node, uint64_t base, int from, int to,
+                             box_move_t *out, size_t max, size_t *n)
+{
+    for (int i = 0; i < node->avliable_slot; i++)
+    {
+        uint8_t state = box_slot_state(node, i);
+        uint64_t offset = base + box_slots_bytes(node->objlevel, i);
+        if (state == OBJ_START)
+        {
+            uint8_t slots = box_obj_slots(node, i);
+            if (i > to || i + slots - 1 < from)
+                continue;
+            if (*n >= max)
+                return false;
+            out[(*n)++] = (box_move_t){.old_offset = offset, .new_offset = BOX_FAILED, .size = box_slots_bytes(node->objlevel, slots)};
+        }
+        else if (state == BOX_FORMATTED && i >= from && i <= to)
+        {
+            box_head_t *child = box_node(meta, node->childs_blockid[i]);
+            rlock(&child->rw_lock);
+            bool fits = box_plan_collect(meta, child, offset, 0, 15, out, max, n);
+            runlock(&child->rw_lock);
+            if (!fits)
+                return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * 从node（起始于base）向下找objlevel为target.level的节点，逐个评估其中的窗口，
+ * best更新时把窗口中的obj收集到moves，个数写入n。
+ * 线程安全需求：调用者持有node的读锁，返回前释放。子节点逐层交替加锁，见文件开头。
+ */
+static void box_plan_walk(box_meta_t *meta, box_head_t *node, uint64_t base, obj_usage target, size_t max_moves,
+                          box_window_t *best, box_move_t *moves, size_t *n)
+{
+    if (node->objlevel == target.level)
+    {
+        if (box_plan_windows(meta, node, box_node_id(meta, node), base, target.multiple, max_moves, best))
+        {
+            // 子节点的锁在评估后已释放，其中的obj可能又变多；超过max_moves时放弃该窗口
+            *n = 0;
+            if (!box_plan_collect(meta, node, base, best->slot, best->slot + target.multiple - 1, moves, max_moves, n))
+                *best = (box_window_t){.node_id = -1};
+        }
+        runlock(&node->rw_lock);
+        return;
+    }
+
+    int next = 0;
+    while (next < 16)
+    {
+        uint16_t formatted = box_formatted_mask(node) & (uint16_t)(0xFFFF << next);
+        if (!formatted)
+            break;
+        int i = __builtin_ctz(formatted);
+        next = i + 1;
+        box_head_t *child = box_node(meta, node->childs_blockid[i]);
+        rlock(&child->rw_lock);
+        lock_pin(&node->rw_lock);
+        runlock(&node->rw_lock);
+        box_plan_walk(meta, child, base + box_slots_bytes(node->objlevel, i), target, max_moves, best, moves, n);
+        rlock(&node->rw_lock);
+        lock_unpin(&node->rw_lock);
+    }
+    runlock(&node->rw_lock);
+}
+
+static int compare_move_size(const void *a, const void *b)
+{
+    uint64_t x = ((const box_move_t *)a)->size;
+    uint64_t y = ((const box_move_t *)b)->size;
+    return (x < y) - (x > y);
+}
+
+/*
+ * 为moves中的每个obj分配窗口 [start, end) 之外的新位置。
+ * 落在窗口内的分配作为占位，全部完成后释放；任何一个分配失败时归还已分配的新位置，返回false。
+ */
+static bool box_plan_reserve(void *metaptr, box_move_t *moves, size_t n, uint64_t start, uint64_t end)
+{
+    uint64_t *fillers = NULL;
+    size_t fillers_count = 0, fillers_cap = 0;
+    size_t done = 0;
+    while (done < n)
+    {
+        uint64_t offset = box_alloc(metaptr, moves[done].size);
+        if (offset == BOX_FAILED)
+            break;
+        if (offset < end && offset + moves[done].size > start)
+        {
+            if (fillers_count == fillers_cap)
+            {
+                fillers_cap = fillers_cap ? fillers_cap * 2 : 64;
+                uint64_t *grown = realloc(fillers, fillers_cap * sizeof(uint64_t));
+                if (!grown)
+                {
+                    box_free(metaptr, offset);
+                    break;
+                }
+                fillers = grown;
+            }
+            fillers[fillers_count++] = offset;
+            continue;
+        }
+        moves[done++].new_offset = offset;
+    }
+    box_free_n(metaptr, fillers, fillers_count);
+    free(fillers);
+    if (done == n)
+        return true;
+
+    for (size_t i = 0; i < done; i++)
+        box_free(metaptr, moves[i].new_offset);
+    return false;
+}
+
+size_t box_compact_plan(void *metaptr, const size_t target_size, box_move_t *moves, const size_t max_moves)
+{
+    box_meta_t *meta = metaptr;
+    if (!metaptr || !moves || box_check_magic(meta) != 0 || target_size == 0)
+    {
+        LOG("[ERROR] invalid arguments for box_compact_plan");
+        return BOX_COMPACT_FAILED;
+    }
+    obj_usage target = align_to((target_size + 8 - 1) / 8);
+
+    box_head_t *root = box_lock_root(meta, false);
+    uint8_t root_level = root->objlevel;
+    uint8_t root_slots = root->avliable_slot;
+    bool fits = compare_obj_usage(root->child_max_obj_capacity, target) >= 0 ||
+                (target.level < root_level && root->max_obj_capacity > 0) ||
+                (target.level == root_level && target.multiple <= root->max_obj_capacity);
+    if (fits || target.level > root_level || (target.level == root_level && target.multiple > root_slots))
+    {
+        runlock(&root->rw_lock);
+        if (fits)
+            return 0;
+        LOG("[ERROR] target size %zu larger than the box", target_size);
+        return BOX_COMPACT_FAILED;
+    }
+
+    box_window_t best = {.node_id = -1};
+    size_t n = 0;
+    box_plan_walk(meta, root, 0, target, max_moves, &best, moves, &n);
+    if (best.node_id < 0)
+    {
+        LOG("[ERROR] no window frees %zu bytes within %zu moves", target_size, max_moves);
+        return BOX_COMPACT_FAILED;
+    }
+
+    // 先为大的obj找位置
+    qsort(moves, n, sizeof(box_move_t), compare_move_size);
+    uint64_t start = best.base + box_slots_bytes(target.level, best.slot);
+    if (!box_plan_reserve(metaptr, moves, n, start, start + box_slots_bytes(target.level, target.multiple)))
+    {
+        LOG("[ERROR] not enough free space outside the window for %zu objects", n);
+        return BOX_COMPACT_FAILED;
+    }
+    LOG("[INFO] compact plan: %zu objects, %lu bytes to move to free object+%lu", n, best.bytes, start);
+    return n;
+}
+
+int box_commit_move(void *metaptr, const box_move_t *move)
+{
+    if (!metaptr || !move)
+        return -1;
+    if (box_allocated_size(metaptr, move->old_offset) != move->size ||
+        box_allocated_size(metaptr, move->new_offset) != move->size)
+    {
+        LOG("[ERROR] move object+%lu -> object+%lu no longer valid", move->old_offset, move->new_offset);
+        return -1;
+    }
+    box_free(metaptr, move->old_offset);
+    return 0;
+}
@@ -0,0 +1,188 @@
+/*
+指针接口：把meta区和obj区的起始地址绑定在一起，像 malloc/free 一样使用指针，而不是offset。
+
+box_heap_t 放在调用者提供的meta区开头，其后才是box的meta区，不需要额外分配内存，
+因此也可以用来实现 malloc 本身（见 box_preload.c）。
+
+对齐：与 malloc 相同，大于8字节的分配按16字节对齐。
+X*16^N*8 中 N>=1 的obj（>=128字节）天然按128字节对齐；N=0 的obj只按8字节对齐，
+9~127字节的请求向上取整到16的倍数后用 box_alloc_aligned 分配。
+box_alloc_aligned 只对齐obj在obj区内的offset，指针的对齐还受base的对齐限制，
+因此 box_heap_aligned_alloc 不接受超过base实际对齐的align。
+*/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <boxmalloc/boxmalloc.h>
+#include "logutil.h"
+#include "box.h"
+
+struct box_heap
+{
+    uint8_t *meta; // box的meta区
+    uint8_t *base; // obj区
+    uint64_t bytes;
+};
+
+// box_heap_t 在meta区开头占用的字节数
+#define BOX_HEAP_HEADER 64
+_Static_assert(sizeof(box_heap_t) <= BOX_HEAP_HEADER, "box_heap_t must fit in its header");
+
+#define BOX_HEAP_ALIGN 16
+
+box_heap_t *box_heap_create(void *metaptr, const size_t meta_bytes, void *base, const size_t bytes, const box_options_t *options)
+{
+    if (!metaptr || !base || meta_bytes <= BOX_HEAP_HEADER || (uintptr_t)base % BOX_HEAP_ALIGN != 0)
+    {
+        LOG("[ERROR] invalid meta or obj region for box_heap_create");
+        return NULL;
+    }
+    box_heap_t *heap = metaptr;
+    uint8_t *meta = (uint8_t *)metaptr + BOX_HEAP_HEADER;
+    if (box_init_ex(meta, meta_bytes - BOX_HEAP_HEADER, bytes, options) != 0)
+        return NULL;
+    heap->meta = meta;
+    heap->base = base;
+    heap->bytes = bytes;
+    return heap;
+}
+
+void *box_heap_meta(box_heap_t *heap)
+{
+    return heap ? heap->meta : NULL;
+}
+
+// 实际向box请求的字节数：大于8字节时取整到16的倍数，溢出时返回0
+static size_t box_heap_request(size_t size)
+{
+    if (size <= 8)
+        return 8;
+    if (size > SIZE_MAX - (BOX_HEAP_ALIGN - 1))
+        return 0;
+    return (size + BOX_HEAP_ALIGN - 1) & ~(size_t)(BOX_HEAP_ALIGN - 1);
+}
+
+// request 字节的obj是否需要按16字节对齐分配：128字节以上的obj本身已对齐
+static bool box_heap_needs_align(size_t request)
+{
+    return request > 8 && request < 128;
+}
+
+static uint64_t box_heap_alloc_offset(box_heap_t *heap, size_t size)
+{
+    size_t request = box_heap_request(size);
+    if (request == 0)
+        return BOX_FAILED;
+    if (box_heap_needs_align(request))
+        return box_alloc_aligned(heap->meta, request, BOX_HEAP_ALIGN);
+    return box_alloc(heap->meta, request);
+}
+
+// ptr在obj区内时返回其offset，否则返回 BOX_FAILED
+static uint64_t box_heap_offset(box_heap_t *heap, const void *ptr)
+{
+    const uint8_t *p = ptr;
+    if (p < heap->base || p >= heap->base + heap->bytes)
+        return BOX_FAILED;
+    return p - heap->base;
+}
+
+void *box_heap_malloc(box_heap_t *heap, const size_t size)
+{
+    if (!heap)
+        return NULL;
+    uint64_t offset = box_heap_alloc_offset(heap, size);
+    return offset == BOX_FAILED ? NULL : heap->base + offset;
+}
+
+void box_heap_free(box_heap_t *heap, void *ptr)
+{
+    if (!heap || !ptr)
+        return;
+    uint64_t offset = box_heap_offset(heap, ptr);
+    if (offset == BOX_FAILED)
+    {
+        LOG("[ERROR] free of %p outside the heap", ptr);
+        return;
+    }
+    box_free(heap->meta, offset);
+}
+
+size_t box_heap_usable_size(box_heap_t *heap, const void *ptr)
+{
+    if (!heap || !ptr)
+        return 0;
+    uint64_t offset = box_heap_offset(heap, ptr);
+    return offset == BOX_FAILED ? 0 : box_allocated_size(heap->meta, offset);
+}
+
+bool box_heap_contains(box_heap_t *heap, const void *ptr)
+{
+    return heap && ptr && box_heap_offset(heap, ptr) != BOX_FAILED;
+}
+
+void *box_heap_realloc(box_heap_t *heap, void *ptr, const size_t size)
+{
+    if (!heap)
+        return NULL;
+    if (!ptr)
+        return box_heap_malloc(heap, size);
+    uint64_t offset = box_heap_offset(heap, ptr);
+    uint64_t old_size = offset == BOX_FAILED ? 0 : box_allocated_size(heap->meta, offset);
+    size_t request = box_heap_request(size);
+    if (old_size == 0 || request == 0)
+    {
+        LOG("[ERROR] realloc of %p failed", ptr);
+        return NULL;
+    }
+
+    // 先尝试原地调整，起始offset不变；8字节的obj未必按16字节对齐，扩大时直接另行分配
+    uint64_t moved = BOX_FAILED;
+    if (request == 8 || offset % BOX_HEAP_ALIGN == 0)
+    {
+        moved = box_realloc(heap->meta, offset, request);
+        if (moved == offset)
+            return ptr;
+    }
+    // box_realloc 另行分配的obj不满足对齐时改为对齐分配
+    if (moved != BOX_FAILED && box_heap_needs_align(request) && moved % BOX_HEAP_ALIGN != 0)
+    {
+        box_free(heap->meta, moved);
+        moved = BOX_FAILED;
+    }
+    if (moved == BOX_FAILED)
+        moved = box_heap_alloc_offset(heap, size);
+    if (moved == BOX_FAILED)
+        return NULL;
+    memcpy(heap->base + moved, ptr, old_size < size ? old_size : size);
+    box_free(heap->meta, offset);
+    return heap->base + moved;
+}
+
+void *box_heap_aligned_alloc(box_heap_t *heap, const size_t align, const size_t size)
+{
+    if (!heap || align == 0 || (align & (align - 1)) != 0)
+        return NULL;
+    if (align <= BOX_HEAP_ALIGN)
+        return box_heap_malloc(heap, size);
+    // base + offset 的对齐不会超过base本身的对齐
+    if (align > (uintptr_t)1 << __builtin_ctzll((uintptr_t)heap->base))
+    {
+        LOG("[ERROR] align %zu exceeds the alignment of the obj region %p", align, (void *)heap->base);
+        return NULL;
+    }
+    size_t request = box_heap_request(size);
+    if (request == 0)
+        return NULL;
+    uint64_t offset = box_alloc_aligned(heap->meta, request, align);
+    return offset == BOX_FAILED ? NULL : heap->base + offset;
+}
+
+size_t box_heap_purge(box_heap_t *heap, const size_t min_bytes)
+{
+    if (!heap)
+        return 0;
+    return box_purge(heap->meta, min_bytes, box_purge_madvise, heap->base);
+}
@@ -0,0 +1,137 @@
+/*
+运行时统计的线程注册与汇总，见 box_instr.h。
+
+每个线程的计数器放在 _Thread_local 变量中（不调用malloc，libboxmalloc_preload.so 中也可以使用），
+第一次计数时挂到全局链表上；线程退出时由pthread key的析构函数把计数并入 retired 后摘下。
+链表和 retired 由 box_instr_mutex 保护，只有注册、退出、snapshot、reset 时加锁。
+*/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <boxmalloc/boxmalloc.h>
+#include "box_instr.h"
+
+atomic_bool box_instr_on;
+_Thread_local box_instr_thread_t box_instr_local;
+
+static pthread_mutex_t box_instr_mutex = PTHREAD_MUTEX_INITIALIZER;
+static box_instr_thread_t *box_instr_threads;
+static uint64_t box_instr_retired[BOX_INSTR_WORDS];
+static pthread_key_t box_instr_key;
+static pthread_once_t box_instr_key_once = PTHREAD_ONCE_INIT;
+
+uint64_t box_instr_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void box_instr_thread_exit(void *arg)
+{
+    box_instr_thread_t *t = arg;
+    pthread_mutex_lock(&box_instr_mutex);
+    for (size_t i = 0; i < BOX_INSTR_WORDS; i++)
+        box_instr_retired[i] += atomic_load_explicit(&t->words[i], memory_order_relaxed);
+    if (t->prev)
+        t->prev->next = t->next;
+    else
+        box_instr_threads = t->next;
+    if (t->next)
+        t->next->prev = t->prev;
+    t->registered = false;
+    pthread_mutex_unlock(&box_instr_mutex);
+}
+
+static void box_instr_key_create(void)
+{
+    pthread_key_create(&box_instr_key, box_instr_thread_exit);
+}
+
+void box_instr_register(void)
+{
+    box_instr_thread_t *t = &box_instr_local;
+    pthread_once(&box_instr_key_once, box_instr_key_create);
+    pthread_setspecific(box_instr_key, t);
+    pthread_mutex_lock(&box_instr_mutex);
+    t->prev = NULL;
+    t->next = box_instr_threads;
+    if (box_instr_threads)
+        box_instr_threads->prev = t;
+    box_instr_threads = t;
+    t->registered = true;
+    pthread_mutex_unlock(&box_instr_mutex);
+}
+
+// 2的幂分桶：[2^k, 2^(k+1)) 计入第k项，0计入第0项
+static size_t box_instr_log2(uint64_t n)
+{
+    size_t k = n ? 63 - __builtin_clzll(n) : 0;
+    return k < BOX_INSTR_BUCKETS ? k : BOX_INSTR_BUCKETS - 1;
+}
+
+static size_t box_instr_clamp(uint64_t n, size_t max)
+{
+    return n < max ? n : max - 1;
+}
+
+void box_instr_alloc_end(uint64_t t0, int reason)
+{
+    box_instr_thread_t *t = &box_instr_local;
+    box_instr_add(BOX_INSTR_WORD(allocs), 1);
+    box_instr_add(BOX_INSTR_WORD(alloc_ns) + box_instr_log2(box_instr_now() - t0), 1);
+    box_instr_add(BOX_INSTR_WORD(depth) + box_instr_clamp(t->depth, BOX_INSTR_LEVELS), 1);
+    box_instr_add(BOX_INSTR_WORD(scanned) + box_instr_clamp(t->scanned, BOX_INSTR_BUCKETS), 1);
+    box_instr_add(BOX_INSTR_WORD(propagation) + box_instr_clamp(t->propagation, BOX_INSTR_LEVELS), 1);
+    if (reason == BOX_INSTR_TOO_LARGE)
+        box_instr_add(BOX_INSTR_WORD(fail_too_large), 1);
+    else if (reason == BOX_INSTR_NO_RUN)
+        box_instr_add(BOX_INSTR_WORD(fail_no_run), 1);
+    else if (reason == BOX_INSTR_META)
+        box_instr_add(BOX_INSTR_WORD(fail_meta), 1);
+}
+
+void box_instr_free_end(uint64_t t0)
+{
+    box_instr_thread_t *t = &box_instr_local;
+    box_instr_add(BOX_INSTR_WORD(frees), 1);
+    box_instr_add(BOX_INSTR_WORD(free_ns) + box_instr_log2(box_instr_now() - t0), 1);
+    box_instr_add(BOX_INSTR_WORD(propagation) + box_instr_clamp(t->propagation, BOX_INSTR_LEVELS), 1);
+}
+
+void box_instr_enable(const bool enable)
+{
+    atomic_store(&box_instr_on, enable);
+}
+
+void box_instr_snapshot(box_instr_t *out)
+{
+    if (!out)
+        return;
+    uint64_t *words = (uint64_t *)out;
+    pthread_mutex_lock(&box_instr_mutex);
+    memcpy(words, box_instr_retired, sizeof(box_instr_retired));
+    for (box_instr_thread_t *t = box_instr_threads; t; t = t->next)
+    {
+        for (size_t i = 0; i < BOX_INSTR_WORDS; i++)
+            words[i] += atomic_load_explicit(&t->words[i], memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&box_instr_mutex);
+}
+
+void box_instr_reset(void)
+{
+    pthread_mutex_lock(&box_instr_mutex);
+    memset(box_instr_retired, 0, sizeof(box_instr_retired));
+    for (box_instr_thread_t *t = box_instr_threads; t; t = t->next)
+    {
+        for (size_t i = 0; i < BOX_INSTR_WORDS; i++)
+            atomic_store_explicit(&t->words[i], 0, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&box_instr_mutex);
+}
@@ -0,0 +1,101 @@
+#ifndef BOX_INSTR_H
+#define BOX_INSTR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+/*
+运行时开关的统计（box_instr.c），替代高负载下无法使用的 LOG。
+
+关闭时每个埋点只有一次对 box_instr_on 的relaxed读取和一个几乎总是不跳转的分支。
+计数器按线程累加：box_instr_t 的每个字段看作一个64位字，线程只写自己的 words，
+用relaxed原子读写（单一写者，不需要原子加），box_instr_snapshot 汇总所有线程。
+depth/scanned/propagation 是当前这一次分配或释放的临时计数，结束时计入直方图。
+*/
+#define BOX_INSTR_WORDS (sizeof(box_instr_t) / sizeof(uint64_t))
+#define BOX_INSTR_WORD(field) (offsetof(box_instr_t, field) / sizeof(uint64_t))
+
+typedef struct box_instr_thread
+{
+    atomic_uint_fast64_t words[BOX_INSTR_WORDS];
+    uint32_t depth;
+    uint32_t scanned;
+    uint32_t propagation;
+    bool registered;
+    struct box_instr_thread *prev, *next;
+} box_instr_thread_t;
+
+// 分配失败的原因
+#define BOX_INSTR_OK 0
+#define BOX_INSTR_TOO_LARGE 1
+#define BOX_INSTR_NO_RUN 2
+#define BOX_INSTR_META 3
+
+extern atomic_bool box_instr_on;
+extern _Thread_local box_instr_thread_t box_instr_local;
+
+uint64_t box_instr_now(void);
+void box_instr_register(void);
+void box_instr_alloc_end(uint64_t t0, int reason);
+void box_instr_free_end(uint64_t t0);
+
+static inline bool box_instr_enabled(void)
+{
+    return __builtin_expect(atomic_load_explicit(&box_instr_on, memory_order_relaxed), 0);
+}
+
+static inline void box_instr_add(size_t word, uint64_t n)
+{
+    atomic_uint_fast64_t *w = &box_instr_local.words[word];
+    atomic_store_explicit(w, atomic_load_explicit(w, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// 分配/释放开始：未开启时返回0，结束时据此跳过
+static inline uint64_t box_instr_begin(void)
+{
+    if (!box_instr_enabled())
+        return 0;
+    if (!box_instr_local.registered)
+        box_instr_register();
+    box_instr_local.depth = 0;
+    box_instr_local.scanned = 0;
+    box_instr_local.propagation = 0;
+    return box_instr_now();
+}
+
+// box_find_alloc 进入一层
+static inline void box_instr_descend(void)
+{
+    if (box_instr_enabled())
+        box_instr_local.depth++;
+}
+
+// 检查一个候选子节点
+static inline void box_instr_scan(void)
+{
+    if (box_instr_enabled())
+        box_instr_local.scanned++;
+}
+
+// update_parent 向上传递一层
+static inline void box_instr_propagate(void)
+{
+    if (box_instr_enabled())
+        box_instr_local.propagation++;
+}
+
+static inline void box_instr_count(size_t word)
+{
+    if (box_instr_enabled())
+    {
+        if (!box_instr_local.registered)
+            box_instr_register();
+        box_instr_add(word, 1);
+    }
+}
+
+#endif // BOX_INSTR_H
@@ -0,0 +1,230 @@
+/*
+按offset顺序遍历obj区：依次报告每个已分配的obj和每段最长的连续空闲区域，不建立额外的表。
+
+游标 box_iter_t 由调用者提供，内部是从根到当前节点的路径（最多17层），每层保存节点槽位的副本，
+因此不分配内存，每个节点只在第一次进入时加读锁读取一次。
+空闲区域跨越相邻的槽位和兄弟子树时合并报告：遇到obj或遍历结束时才报告累积的空闲区域。
+
+从任意offset开始：只报告起始offset不小于from的obj，包含from的空闲区域从from处截断，
+因此可以分段遍历，后一段从前一段最后报告的区域的末尾开始即可无缝衔接。
+
+并发：每个节点的副本是读取时的状态，遍历期间的分配/释放可能反映、也可能不反映在结果中。
+路径上的节点在出栈前一直pin住（跨越 box_iter_next 调用），与 box_purge_walk 相同，pin住的节点不会被回收，
+进入子节点时只需给父节点加读锁、确认槽位上仍是子节点，再读取其中当前的子节点；已不是子节点时跳过该槽位，
+其前后的空闲区域不合并。遍历期间变空的节点在出栈时回收（box_unpin）。
+*/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <boxmalloc/boxmalloc.h>
+#include "obj_usage.h"
+#include "logutil.h"
+#include "lock.h"
+#include "box.h"
+
+// 路径上的一个节点
+typedef struct
+{
+    int32_t id;
+    uint8_t slot; // 下一个要处理的槽位
+    uint8_t avliable_slot;
+    uint8_t objlevel;
+    uint8_t reserved;
+    uint16_t free_mask;
+    uint16_t start_mask;
+    uint16_t formatted_mask;
+    uint16_t reserved2;
+    uint64_t base;
+} box_iter_frame_t;
+
+#define BOX_ITER_DEPTH 17
+
+typedef struct
+{
+    box_meta_t *meta;
+    uint64_t from;
+    uint64_t free_offset; // 累积的、尚未报告的空闲区域
+    uint64_t free_bytes;
+    int32_t depth; // 路径上的节点数，-1表示还没有读取根节点
+    uint32_t reserved;
+    box_iter_frame_t stack[BOX_ITER_DEPTH];
+} box_iter_state_t;
+
+_Static_assert(sizeof(box_iter_state_t) <= sizeof(box_iter_t), "box_iter_t too small");
+
+static uint64_t box_iter_slot_bytes(uint8_t objlevel)
+{
+    return obj_offset((obj_usage){.level = objlevel, .multiple = 1});
+}
+
+/*
+ * 复制node的槽位状态，压入路径并pin住node；从包含from的槽位开始。
+ * 线程安全需求：调用者持有node的读锁。
+ */
+static void box_iter_push(box_iter_state_t *it, box_head_t *node, int32_t id, uint64_t base)
+{
+    lock_pin(&node->rw_lock);
+    box_iter_frame_t *f = &it->stack[it->depth++];
+    f->id = id;
+    f->avliable_slot = node->avliable_slot;
+    f->objlevel = node->objlevel;
+    f->base = base;
+    f->free_mask = box_free_mask(node);
+    f->formatted_mask = box_formatted_mask(node);
+    f->start_mask = node->slots.start_mask;
+    uint64_t skip = it->from > base ? (it->from - base) / box_iter_slot_bytes(f->objlevel) : 0;
+    f->slot = skip < f->avliable_slot ? (uint8_t)skip : f->avliable_slot;
+}
+
+// 弹出路径末端的节点，撤销pin
+static void box_iter_pop(box_iter_state_t *it)
+{
+    box_unpin(it->meta, box_node(it->meta, it->stack[--it->depth].id));
+}
+
+// 读取根节点
+static void box_iter_push_root(box_iter_state_t *it)
+{
+    it->depth = 0;
+    box_head_t *root = box_lock_root(it->meta, false);
+    box_iter_push(it, root, (int32_t)box_node_id(it->meta, root), 0);
+    runlock(&root->rw_lock);
+}
+
+/*
+ * 进入路径末端节点第slot个槽位上的子节点（起始于base），槽位已不是子节点时返回false。
+ * 末端节点pin住、不会被回收，加读锁后读到的 childs_blockid 就是该槽位上当前的子节点。
+ */
+static bool box_iter_push_child(box_iter_state_t *it, int slot, uint64_t base)
+{
+    box_head_t *parent = box_node(it->meta, it->stack[it->depth - 1].id);
+    rlock(&parent->rw_lock);
+    if (!(box_formatted_mask(parent) >> slot & 1))
+    {
+        runlock(&parent->rw_lock);
+        return false;
+    }
+    int32_t id = parent->childs_blockid[slot];
+    box_head_t *child = box_node(it->meta, id);
+    rlock(&child->rw_lock);
+    runlock(&parent->rw_lock);
+    box_iter_push(it, child, id, base);
+    runlock(&child->rw_lock);
+    return true;
+}
+
+// 报告并清空累积的空闲区域
+static bool box_iter_flush(box_iter_state_t *it, box_extent_t *out)
+{
+    if (it->free_bytes == 0)
+        return false;
+    *out = (box_extent_t){.offset = it->free_offset, .bytes = it->free_bytes, .kind = BOX_ITER_FREE};
+    it->free_bytes = 0;
+    return true;
+}
+
+int box_iter_begin(void *metaptr, box_iter_t *iter, const uint64_t offset)
+{
+    box_meta_t *meta = (box_meta_t *)metaptr;
+    if (!metaptr || !iter || box_check_magic(meta) != 0)
+    {
+        LOG("[ERROR] invalid arguments for box_iter_begin");
+        return -1;
+    }
+    box_iter_state_t *it = (box_iter_state_t *)iter;
+    it->meta = meta;
+    it->from = offset;
+    it->free_offset = 0;
+    it->free_bytes = 0;
+    it->depth = -1;
+    return 0;
+}
+
+bool box_iter_next(box_iter_t *iter, box_extent_t *out)
+{
+    box_iter_state_t *it = (box_iter_state_t *)iter;
+    if (!it || !it->meta || !out)
+        return false;
+    if (it->depth < 0)
+        box_iter_push_root(it);
+
+    while (it->depth > 0)
+    {
+        box_iter_frame_t *f = &it->stack[it->depth - 1];
+        if (f->slot >= f->avliable_slot)
+        {
+            box_iter_pop(it);
+            continue;
+        }
+        int i = f->slot;
+        uint16_t bit = (uint16_t)(1u << i);
+        uint64_t slot_bytes = box_iter_slot_bytes(f->objlevel);
+        uint64_t start = f->base + i * slot_bytes;
+
+        if (f->free_mask & bit)
+        {
+            // 连续的空闲槽位一次累积，从from处截断
+            uint8_t n = 1 + bitmap_run_after(f->free_mask, i);
+            f->slot += n;
+            uint64_t begin = start > it->from ? start : it->from;
+            uint64_t end = start + n * slot_bytes;
+            if (end <= begin)
+                continue;
+            if (it->free_bytes && it->free_offset + it->free_bytes == begin)
+            {
+                it->free_bytes += end - begin;
+                continue;
+            }
+            bool flushed = box_iter_flush(it, out);
+            it->free_offset = begin;
+            it->free_bytes = end - begin;
+            if (flushed)
+                return true;
+            continue;
+        }
+
+        if (f->formatted_mask & bit)
+        {
+            f->slot++;
+            if (start + slot_bytes <= it->from || f->objlevel == 0 || it->depth >= BOX_ITER_DEPTH)
+                continue;
+            // 子节点已被回收：跳过该槽位，前后的空闲区域不合并
+            if (!box_iter_push_child(it, i, start) && box_iter_flush(it, out))
+                return true;
+            continue;
+        }
+
+        // obj：起始于from之前的obj（从from开始时可能正处在它的 OBJ_CONTINUED 槽位上）整个跳过
+        uint16_t avliable = (uint16_t)((1u << f->avliable_slot) - 1);
+        uint16_t continued = ~(f->free_mask | f->start_mask | f->formatted_mask) & avliable;
+        if (!(f->start_mask & bit))
+        {
+            f->slot += (uint8_t)__builtin_ctz(~(continued >> i));
+            continue;
+        }
+        uint8_t n = 1 + bitmap_run_after(continued, i);
+        if (start < it->from)
+        {
+            f->slot += n;
+            continue;
+        }
+        // 先报告obj之前的空闲区域，下次调用再报告obj
+        if (box_iter_flush(it, out))
+            return true;
+        f->slot += n;
+        *out = (box_extent_t){.offset = start, .bytes = n * slot_bytes, .kind = BOX_ITER_OBJ};
+        return true;
+    }
+    return box_iter_flush(it, out);
+}
+
+void box_iter_end(box_iter_t *iter)
+{
+    box_iter_state_t *it = (box_iter_state_t *)iter;
+    if (!it || !it->meta)
+        return;
+    while (it->depth > 0)
+        box_iter_pop(it);
+}
@@ -0,0 +1,216 @@
+/*
+libboxmalloc_preload.so：用 LD_PRELOAD 把进程的 malloc/free 等函数替换为 boxmalloc，
+用于在真实服务和通用的分配器基准上与glibc、jemalloc比较RSS和吞吐。
+
+进程内只有一个 box_heap_t，第一次分配时 mmap meta区和obj区（MAP_NORESERVE，只占虚拟地址，按需分配物理页）：
+- BOXMALLOC_HEAP_SIZE：obj区的字节数，须为 8*16^n*x，默认4G
+- meta区按 box_meta_bytes_worst_case(obj区, 16) 预留，任何分配状态下都不会因meta区不足而失败
+- obj区起始地址按 BOX_PRELOAD_BASE_ALIGN 对齐（多映射一段再裁掉首尾），posix_memalign 等的align不超过它时都能满足
+不在obj区内的指针（如 LD_PRELOAD 生效前分配的）在free时忽略。
+每1024次free检查一次已分配的字节数，比上次交还时减少了 BOX_PRELOAD_PURGE_BYTES 以上时，
+用 box_heap_purge 把64K以上的空闲区域交还给操作系统。
+
+这里的代码不能调用任何可能分配内存的函数（printf、dlsym等），编译时不定义 ENABLE_LOG。
+fork时若其它线程正持有节点的锁，子进程中的分配可能死锁，与不处理fork的分配器相同。
+*/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+#define BOX_PRELOAD_DEFAULT_SIZE (4ULL * 1024 * 1024 * 1024)
+// obj区起始地址的对齐，box_heap_aligned_alloc 不接受更大的align；多映射的部分只占虚拟地址
+#define BOX_PRELOAD_BASE_ALIGN (1ULL * 1024 * 1024 * 1024)
+
+#define BOX_PRELOAD_PURGE_INTERVAL 1024
+#define BOX_PRELOAD_PURGE_BYTES (64ULL * 1024 * 1024)
+#define BOX_PRELOAD_PURGE_MIN (64 * 1024)
+
+#define BOX_PRELOAD_UNINIT 0
+#define BOX_PRELOAD_INITING 1
+#define BOX_PRELOAD_READY 2
+#define BOX_PRELOAD_FAILED 3
+
+static box_heap_t *preload_heap_ptr;
+static atomic_int preload_state;
+static atomic_uint preload_frees;
+static atomic_uint_fast64_t preload_high; // 上次交还以来已分配字节数的最高值
+
+static void *preload_map(size_t bytes)
+{
+    void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+// 映射bytes字节，起始地址按align（页大小的倍数）对齐
+static void *preload_map_aligned(size_t bytes, size_t align)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    bytes = (bytes + page - 1) / page * page;
+    uint8_t *p = preload_map(bytes + align);
+    if (!p)
+        return NULL;
+    size_t head = (align - (uintptr_t)p % align) % align;
+    if (head)
+        munmap(p, head);
+    if (align - head)
+        munmap(p + head + bytes, align - head);
+    return p + head;
+}
+
+static box_heap_t *preload_create(void)
+{
+    size_t bytes = BOX_PRELOAD_DEFAULT_SIZE;
+    const char *env = getenv("BOXMALLOC_HEAP_SIZE");
+    if (env && *env)
+        bytes = strtoull(env, NULL, 0);
+    size_t meta_bytes = box_meta_bytes_worst_case(bytes, 16, NULL);
+    if (meta_bytes == 0)
+        return NULL;
+    // box_heap_t 占meta区开头的一页
+    meta_bytes += (size_t)sysconf(_SC_PAGESIZE);
+    void *meta = preload_map(meta_bytes);
+    void *base = preload_map_aligned(bytes, BOX_PRELOAD_BASE_ALIGN);
+    if (!meta || !base)
+        return NULL;
+    return box_heap_create(meta, meta_bytes, base, bytes, NULL);
+}
+
+static box_heap_t *preload_heap(void)
+{
+    int state = atomic_load_explicit(&preload_state, memory_order_acquire);
+    if (state == BOX_PRELOAD_READY)
+        return preload_heap_ptr;
+    int expected = BOX_PRELOAD_UNINIT;
+    if (atomic_compare_exchange_strong(&preload_state, &expected, BOX_PRELOAD_INITING))
+    {
+        preload_heap_ptr = preload_create();
+        state = preload_heap_ptr ? BOX_PRELOAD_READY : BOX_PRELOAD_FAILED;
+        atomic_store_explicit(&preload_state, state, memory_order_release);
+        return preload_heap_ptr;
+    }
+    while ((state = atomic_load_explicit(&preload_state, memory_order_acquire)) == BOX_PRELOAD_INITING)
+        sched_yield();
+    return state == BOX_PRELOAD_READY ? preload_heap_ptr : NULL;
+}
+
+void *malloc(size_t size)
+{
+    void *p = box_heap_malloc(preload_heap(), size);
+    if (!p)
+        errno = ENOMEM;
+    return p;
+}
+
+static void preload_purge(box_heap_t *heap)
+{
+    box_stats_t stats;
+    if (box_stats(box_heap_meta(heap), &stats) != 0)
+        return;
+    uint64_t high = atomic_load_explicit(&preload_high, memory_order_relaxed);
+    if (stats.allocated_bytes > high)
+    {
+        atomic_compare_exchange_strong(&preload_high, &high, stats.allocated_bytes);
+        return;
+    }
+    if (high - stats.allocated_bytes < BOX_PRELOAD_PURGE_BYTES)
+        return;
+    // 只由一个线程交还
+    if (atomic_compare_exchange_strong(&preload_high, &high, stats.allocated_bytes))
+        box_heap_purge(heap, BOX_PRELOAD_PURGE_MIN);
+}
+
+void free(void *ptr)
+{
+    box_heap_t *heap = preload_heap();
+    if (!box_heap_contains(heap, ptr))
+        return;
+    box_heap_free(heap, ptr);
+    if (atomic_fetch_add_explicit(&preload_frees, 1, memory_order_relaxed) % BOX_PRELOAD_PURGE_INTERVAL == 0)
+        preload_purge(heap);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    if (size && n > SIZE_MAX / size)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    // 不调用malloc：优化时编译器会把 malloc+memset(0) 合并成对calloc自身的调用
+    void *p = box_heap_malloc(preload_heap(), n * size);
+    if (!p)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(p, 0, n * size);
+    return p;
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    box_heap_t *heap = preload_heap();
+    if (ptr && size == 0)
+    {
+        free(ptr);
+        return NULL;
+    }
+    if (ptr && !box_heap_contains(heap, ptr))
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    void *p = box_heap_realloc(heap, ptr, size);
+    if (!p)
+        errno = ENOMEM;
+    return p;
+}
+
+int posix_memalign(void **out, size_t align, size_t size)
+{
+    if (align < sizeof(void *) || (align & (align - 1)) != 0)
+        return EINVAL;
+    void *p = box_heap_aligned_alloc(preload_heap(), align, size);
+    if (!p)
+        return ENOMEM;
+    *out = p;
+    return 0;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    void *p = box_heap_aligned_alloc(preload_heap(), align, size);
+    if (!p)
+        errno = ENOMEM;
+    return p;
+}
+
+void *memalign(size_t align, size_t size)
+{
+    return aligned_alloc(align, size);
+}
+
+void *valloc(size_t size)
+{
+    return aligned_alloc((size_t)sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    return aligned_alloc(page, (size + page - 1) / page * page);
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+    return box_heap_usable_size(preload_heap(), ptr);
+}
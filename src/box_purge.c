@@ -0,0 +1,114 @@
+/*
+把空闲的obj区交还给obj区的所有者：boxmalloc不访问obj区，只报告哪些区域已经空闲，
+由回调决定如何处理（madvise、fallocate(PUNCH_HOLE)、TRIM等）。
+
+槽位变为空闲时（释放obj、回收子节点、原地缩小），在节点的 dirty_mask 中记下该槽位；
+box_purge 遍历所有节点，把包含待交还槽位、且不小于min_bytes的连续空闲槽位交给回调，回调全部交还后清除记录。
+小于min_bytes、或回调只交还了一部分（如不含整页）的区域保留记录，相邻的槽位以后空闲时可以合并成更大的区域。
+新格式化的节点的槽位全部视为待交还（所在区域可能被以前的obj用过）。
+
+回调期间持有该节点的写锁，槽位不会被并发的分配占用，因此madvise(MADV_DONTNEED)不会清掉新分配的obj。
+遍历与 box_find_alloc_n 相同地hand-over-hand：持有节点的写锁时锁住子节点，pin住节点后释放，
+子树完成后再取回节点的写锁；子节点在加锁前不会被回收、复用为别处的节点，否则会交还别的节点正在使用的区域。
+*/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <boxmalloc/boxmalloc.h>
+#include "obj_usage.h"
+#include "logutil.h"
+#include "lock.h"
+#include "box.h"
+
+typedef struct
+{
+    size_t min_bytes;
+    box_purge_fn fn;
+    void *ctx;
+    uint64_t purged;
+} box_purge_ctx_t;
+
+/*
+ * 报告node中包含待交还槽位的空闲区域。
+ * 线程安全需求：调用者持有node的写锁。
+ */
+static void box_purge_node(box_head_t *node, uint64_t base, box_purge_ctx_t *purge)
+{
+    uint16_t free = box_free_mask(node);
+    uint16_t dirty = node->slots.dirty_mask & free;
+    uint64_t slot_bytes = obj_offset((obj_usage){.level = node->objlevel, .multiple = 1});
+    while (dirty)
+    {
+        // 包含最低的待交还槽位的整段空闲槽位
+        int i = __builtin_ctz(dirty);
+        int start = i;
+        while (start > 0 && (free >> (start - 1) & 1))
+            start--;
+        int end = i + 1 + bitmap_run_after(free, i);
+        uint16_t run = (uint16_t)(((1u << (end - start)) - 1) << start);
+        dirty &= ~run;
+        uint64_t bytes = (end - start) * slot_bytes;
+        if (bytes < purge->min_bytes)
+            continue;
+        uint64_t released = purge->fn(purge->ctx, base + start * slot_bytes, bytes);
+        purge->purged += released;
+        if (released == bytes)
+            node->slots.dirty_mask &= ~run;
+    }
+}
+
+/*
+ * 报告node（起始于base）及其子树中待交还的区域。
+ * 线程安全需求：进入时调用者持有node的写锁，返回前释放；同一时刻至多持有node和一个子节点的写锁，锁顺序从父到子。
+ */
+static void box_purge_walk(box_meta_t *meta, box_head_t *node, uint64_t base, box_purge_ctx_t *purge)
+{
+    box_purge_node(node, base, purge);
+    uint64_t slot_bytes = obj_offset((obj_usage){.level = node->objlevel, .multiple = 1});
+    int next = 0;
+    while (node->objlevel > 0 && next < 16)
+    {
+        // 取回node后重新读取：释放期间子节点可能被回收或新建
+        uint16_t formatted = box_formatted_mask(node) & (uint16_t)~((1u << next) - 1);
+        if (!formatted)
+            break;
+        int i = __builtin_ctz(formatted);
+        next = i + 1;
+        box_head_t *child = box_node(meta, node->childs_blockid[i]);
+        lock(&child->rw_lock);
+        lock_pin(&node->rw_lock);
+        unlock(&node->rw_lock);
+        box_purge_walk(meta, child, base + i * slot_bytes, purge);
+        lock_pinned(&node->rw_lock);
+    }
+    unlock(&node->rw_lock);
+}
+
+size_t box_purge(void *metaptr, const size_t min_bytes, box_purge_fn fn, void *ctx)
+{
+    box_meta_t *meta = (box_meta_t *)metaptr;
+    if (!metaptr || !fn || box_check_magic(meta) != 0)
+    {
+        LOG("[ERROR] invalid arguments for box_purge");
+        return 0;
+    }
+    box_head_t *root = box_lock_root(meta, true);
+    box_purge_ctx_t purge = {.min_bytes = min_bytes, .fn = fn, .ctx = ctx};
+    box_purge_walk(meta, root, 0, &purge);
+    return purge.purged;
+}
+
+uint64_t box_purge_madvise(void *ctx, const uint64_t offset, const uint64_t bytes)
+{
+    // 只交还区域内的整页
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start = ((uintptr_t)ctx + offset + page - 1) & ~(page - 1);
+    uintptr_t end = ((uintptr_t)ctx + offset + bytes) & ~(page - 1);
+    if (start >= end || madvise((void *)start, end - start, MADV_DONTNEED) != 0)
+        return 0;
+    return end - start;
+}
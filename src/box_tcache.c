@@ -0,0 +1,155 @@
+/*
+线程私有的小对象缓存，位于 box_alloc/box_free 之前。
+
+每个线程为 (0,128] 字节的每种对齐尺寸（8*1 ~ 8*16 字节，共16种obj_usage）保存一组空闲offset。
+缓存命中时不访问共享的meta区，也不加锁；缓存为空时通过 box_alloc_n 批量补充，缓存满时通过 box_free_n 批量归还一半。
+缓存中的obj在box树看来仍是已分配状态。
+
+线程退出时，通过pthread key的析构函数把缓存全部归还给box树。
+*/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include <boxmalloc/boxmalloc.h>
+#include "logutil.h"
+#include "box.h"
+
+#define BOX_TCACHE_MAX_SIZE 128
+#define BOX_TCACHE_CLASSES (BOX_TCACHE_MAX_SIZE / 8)
+#define BOX_TCACHE_DEFAULT_DEPTH 64
+#ifndef BOX_TCACHE_MAX_DEPTH
+#define BOX_TCACHE_MAX_DEPTH 256
+#endif
+
+typedef struct
+{
+    uint32_t count;
+    uint64_t offsets[BOX_TCACHE_MAX_DEPTH];
+} tcache_bin;
+
+typedef struct
+{
+    void *metaptr; // 缓存绑定的meta区
+    bool registered;
+    tcache_bin bins[BOX_TCACHE_CLASSES];
+} tcache_t;
+
+static _Thread_local tcache_t tcache;
+
+static atomic_size_t tcache_depth = BOX_TCACHE_DEFAULT_DEPTH;
+static pthread_key_t tcache_key;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+
+// 8字节单位的size，[1,16] 映射到 bins[0,15]
+static inline int tcache_class(size_t size)
+{
+    return (int)((size + 8 - 1) / 8) - 1;
+}
+
+static void tcache_flush_bin(void *metaptr, tcache_bin *bin, uint32_t keep)
+{
+    if (bin->count <= keep)
+        return;
+    box_free_n(metaptr, &bin->offsets[keep], bin->count - keep);
+    bin->count = keep;
+}
+
+static void tcache_flush_all(tcache_t *cache)
+{
+    if (!cache->metaptr)
+        return;
+    for (int i = 0; i < BOX_TCACHE_CLASSES; i++)
+    {
+        tcache_flush_bin(cache->metaptr, &cache->bins[i], 0);
+    }
+    cache->metaptr = NULL;
+}
+
+static void tcache_thread_exit(void *arg)
+{
+    tcache_flush_all(arg);
+}
+
+static void tcache_key_create(void)
+{
+    pthread_key_create(&tcache_key, tcache_thread_exit);
+}
+
+// 绑定到metaptr；同一线程切换meta区时，先把旧缓存归还
+static void tcache_bind(void *metaptr)
+{
+    if (tcache.metaptr == metaptr)
+        return;
+    tcache_flush_all(&tcache);
+    tcache.metaptr = metaptr;
+    if (!tcache.registered)
+    {
+        pthread_once(&tcache_key_once, tcache_key_create);
+        pthread_setspecific(tcache_key, &tcache);
+        tcache.registered = true;
+    }
+}
+
+void box_tcache_set_depth(size_t depth)
+{
+    if (depth < 1)
+        depth = 1;
+    if (depth > BOX_TCACHE_MAX_DEPTH)
+        depth = BOX_TCACHE_MAX_DEPTH;
+    atomic_store(&tcache_depth, depth);
+}
+
+uint64_t box_tcache_alloc(void *metaptr, const size_t size)
+{
+    if (!metaptr)
+        return BOX_FAILED;
+    if (size == 0 || size > BOX_TCACHE_MAX_SIZE)
+        return box_alloc(metaptr, size);
+
+    tcache_bind(metaptr);
+    tcache_bin *bin = &tcache.bins[tcache_class(size)];
+    if (bin->count == 0)
+    {
+        // 批量补充一半深度
+        size_t depth = atomic_load_explicit(&tcache_depth, memory_order_relaxed);
+        size_t refill = depth / 2 > 0 ? depth / 2 : 1;
+        size_t class_size = (size_t)(tcache_class(size) + 1) * 8;
+        bin->count = box_alloc_n(metaptr, class_size, refill, bin->offsets);
+        if (bin->count == 0)
+        {
+            LOG("[ERROR] tcache refill failed, size %zu", size);
+            return BOX_FAILED;
+        }
+    }
+    return bin->offsets[--bin->count];
+}
+
+void box_tcache_free(void *metaptr, const uint64_t obj_offset, const size_t size)
+{
+    if (!metaptr)
+        return;
+    if (size == 0 || size > BOX_TCACHE_MAX_SIZE)
+    {
+        box_free(metaptr, obj_offset);
+        return;
+    }
+
+    tcache_bind(metaptr);
+    tcache_bin *bin = &tcache.bins[tcache_class(size)];
+    size_t depth = atomic_load_explicit(&tcache_depth, memory_order_relaxed);
+    if (bin->count >= depth)
+    {
+        // 缓存已满，归还一半
+        tcache_flush_bin(metaptr, bin, depth / 2);
+    }
+    bin->offsets[bin->count++] = obj_offset;
+}
+
+void box_tcache_flush(void *metaptr)
+{
+    if (tcache.metaptr == metaptr)
+        tcache_flush_all(&tcache);
+}
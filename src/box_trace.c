@@ -0,0 +1,140 @@
+/*
+分配跟踪：把对一个meta区的 box_alloc/box_free/box_allocated_size 调用记入二进制trace文件，
+用 tools/box_replay 在新的meta区上重放，离线重现生产环境的分配模式。
+
+trace文件 = box_trace_header_t + max_records 个 box_trace_record_t，整个文件mmap到内存，
+每次调用用原子计数器取得一条记录的位置后直接写入，不加锁、不调用write。
+超过max_records的记录丢弃，只计数。
+
+box_trace_meta 为NULL时不跟踪，box_* 函数中的 box_trace 只有一次比较。
+记录时先增加inflight再确认仍在跟踪，box_trace_stop 清除 box_trace_meta 后等inflight归零再unmap，
+因此可以在其它线程仍在调用 box_* 时停止。
+*/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include <boxmalloc/boxmalloc.h>
+#include "logutil.h"
+#include "box.h"
+
+void *_Atomic box_trace_meta;
+
+static struct
+{
+    atomic_bool active; // box_trace_start 到 box_trace_stop 之间，防止重复start
+    int fd;
+    box_trace_header_t *header;
+    box_trace_record_t *records;
+    uint64_t max_records;
+    size_t map_bytes;
+    atomic_uint_fast64_t next;
+    atomic_uint inflight;
+} trace;
+
+int box_trace_start(void *metaptr, const char *path, const uint64_t max_records)
+{
+    box_meta_t *meta = metaptr;
+    if (!metaptr || !path || max_records == 0 || box_check_magic(meta) != 0)
+    {
+        LOG("[ERROR] invalid arguments for box_trace_start");
+        return -1;
+    }
+    bool expected = false;
+    if (!atomic_compare_exchange_strong(&trace.active, &expected, true))
+    {
+        LOG("[ERROR] a trace is already being recorded");
+        return -1;
+    }
+    size_t map_bytes = sizeof(box_trace_header_t) + max_records * sizeof(box_trace_record_t);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    void *map = MAP_FAILED;
+    if (fd >= 0 && ftruncate(fd, (off_t)map_bytes) == 0)
+        map = mmap(NULL, map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        LOG("[ERROR] failed to create trace file %s", path);
+        if (fd >= 0)
+            close(fd);
+        atomic_store(&trace.active, false);
+        return -1;
+    }
+
+    trace.fd = fd;
+    trace.header = map;
+    trace.records = (box_trace_record_t *)((uint8_t *)map + sizeof(box_trace_header_t));
+    trace.max_records = max_records;
+    trace.map_bytes = map_bytes;
+    atomic_store(&trace.next, 0);
+    *trace.header = (box_trace_header_t){
+        .version = BOX_TRACE_VERSION,
+        .record_bytes = sizeof(box_trace_record_t),
+        .box_bytessize = meta->box_bytessize,
+        .boxhead_bytessize = meta->boxhead_bytessize,
+    };
+    memcpy(trace.header->magic, BOX_TRACE_MAGIC, sizeof(trace.header->magic));
+    atomic_store(&box_trace_meta, metaptr);
+    LOG("[INFO] tracing to %s, at most %lu records", path, max_records);
+    return 0;
+}
+
+uint64_t box_trace_stop(void)
+{
+    if (!atomic_load(&trace.active))
+        return 0;
+    atomic_store(&box_trace_meta, NULL);
+    while (atomic_load(&trace.inflight) != 0)
+        sched_yield();
+
+    uint64_t next = atomic_load(&trace.next);
+    uint64_t records = next < trace.max_records ? next : trace.max_records;
+    trace.header->records = records;
+    trace.header->dropped = next - records;
+    munmap(trace.header, trace.map_bytes);
+    if (ftruncate(trace.fd, (off_t)(sizeof(box_trace_header_t) + records * sizeof(box_trace_record_t))) != 0)
+    {
+        LOG("[WARN] failed to truncate the trace file");
+    }
+    close(trace.fd);
+    atomic_store(&trace.active, false);
+    LOG("[INFO] trace stopped, %lu records, %lu dropped", records, next - records);
+    return records;
+}
+
+static uint32_t box_trace_thread(void)
+{
+    static _Thread_local uint32_t tid;
+    if (tid == 0)
+        tid = (uint32_t)syscall(SYS_gettid);
+    return tid;
+}
+
+void box_trace_record(const void *metaptr, uint8_t op, uint64_t size, uint64_t offset)
+{
+    atomic_fetch_add(&trace.inflight, 1);
+    if (atomic_load(&box_trace_meta) == metaptr)
+    {
+        uint64_t i = atomic_fetch_add_explicit(&trace.next, 1, memory_order_relaxed);
+        if (i < trace.max_records)
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            trace.records[i] = (box_trace_record_t){
+                .time_ns = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec,
+                .size = size,
+                .offset = offset,
+                .thread = box_trace_thread(),
+                .op = op,
+            };
+        }
+    }
+    atomic_fetch_sub(&trace.inflight, 1);
+}
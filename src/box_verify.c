@@ -0,0 +1,325 @@
+/*
+一致性检查：在使用崩溃后或共享的meta区之前，确认每个 box_head_t 都满足下列不变式：
+- 节点：state为 BOX_FORMATTED，objlevel比父节点小1，parent指向父节点，avliable_slot∈[1,16]；
+  根节点的槽位正好覆盖整个obj区
+- 槽位：位图互不重叠、不超出 avliable_slot；OBJ_CONTINUED 前面是 OBJ_START 或 OBJ_CONTINUED；
+  BOX_FORMATTED 的槽位不在0层，子节点的block id在meta区内
+- 容量：max_obj_capacity 等于最长的连续空闲槽位数，child_max_obj_capacity 和 child_cap 与子节点实际的容量一致
+
+并行：先从根节点开始逐层展开，直到待检查的子树数达到线程数的8倍，各线程从中领取子树，
+在子树内自下而上递归检查；最后由调用线程自下而上检查展开过的上层节点。
+子树的实际容量写入父节点任务的 child_caps，不同子树写不同的字节，不需要加锁。
+
+修复只改写由槽位和子节点推导出来的容量字段（max_obj_capacity、child_max_obj_capacity、child_cap），
+结构错误（节点、槽位、block id）只报告。出错的子树按没有空闲空间计算，修复后的分配不会进入该子树。
+检查不加锁，调用期间不能有其它线程访问meta区，与 box_attach 相同。
+*/
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <boxmalloc/boxmalloc.h>
+#include "obj_usage.h"
+#include "logutil.h"
+#include "box.h"
+
+// 每个线程平均分到的子树数
+#define BOX_VERIFY_TASKS_PER_THREAD 8
+#define BOX_VERIFY_MAX_THREADS 256
+
+typedef struct
+{
+    int64_t id;
+    int32_t parent_id;
+    int32_t parent_task; // 父节点的任务，根节点为-1
+    uint8_t objlevel;
+    uint8_t slot;           // 在父节点中的槽位
+    bool expanded;          // 子节点已展开为单独的任务，最后检查本节点的容量
+    uint64_t base;
+    uint8_t child_caps[16]; // 各子节点实际容量的 obj_usage_key，由子节点的任务写入
+} box_verify_task_t;
+
+typedef struct
+{
+    box_meta_t *meta;
+    bool repair;
+    box_verify_report_t *out;
+    atomic_uint_fast64_t nodes;
+    atomic_uint_fast64_t violations;
+    atomic_uint_fast64_t repaired;
+    box_verify_task_t *tasks;
+    size_t ntasks;
+    atomic_size_t next; // 下一个待领取的子树任务
+} box_verify_ctx_t;
+
+static void box_verify_report(box_verify_ctx_t *ctx, uint32_t kind, int64_t id, uint64_t offset, bool repaired)
+{
+    uint64_t n = atomic_fetch_add_explicit(&ctx->violations, 1, memory_order_relaxed);
+    if (repaired)
+        atomic_fetch_add_explicit(&ctx->repaired, 1, memory_order_relaxed);
+    if (n < BOX_VERIFY_ERRORS)
+        ctx->out->error[n] = (box_verify_error_t){.kind = kind, .block_id = (int32_t)id, .offset = offset};
+    LOG("[WARN] box_verify: kind %u at block %ld, offset %lu%s", kind, (long)id, offset, repaired ? ", repaired" : "");
+}
+
+// block id对应的节点，不在meta区内时返回NULL
+static box_head_t *box_verify_node(box_meta_t *meta, int64_t id)
+{
+    if (id < 0)
+        return NULL;
+    uint8_t *node = (uint8_t *)box_node(meta, id);
+    if (node < (uint8_t *)box_boxhead(meta) || node + sizeof(box_head_t) > (uint8_t *)meta + meta->boxhead_bytessize)
+        return NULL;
+    return (box_head_t *)node;
+}
+
+/*
+ * 检查节点本身和槽位状态，节点不可用（不能再访问其槽位和子节点）时返回false。
+ * 线程安全需求：没有其它线程访问meta区。
+ */
+static bool box_verify_head(box_verify_ctx_t *ctx, box_head_t *node, int64_t id, int32_t parent_id, uint8_t objlevel, uint64_t base)
+{
+    if (node->state != BOX_FORMATTED || node->objlevel != objlevel || node->parent != parent_id ||
+        node->avliable_slot < 1 || node->avliable_slot > 16)
+    {
+        box_verify_report(ctx, BOX_VERIFY_LINK, id, base, false);
+        return false;
+    }
+    uint64_t slot_bytes = obj_offset((obj_usage){.level = objlevel, .multiple = 1});
+    uint16_t avliable = (uint16_t)((1u << node->avliable_slot) - 1);
+    uint16_t free = node->slots.free_mask, start = node->slots.start_mask, formatted = node->slots.formatted_mask;
+    if ((free & start) || (free & formatted) || (start & formatted) || ((free | start | formatted) & ~avliable))
+        box_verify_report(ctx, BOX_VERIFY_SLOTS, id, base, false);
+    uint8_t prev = BOX_UNUSED;
+    for (int i = 0; i < node->avliable_slot; i++)
+    {
+        uint8_t state = box_slot_state(node, i);
+        if (state == OBJ_CONTINUED && prev != OBJ_START && prev != OBJ_CONTINUED)
+            box_verify_report(ctx, BOX_VERIFY_SLOTS, id, base + i * slot_bytes, false);
+        else if (state == BOX_FORMATTED && objlevel == 0)
+            box_verify_report(ctx, BOX_VERIFY_SLOTS, id, base + i * slot_bytes, false);
+        prev = state;
+    }
+    return true;
+}
+
+/*
+ * 按子节点的实际容量caps检查（修复）node的容量字段，返回node实际的容量key。
+ * 线程安全需求：没有其它线程访问meta区；node的子树已经检查完。
+ */
+static uint8_t box_verify_capacity(box_verify_ctx_t *ctx, box_head_t *node, int64_t id, uint64_t base, const uint8_t caps[16])
+{
+    box_meta_t *meta = ctx->meta;
+    uint8_t longest = bitmap_longest_run(box_free_mask(node));
+    if (node->max_obj_capacity != longest)
+    {
+        if (ctx->repair)
+        {
+            // 同时移动 box_stats 中的计数
+            int8_t before = node->max_obj_capacity;
+            if (before >= 0 && before <= 16)
+            {
+                atomic_fetch_sub_explicit(&meta->ext.counters.free_runs[before], 1, memory_order_relaxed);
+                atomic_fetch_add_explicit(&meta->ext.counters.free_runs[longest], 1, memory_order_relaxed);
+            }
+            node->max_obj_capacity = longest;
+        }
+        box_verify_report(ctx, BOX_VERIFY_MAX_CAPACITY, id, base, ctx->repair);
+    }
+
+    uint8_t child_max = caps_max(caps);
+    bool child_ok = obj_usage_key(node->child_max_obj_capacity) == child_max &&
+                    memcmp(node->child_cap, caps, sizeof(node->child_cap)) == 0;
+    if (!child_ok)
+    {
+        if (ctx->repair)
+        {
+            node->child_max_obj_capacity = obj_usage_from_key(child_max);
+            memcpy(node->child_cap, caps, sizeof(node->child_cap));
+        }
+        box_verify_report(ctx, BOX_VERIFY_CHILD_CAPACITY, id, base, ctx->repair);
+    }
+
+    // 与 box_and_child_max_obj_capacity 相同：16个槽位全部空闲时按[objlevel,15]计算
+    uint8_t own = 0;
+    if (longest > 0)
+        own = obj_usage_key((obj_usage){.level = node->objlevel, .multiple = longest >= 16 ? 15 : longest});
+    return own > child_max ? own : child_max;
+}
+
+/*
+ * 自下而上检查以id为根的子树，返回子树实际的容量key，子树根不可用时返回0。
+ * 线程安全需求：没有其它线程访问meta区。
+ */
+static uint8_t box_verify_subtree(box_verify_ctx_t *ctx, int64_t id, int32_t parent_id, uint8_t objlevel, uint64_t base, uint64_t *nodes)
+{
+    box_meta_t *meta = ctx->meta;
+    box_head_t *node = box_verify_node(meta, id);
+    if (!node)
+    {
+        box_verify_report(ctx, BOX_VERIFY_LINK, id, base, false);
+        return 0;
+    }
+    (*nodes)++;
+    if (!box_verify_head(ctx, node, id, parent_id, objlevel, base))
+        return 0;
+    uint8_t caps[16] = {0};
+    uint16_t formatted = objlevel > 0 ? box_formatted_mask(node) : 0;
+    uint64_t slot_bytes = obj_offset((obj_usage){.level = objlevel, .multiple = 1});
+    while (formatted)
+    {
+        int i = __builtin_ctz(formatted);
+        formatted &= formatted - 1;
+        caps[i] = box_verify_subtree(ctx, node->childs_blockid[i], (int32_t)id, objlevel - 1, base + i * slot_bytes, nodes);
+    }
+    return box_verify_capacity(ctx, node, id, base, caps);
+}
+
+static void box_verify_finish(box_verify_ctx_t *ctx, box_verify_task_t *task, uint8_t cap)
+{
+    if (task->parent_task >= 0)
+        ctx->tasks[task->parent_task].child_caps[task->slot] = cap;
+}
+
+static void *box_verify_worker(void *arg)
+{
+    box_verify_ctx_t *ctx = arg;
+    uint64_t nodes = 0;
+    size_t k;
+    while ((k = atomic_fetch_add_explicit(&ctx->next, 1, memory_order_relaxed)) < ctx->ntasks)
+    {
+        box_verify_task_t *task = &ctx->tasks[k];
+        box_verify_finish(ctx, task, box_verify_subtree(ctx, task->id, task->parent_id, task->objlevel, task->base, &nodes));
+    }
+    atomic_fetch_add_explicit(&ctx->nodes, nodes, memory_order_relaxed);
+    return NULL;
+}
+
+/*
+ * 展开任务k：检查节点本身，把它的子节点追加为新的任务；没有子节点时直接检查容量。
+ * 返回-1表示内存不足。
+ */
+static int box_verify_expand(box_verify_ctx_t *ctx, size_t k, size_t *capacity)
+{
+    box_meta_t *meta = ctx->meta;
+    box_verify_task_t task = ctx->tasks[k];
+    box_head_t *node = box_verify_node(meta, task.id);
+    if (!node)
+    {
+        box_verify_report(ctx, BOX_VERIFY_LINK, task.id, task.base, false);
+        return 0;
+    }
+    atomic_fetch_add_explicit(&ctx->nodes, 1, memory_order_relaxed);
+    if (!box_verify_head(ctx, node, task.id, task.parent_id, task.objlevel, task.base))
+        return 0;
+    uint16_t formatted = task.objlevel > 0 ? box_formatted_mask(node) : 0;
+    if (!formatted)
+    {
+        box_verify_finish(ctx, &ctx->tasks[k], box_verify_capacity(ctx, node, task.id, task.base, task.child_caps));
+        return 0;
+    }
+    if (ctx->ntasks + 16 > *capacity)
+    {
+        box_verify_task_t *tasks = realloc(ctx->tasks, *capacity * 2 * sizeof(box_verify_task_t));
+        if (!tasks)
+            return -1;
+        ctx->tasks = tasks;
+        *capacity *= 2;
+    }
+    ctx->tasks[k].expanded = true;
+    uint64_t slot_bytes = obj_offset((obj_usage){.level = task.objlevel, .multiple = 1});
+    while (formatted)
+    {
+        int i = __builtin_ctz(formatted);
+        formatted &= formatted - 1;
+        ctx->tasks[ctx->ntasks++] = (box_verify_task_t){
+            .id = node->childs_blockid[i],
+            .parent_id = (int32_t)task.id,
+            .parent_task = (int32_t)k,
+            .objlevel = task.objlevel - 1,
+            .slot = i,
+            .base = task.base + i * slot_bytes,
+        };
+    }
+    return 0;
+}
+
+int box_verify(void *metaptr, const unsigned nthreads, const bool repair, box_verify_report_t *out)
+{
+    box_meta_t *meta = (box_meta_t *)metaptr;
+    if (!metaptr || !out || box_check_magic(meta) != 0)
+    {
+        LOG("[ERROR] invalid arguments for box_verify");
+        return -1;
+    }
+    unsigned threads = nthreads;
+    if (threads == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (unsigned)cpus : 1;
+    }
+    if (threads > BOX_VERIFY_MAX_THREADS)
+        threads = BOX_VERIFY_MAX_THREADS;
+
+    memset(out, 0, sizeof(*out));
+    box_verify_ctx_t ctx = {.meta = meta, .repair = repair, .out = out};
+    size_t capacity = 64;
+    ctx.tasks = malloc(capacity * sizeof(box_verify_task_t));
+    if (!ctx.tasks)
+    {
+        LOG("[ERROR] box_verify out of memory");
+        return -1;
+    }
+
+    int64_t root_id = box_root_id(meta);
+    box_head_t *root = box_verify_node(meta, root_id);
+    uint8_t root_level = root ? root->objlevel : 0;
+    if (root && (uint64_t)root->avliable_slot * obj_offset((obj_usage){.level = root_level, .multiple = 1}) != meta->box_bytessize)
+        box_verify_report(&ctx, BOX_VERIFY_LINK, root_id, 0, false);
+    ctx.tasks[0] = (box_verify_task_t){.id = root_id, .parent_id = -1, .parent_task = -1, .objlevel = root_level};
+    ctx.ntasks = 1;
+
+    // 逐层展开，直到待检查的子树足够分给各线程；[0, first)为已展开或已检查的任务
+    size_t target = (size_t)threads * BOX_VERIFY_TASKS_PER_THREAD;
+    size_t first = 0;
+    while (first < ctx.ntasks && ctx.ntasks - first < target)
+    {
+        if (box_verify_expand(&ctx, first, &capacity) != 0)
+        {
+            LOG("[ERROR] box_verify out of memory");
+            free(ctx.tasks);
+            return -1;
+        }
+        first++;
+    }
+
+    atomic_store_explicit(&ctx.next, first, memory_order_relaxed);
+    size_t leaves = ctx.ntasks - first;
+    unsigned started = 0;
+    pthread_t workers[BOX_VERIFY_MAX_THREADS];
+    while (started + 1 < threads && started + 1 < leaves && pthread_create(&workers[started], NULL, box_verify_worker, &ctx) == 0)
+        started++;
+    box_verify_worker(&ctx);
+    for (unsigned i = 0; i < started; i++)
+        pthread_join(workers[i], NULL);
+
+    // 自下而上检查展开过的节点：子节点的任务总在父节点之后
+    for (size_t k = first; k-- > 0;)
+    {
+        box_verify_task_t *task = &ctx.tasks[k];
+        if (task->expanded)
+            box_verify_finish(&ctx, task, box_verify_capacity(&ctx, box_node(meta, task->id), task->id, task->base, task->child_caps));
+    }
+    free(ctx.tasks);
+
+    out->nodes = atomic_load(&ctx.nodes);
+    out->violations = atomic_load(&ctx.violations);
+    out->repaired = atomic_load(&ctx.repaired);
+    out->reported = out->violations < BOX_VERIFY_ERRORS ? (uint32_t)out->violations : BOX_VERIFY_ERRORS;
+    return out->violations == out->repaired ? 0 : 1;
+}
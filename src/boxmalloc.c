@@ -1,6 +1,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdatomic.h>
 
@@ -11,23 +12,21 @@
 #include "logutil.h"
 #include "lock.h"
 #include "box.h"
-
-static int check_magic(box_meta_t *meta) {
-    if (memcmp(meta->magic, BOX_MAGIC, sizeof(BOX_MAGIC)-1) != 0) {
-        return -1;
-    }
-    return 0;
-}
+#include "box_instr.h"
 
 static void box_format(box_meta_t *meta, box_head_t *node, uint8_t objlevel, uint8_t avliable_slot, int32_t parent_id);
 
 int box_init(void *metaptr, const size_t boxhead_bytessize, const size_t box_bytessize)
 {
-    if(check_magic((box_meta_t *)metaptr) == 0) {
-        LOG("[ERROR] box_meta_t already initialized");
-        return -1;
-    }
+    return box_init_ex(metaptr, boxhead_bytessize, box_bytessize, NULL);
+}
 
+/*
+ * 校验box_bytessize和options，按box_init_ex的方式填写meta的头部（不含blocks），box_boxhead(meta)即可得到blocks区的位置。
+ * 只写meta本身，不访问meta之后的内存，可以用于栈上的临时box_meta_t。
+ */
+static int box_meta_header(box_meta_t *meta, const size_t boxhead_bytessize, const size_t box_bytessize, const box_options_t *options)
+{
     if (box_bytessize % 8 != 0)
     {
         LOG("[ERROR] box_bytessize must be aligned to 8. Given size: %zu", box_bytessize);
@@ -39,15 +38,119 @@ int box_init(void *metaptr, const size_t boxhead_bytessize, const size_t box_byt
         LOG("[ERROR] box_bytessize must be aligned to 16. Given size: %zu", box_bytessize);
         return -1;
     }
-    box_meta_t *meta = metaptr;
+    // 索引粒度须为 8*16^n，且小于整个box
+    uint32_t index_level = 0;
+    uint64_t index_entries = 0;
+    if (options && options->index_chunk)
+    {
+        obj_usage chunk = align_to(options->index_chunk / 8);
+        if (options->index_chunk != obj_offset(chunk) || chunk.multiple != 1 || chunk.level == 0 ||
+            chunk.level > rounded_size_t.level)
+        {
+            LOG("[ERROR] index_chunk must be 8*16^n and smaller than the box. Given size: %lu", options->index_chunk);
+            return -1;
+        }
+        index_level = chunk.level;
+        index_entries = (box_bytessize + options->index_chunk - 1) / options->index_chunk;
+        if (index_entries > UINT32_MAX)
+        {
+            LOG("[ERROR] index_chunk %lu too small for box_bytessize %zu", options->index_chunk, box_bytessize);
+            return -1;
+        }
+    }
+
+    uint32_t journal_slots = options ? options->journal_slots : 0;
+    if (journal_slots > BOX_JOURNAL_MAX_SLOTS)
+    {
+        LOG("[ERROR] journal_slots must be <= %d. Given: %u", BOX_JOURNAL_MAX_SLOTS, journal_slots);
+        return -1;
+    }
+
     *meta = (box_meta_t){
+        .layout_version = BOX_LAYOUT_VERSION,
         .boxhead_bytessize = boxhead_bytessize,
         .box_bytessize = box_bytessize,
+        .ext = {
+            .ext_bytessize = sizeof(meta->ext),
+            .empty_keep = options ? options->empty_keep : 0,
+            .policy = options ? options->policy : BOX_FIRST_FIT,
+            .index_level = index_level,
+            .index_entries = index_entries,
+            .journal_slots = journal_slots,
+            .open_state = BOX_OPEN,
+        },
     };
+    return 0;
+}
+
+/*
+ * 初始化后不再变化的字段的校验和（FNV-1a），box_attach 据此判断meta区是否是被破坏或不匹配的文件。
+ * boxhead_bytessize、box_bytessize、blocks等运行中会变化的字段不在其中。
+ */
+static uint64_t box_meta_checksum(const box_meta_t *meta)
+{
+    struct
+    {
+        uint8_t magic[12];
+        uint32_t layout_version;
+        uint64_t ext_bytessize;
+        uint32_t empty_keep;
+        uint32_t policy;
+        uint32_t index_level;
+        uint32_t journal_slots;
+        uint64_t index_entries;
+    } fixed;
+    memset(&fixed, 0, sizeof(fixed));
+    memcpy(fixed.magic, meta->magic, sizeof(fixed.magic));
+    fixed.layout_version = meta->layout_version;
+    fixed.ext_bytessize = meta->ext.ext_bytessize;
+    fixed.empty_keep = meta->ext.empty_keep;
+    fixed.policy = meta->ext.policy;
+    fixed.index_level = meta->ext.index_level;
+    fixed.journal_slots = meta->ext.journal_slots;
+    fixed.index_entries = meta->ext.index_entries;
+
+    uint64_t hash = 14695981039346656037ULL;
+    const uint8_t *bytes = (const uint8_t *)&fixed;
+    for (size_t i = 0; i < sizeof(fixed); i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    return hash;
+}
+
+int box_init_ex(void *metaptr, const size_t boxhead_bytessize, const size_t box_bytessize, const box_options_t *options)
+{
+    if(box_check_magic((box_meta_t *)metaptr) == 0) {
+        LOG("[ERROR] box_meta_t already initialized");
+        return -1;
+    }
+
+    box_meta_t *meta = metaptr;
+    if (box_meta_header(meta, boxhead_bytessize, box_bytessize, options) != 0)
+        return -1;
+    obj_usage rounded_size_t = align_to(box_bytessize / 8);
 
-    blocks_init(&meta->blocks, boxhead_bytessize - sizeof(box_meta_t), sizeof(box_head_t));
+    void *boxhead = box_boxhead(meta);
+    if ((size_t)(boxhead - metaptr) + sizeof(box_head_t) > boxhead_bytessize)
+    {
+        LOG("[ERROR] boxhead_bytessize %zu too small for the index and journal", boxhead_bytessize);
+        return -1;
+    }
+    box_journal_slot_t *journal = box_journal(meta);
+    for (uint32_t k = 0; journal && k < meta->ext.journal_slots; k++)
+    {
+        memset(&journal[k], 0, sizeof(journal[k]));
+        journal[k].free_id = -1;
+    }
+    atomic_int_least32_t *index = box_index(meta);
+    if (index)
+    {
+        for (uint64_t i = 0; i < meta->ext.index_entries; i++)
+            atomic_init(&index[i], -1);
+        // 索引可能指向已回收的block，查找方会对其加读锁后再确认，block复用时不能重置锁
+        memset(boxhead, 0, boxhead_bytessize - (boxhead - metaptr));
+    }
+    blocks_init(&meta->blocks, boxhead_bytessize - (boxhead - metaptr), sizeof(box_head_t));
 
-    void *boxhead=(void *)meta+sizeof(box_meta_t);
     int64_t block_id = blocks_alloc(&meta->blocks, boxhead); // 分配根节点
     if (block_id < 0)
     {
@@ -56,13 +159,96 @@ int box_init(void *metaptr, const size_t boxhead_bytessize, const size_t box_byt
     }
 
     box_head_t *root_boxhead = boxhead + blockdata_offset(&meta->blocks, block_id);
+    atomic_init(&meta->ext.root_id, (int32_t)block_id);
+    atomic_init(&root_boxhead->rw_lock, 0);
     box_format(meta, root_boxhead, rounded_size_t.level, rounded_size_t.multiple, -1);
+
+    // meta区不够容纳最小obj铺满obj区所需的全部节点时，运行中可能因meta区耗尽而分配失败
+    if (boxhead_bytessize < box_meta_bytes_worst_case(box_bytessize, 8, options))
+    {
+        size_t covered = 8;
+        while (covered < box_bytessize && boxhead_bytessize < box_meta_bytes_worst_case(box_bytessize, covered, options))
+            covered *= 16;
+        LOG("[WARN] boxhead_bytessize %zu needs %zu bytes for 8-byte objects; the obj region is covered only for objects >= %zu bytes",
+            boxhead_bytessize, box_meta_bytes_worst_case(box_bytessize, 8, options), covered);
+    }
     
     memset(meta->magic, 0, sizeof(meta->magic));
     memcpy(meta->magic, BOX_MAGIC, sizeof(BOX_MAGIC)-1);
+    meta->ext.checksum = box_meta_checksum(meta);
     LOG("[INFO] box_init success");
     return 0;
 }
+
+// meta区头部（box_meta_t、索引）加上count个block所需的字节数
+static size_t box_meta_bytes(box_meta_t *scratch, const uint64_t count)
+{
+    size_t header = (uint8_t *)box_boxhead(scratch) - (uint8_t *)scratch;
+    // blockmalloc每个block的实际跨度（block_t + box_head_t + 对齐），用临时的blocks_meta_t测量
+    blocks_init(&scratch->blocks, 2 * (sizeof(block_t) + sizeof(box_head_t) + 64), sizeof(box_head_t));
+    size_t first = blockdata_offset(&scratch->blocks, 0);
+    size_t stride = blockdata_offset(&scratch->blocks, 1) - first;
+    return header + first + count * stride;
+}
+
+// objlevel为level的节点在box中最多有多少个
+static uint64_t box_level_nodes_max(const size_t box_bytessize, uint8_t level)
+{
+    uint64_t span = obj_offset((obj_usage){.level = level + 1, .multiple = 1});
+    return (box_bytessize + span - 1) / span;
+}
+
+size_t box_meta_bytes_worst_case(const size_t box_bytessize, const size_t min_obj_size, const box_options_t *options)
+{
+    box_meta_t scratch;
+    if (box_meta_header(&scratch, 0, box_bytessize, options) != 0)
+        return 0;
+    obj_usage root = align_to(box_bytessize / 8);
+    obj_usage min = align_to(min_obj_size > 8 ? (min_obj_size + 7) / 8 : 1);
+
+    // obj只放在objlevel与其level相同的节点中，最坏情况下objlevel>=min.level的每个节点都存在
+    uint64_t count = 1;
+    for (uint8_t level = min.level; level < root.level; level++)
+        count += box_level_nodes_max(box_bytessize, level);
+    return box_meta_bytes(&scratch, count);
+}
+
+size_t box_meta_bytes_required(const size_t box_bytessize, const box_size_count_t *histogram, const size_t n, const box_options_t *options)
+{
+    box_meta_t scratch;
+    if (box_meta_header(&scratch, 0, box_bytessize, options) != 0)
+        return 0;
+    obj_usage root = align_to(box_bytessize / 8);
+
+    // 每个objlevel上obj占用的槽位数
+    uint64_t slots[16] = {0};
+    for (size_t i = 0; i < n; i++)
+    {
+        if (histogram[i].size == 0 || histogram[i].count == 0)
+            continue;
+        if (histogram[i].size > box_bytessize)
+            return 0;
+        // 同一size的obj各自装满节点，16 % multiple 个装不下的槽位也计入
+        obj_usage objsize = align_to((histogram[i].size + 7) / 8);
+        uint64_t per_node = 16 / objsize.multiple;
+        slots[objsize.level] += histogram[i].count / per_node * 16 + histogram[i].count % per_node * objsize.multiple;
+    }
+
+    // 从最低层往上：每16个槽位（obj或下一层的节点）需要一个节点
+    uint64_t count = 1;
+    uint64_t children = 0;
+    for (uint8_t level = 0; level < root.level; level++)
+    {
+        uint64_t used = slots[level] + children;
+        children = (used + 15) / 16;
+        if (children > box_level_nodes_max(box_bytessize, level))
+            return 0;
+        count += children;
+    }
+    if (slots[root.level] + children > root.multiple)
+        return 0;
+    return box_meta_bytes(&scratch, count);
+}
 /*
  * 线程安全需求：
  * - 需要读锁：只读取槽位状态，不修改。
@@ -72,29 +258,77 @@ int box_init(void *metaptr, const size_t boxhead_bytessize, const size_t box_byt
  */
 static uint8_t box_continuous_max(box_head_t *node)
 {
-    uint8_t continuous_count = 0;
-    uint8_t continuous_max = 0;
-    for (int i = 0; i < node->avliable_slot; i++)
+    return bitmap_longest_run(node->slots.free_mask);
+}
+
+_Static_assert(BOX_STATS_LEVELS == sizeof(((box_counters_t *)0)->objects) / sizeof(atomic_uint_fast64_t),
+               "box_stats_t.objects must match box_counters_t");
+
+// 统计objlevel层上占slots个槽位的obj，sign为1（分配）或-1（释放）
+static void box_count_obj(box_meta_t *meta, uint8_t objlevel, uint8_t slots, int sign)
+{
+    box_counters_t *counters = &meta->ext.counters;
+    // 16个槽位即上一层的一个单元，与 box_allocated_size 一致
+    obj_usage usage = slots == 16 ? (obj_usage){.level = objlevel + 1, .multiple = 1}
+                                  : (obj_usage){.level = objlevel, .multiple = slots};
+    uint8_t level = usage.level < 16 ? usage.level : 15;
+    if (sign > 0)
     {
-        if (node->used_slots[i].state == BOX_UNUSED)
-        {
-            continuous_count++;
-        }
-        else
-        {
-            if (continuous_count > continuous_max)
-                continuous_max = continuous_count;
-            continuous_count = 0; // 中断，重新计数
-        }
+        atomic_fetch_add_explicit(&counters->allocated_bytes, obj_offset(usage), memory_order_relaxed);
+        atomic_fetch_add_explicit(&counters->objects[level], 1, memory_order_relaxed);
+    }
+    else
+    {
+        atomic_fetch_sub_explicit(&counters->allocated_bytes, obj_offset(usage), memory_order_relaxed);
+        atomic_fetch_sub_explicit(&counters->objects[level], 1, memory_order_relaxed);
+    }
+}
+
+// 统计格式化（sign=1）或回收（sign=-1）的节点
+static void box_count_node(box_meta_t *meta, box_head_t *node, int sign)
+{
+    box_counters_t *counters = &meta->ext.counters;
+    if (sign > 0)
+    {
+        atomic_fetch_add_explicit(&counters->nodes, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&counters->free_runs[node->max_obj_capacity], 1, memory_order_relaxed);
+    }
+    else
+    {
+        atomic_fetch_sub_explicit(&counters->nodes, 1, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&counters->free_runs[node->max_obj_capacity], 1, memory_order_relaxed);
+    }
+}
+
+// 统计一次成功的分配请求：count个size字节的obj，各对齐到rounded
+static void box_count_request(box_meta_t *meta, size_t size, obj_usage rounded, uint64_t count)
+{
+    box_counters_t *counters = &meta->ext.counters;
+    if (count == 0)
+        return;
+    atomic_fetch_add_explicit(&counters->requested_total, size * count, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters->rounded_total, obj_offset(rounded) * count, memory_order_relaxed);
+}
+
+/*
+ * 槽位变化后重新计算node的max_obj_capacity，同时移动它在 free_runs 中的计数。
+ * 线程安全需求：调用者持有node的写锁。
+ */
+static void box_update_max(box_meta_t *meta, box_head_t *node)
+{
+    uint8_t before = node->max_obj_capacity;
+    node->max_obj_capacity = box_continuous_max(node);
+    box_counters_t *counters = &meta->ext.counters;
+    if (before != node->max_obj_capacity)
+    {
+        atomic_fetch_sub_explicit(&counters->free_runs[before], 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&counters->free_runs[node->max_obj_capacity], 1, memory_order_relaxed);
     }
-    if (continuous_count > continuous_max)
-        continuous_max = continuous_count;
-    return continuous_max;
 }
 /*
  * 线程安全需求：
- * - 需要写锁：初始化节点状态。
- * - 锁粒度：node 级，获取当前节点的写锁。
+ * - 需要写锁：初始化节点状态，不修改rw_lock。
+ * - 锁粒度：node 级，调用者持有当前节点的写锁（根节点在box_init时无并发）。
  * - 锁顺序：单个节点。
  * - 并发性：不同节点的格式化可以并发。
 */
@@ -106,71 +340,47 @@ static void box_format(box_meta_t *meta, box_head_t *node, uint8_t objlevel, uin
     // obj,childbox usage
     node->avliable_slot = avliable_slot;
     node->max_obj_capacity = avliable_slot;
-    for (int i = 0; i < avliable_slot; i++)
-    {
-        node->used_slots[i] = (box_child_t){
-            .continue_max = 16,
-            .state = BOX_UNUSED,
-        };
-    }
+    // 槽位所在的区域以前可能被其它obj用过，一律视为待交还
+    node->slots = (box_slots_bitmap_t){
+        .free_mask = (uint16_t)((1u << avliable_slot) - 1),
+        .dirty_mask = (uint16_t)((1u << avliable_slot) - 1),
+    };
+    // 尚无子节点
     node->child_max_obj_capacity = (obj_usage){
-        .level =objlevel,
-        .multiple =1,
+        .level = 0,
+        .multiple = 0,
     };
     // childbox
     for (int i = 0; i < 16; i++)
     {
         node->childs_blockid[i] = -1;
     }
+    memset(node->child_cap, 0, sizeof(node->child_cap));
 
     // parent
     node->parent = parent_id;
+    box_count_node(meta, node, 1);
 }
-/*
- * 线程安全需求：
- * - 需要读锁：只读取节点容量信息，不修改。
- * - 锁粒度：node 级，获取当前节点的读锁。
- * - 锁顺序：单个节点。
- * - 并发性：允许多个线程同时读取。
- */
-static obj_usage box_max_obj_capacity(box_head_t *node)
+// size字节的请求对齐后的obj大小；与 box_realloc 缩小到0相同，size为0时也占一个8字节单位
+static obj_usage box_request_usage(size_t size)
 {
-    if (node->max_obj_capacity > 0)
-    {
-        if (node->max_obj_capacity == 16)
-        {
-            return (obj_usage){
-                .level = node->objlevel + 1,
-                .multiple = 1,
-            };
-        }
-        return (obj_usage){
-            .level = node->objlevel,
-            .multiple = node->max_obj_capacity,
-        };
-    }
-    else
-    {
-        return node->child_max_obj_capacity;
-    }
+    return align_to(size ? (size + 8 - 1) / 8 : 1);
 }
 
 static obj_usage box_and_child_max_obj_capacity(box_head_t *node)
 {
     // 计算“本节点自身槽位”可提供的最大容量
-    obj_usage own;
-
-    if (node->max_obj_capacity == 16)
-    {
-        own.level = node->objlevel + 1;
-        own.multiple = 1;
-    }
-    else
+    // 16个槽位全部空闲时，按[objlevel,15]计算：整个node大小的obj应放在parent的槽位中
+    obj_usage own = {
+        .level = 0,
+        .multiple = 0,
+    };
+    if (node->max_obj_capacity > 0)
     {
         own.level = node->objlevel;
-        own.multiple = node->max_obj_capacity;
+        own.multiple = node->max_obj_capacity >= 16 ? 15 : node->max_obj_capacity;
     }
- 
+
     // 子树聚合得到的最大容量
     obj_usage child = node->child_max_obj_capacity;
 
@@ -180,411 +390,1172 @@ static obj_usage box_and_child_max_obj_capacity(box_head_t *node)
 
 /*
  * 线程安全需求：
- * - 需要写锁：修改父节点状态。
- * - 锁粒度：node 级，递归获取当前节点的写锁。
- * - 锁顺序：从叶到根逐级获取锁。
- * - 并发性：不同分支的更新可以并发。
+ * - 需要读锁：读取子节点的容量，写入node的child_cap。
+ * - 锁粒度：调用者持有node的写锁，获取子节点的读锁。
+ * - 锁顺序：从父到子。
  */
-static void update_parent(box_meta_t *meta, box_head_t *node, bool slotstate_changed, bool slot_max_obj_capacity_changed)
+static void box_refresh_child_cap(box_meta_t *meta, box_head_t *node, int i)
 {
+    box_head_t *child = box_node(meta, node->childs_blockid[i]);
+    rlock(&child->rw_lock);
+    node->child_cap[i] = obj_usage_key(box_and_child_max_obj_capacity(child));
+    runlock(&child->rw_lock);
+}
 
-    if (slotstate_changed)
+/*
+ * 线程安全需求：
+ * - 需要读锁：逐个读取子节点的容量。
+ * - 锁粒度：node 级，调用者持有node的写锁，依次获取每个子节点的读锁。
+ * - 锁顺序：从父到子，与 box_find_alloc 一致。
+ * - 并发性：不同节点的汇总可以并发。
+ */
+static obj_usage box_childs_max_obj_capacity(box_meta_t *meta, box_head_t *node, box_head_t *changed)
+{
+    // 只重新读取发生变化的子节点，其余使用node中缓存的child_cap
+    if (changed)
     {
-        uint8_t newcontinuous_max = box_continuous_max(node);
-        if (node->max_obj_capacity != newcontinuous_max)
+        int32_t changed_id = box_node_id(meta, changed);
+        for (int i = 0; i < node->avliable_slot; i++)
         {
-            node->max_obj_capacity = newcontinuous_max;
+            if (node->childs_blockid[i] == changed_id && box_slot_state(node, i) == BOX_FORMATTED)
+            {
+                box_refresh_child_cap(meta, node, i);
+                break;
+            }
         }
-        else
+    }
+    else
+    {
+        uint16_t formatted = node->slots.formatted_mask;
+        while (formatted)
         {
-            slotstate_changed = false;
+            box_refresh_child_cap(meta, node, __builtin_ctz(formatted));
+            formatted &= formatted - 1;
         }
     }
+    return obj_usage_from_key(caps_max(node->child_cap));
+}
 
-    void *boxhead=(void*)meta+sizeof(box_meta_t);
-
-    if (slot_max_obj_capacity_changed)
+// 先从初始的block池分配，用完后依次使用 box_extend_meta 追加的池
+static int64_t box_blocks_alloc(box_meta_t *meta)
+{
+    box_instr_count(BOX_INSTR_WORD(blocks_alloc));
+    lock(&meta->blocks_lock);
+    int64_t block_id = blocks_alloc(&meta->blocks, box_boxhead(meta));
+    unsigned extents = box_extents(meta);
+    for (unsigned k = 0; block_id < 0 && k < extents; k++)
     {
-        if (node->max_obj_capacity > 0)
-        {
-            // 当前节点还有空闲槽，child_max_obj_capacity不变
-            slot_max_obj_capacity_changed = false;
-        }
-        else
-        {
-            obj_usage newmax = {
-                .level = 0,
-                .multiple = 0};
+        blocks_meta_t *pool = (blocks_meta_t *)((uint8_t *)meta + meta->ext.extent_offset[k]);
+        int64_t local_id = blocks_alloc(pool, box_extent_data(meta, k));
+        if (local_id >= 0)
+            block_id = meta->ext.extent_first_id[k] + local_id;
+    }
+    unlock(&meta->blocks_lock);
+    return block_id;
+}
 
-            box_head_t *child = NULL;
-            for (int i = 0; i < node->avliable_slot; i++)
-            {
-                if (node->used_slots[i].state == BOX_FORMATTED)
-                {
-                    child = boxhead + blockdata_offset(&meta->blocks, node->childs_blockid[i]);
-                    if (!child)
-                    {
-                        LOG("[ERROR] child node should not be NULL");
-                        return;
-                    }
-                    obj_usage childmax = box_and_child_max_obj_capacity(child);
-                    if (compare_obj_usage(childmax, newmax) > 0)
-                        newmax = childmax;
-                }
-            }
-            int8_t child_max_obj_capacity_changed = compare_obj_usage(newmax, node->child_max_obj_capacity);
-            if (child_max_obj_capacity_changed != 0)
-            {
-                // 发生变化
-                node->child_max_obj_capacity = newmax;
-            }
-            else
-            {
-                slot_max_obj_capacity_changed = false;
-            }
-        }
+static void box_blocks_free(box_meta_t *meta, int64_t block_id)
+{
+    lock(&meta->blocks_lock);
+    unsigned k = box_extents(meta);
+    while (k > 0 && block_id < meta->ext.extent_first_id[k - 1])
+        k--;
+    if (k == 0)
+    {
+        blocks_free(&meta->blocks, box_boxhead(meta), block_id);
     }
-    if (slotstate_changed || slot_max_obj_capacity_changed)
+    else
     {
-        if (node->parent >= 0)
-        {
-            box_head_t *parent = boxhead + blockdata_offset(&meta->blocks, node->parent);
-            update_parent(meta, parent, slotstate_changed, slot_max_obj_capacity_changed);
-        }
+        blocks_meta_t *pool = (blocks_meta_t *)((uint8_t *)meta + meta->ext.extent_offset[k - 1]);
+        blocks_free(pool, box_extent_data(meta, k - 1), block_id - meta->ext.extent_first_id[k - 1]);
     }
+    unlock(&meta->blocks_lock);
 }
+
 /*
+ * 取得一个日志槽，开始一次需要崩溃一致的修改；没有日志时返回NULL，以下 box_journal_* 对NULL不做任何事。
  * 线程安全需求：
- * - 需要写锁：修改节点的槽位状态。
- * - 锁粒度：node 级，获取当前节点的写锁。
- * - 锁顺序：单个节点，无递归。
- * - 并发性：不同节点的 put_slots 可以并发。
+ * - 日志槽由 journal_busy 位图分配，同一时刻只属于一个线程。
+ * - 调用者可以持有节点的锁：日志槽只在一次修改期间占用，期间不会再等待其它节点的锁。
  */
-static uint8_t put_slots(box_meta_t *meta, box_head_t *node, obj_usage objsize)
+static box_journal_slot_t *box_journal_begin(box_meta_t *meta)
 {
-    uint8_t target_slot = 0;
-    uint8_t continuous_count = 0;
-    bool found = false;
-
-    // 寻找连续的空闲槽
-
-    for (int i = 0; i < node->avliable_slot && !found; i++)
+    box_journal_slot_t *slots = box_journal(meta);
+    if (!slots)
+        return NULL;
+    uint64_t all = meta->ext.journal_slots == 64 ? UINT64_MAX : (UINT64_C(1) << meta->ext.journal_slots) - 1;
+    uint64_t busy = atomic_load_explicit(&meta->ext.journal_busy, memory_order_relaxed);
+    while (true)
     {
-        if (node->used_slots[i].state == BOX_UNUSED)
+        uint64_t idle = ~busy & all;
+        if (!idle)
         {
-            if (continuous_count == 0)
-            {
-                target_slot = i; // 记录连续空闲槽的起始位置
-            }
-            continuous_count++;
-
-            if (continuous_count >= objsize.multiple)
-            {
-                found = true;
-                break;
-            }
+            sched_yield();
+            busy = atomic_load_explicit(&meta->ext.journal_busy, memory_order_relaxed);
+            continue;
         }
-        else
+        int k = __builtin_ctzll(idle);
+        if (atomic_compare_exchange_weak_explicit(&meta->ext.journal_busy, &busy, busy | (UINT64_C(1) << k),
+                                                  memory_order_acquire, memory_order_relaxed))
         {
-            continuous_count = 0; // 中断，重新计数
+            box_journal_slot_t *j = &slots[k];
+            j->blocks = 0;
+            j->free_id = -1;
+            atomic_store_explicit(&j->images, 0, memory_order_relaxed);
+            atomic_store_explicit(&j->active, 1, memory_order_release);
+            return j;
         }
     }
+}
 
-    if (!found)
+// 保存ptr处bytes字节的前像，保存之后才能修改这部分
+static void box_journal_save(box_meta_t *meta, box_journal_slot_t *j, const void *ptr, size_t bytes)
+{
+    if (!j)
+        return;
+    unsigned n = atomic_load_explicit(&j->images, memory_order_relaxed);
+    if (n >= BOX_JOURNAL_IMAGES || bytes > sizeof(j->image[n].data))
     {
-        // 通常不会执行到这里，因为调用此函数前，已经确保有足够的连续空闲槽
-        LOG("[ERROR] not enough continuous free slots");
-        return 0;
+        LOG("[ERROR] bug happen, journal image %u of %zu bytes does not fit", n, bytes);
+        return;
     }
+    box_journal_image_t *image = &j->image[n];
+    image->offset = (const uint8_t *)ptr - (uint8_t *)meta;
+    image->bytes = (uint32_t)bytes;
+    memcpy(image->data, ptr, bytes);
+    atomic_store_explicit(&j->images, n + 1, memory_order_release);
+}
+
+// 记录本次修改新分配的block，撤销时归还
+static void box_journal_alloc(box_journal_slot_t *j, int64_t block_id)
+{
+    if (j && j->blocks < BOX_JOURNAL_BLOCKS)
+        j->alloc_ids[j->blocks++] = (int32_t)block_id;
+}
+
+// 提交，此后崩溃不再撤销；free_id>=0 是提交后才归还的block，归还前崩溃由 box_attach 补做
+static void box_journal_commit(box_journal_slot_t *j, int64_t free_id)
+{
+    if (!j)
+        return;
+    j->free_id = (int32_t)free_id;
+    atomic_store_explicit(&j->active, 0, memory_order_release);
+}
+
+// 归还日志槽
+static void box_journal_end(box_meta_t *meta, box_journal_slot_t *j)
+{
+    if (!j)
+        return;
+    j->free_id = -1;
+    uint64_t bit = UINT64_C(1) << (j - box_journal(meta));
+    atomic_fetch_and_explicit(&meta->ext.journal_busy, ~bit, memory_order_release);
+}
 
-    // 标记已分配的槽
-    for (int i = 0; i < objsize.multiple; i++)
+/*
+ * 空节点是否按 empty_keep 保留：已保留的继续保留，名额未满时占用一个名额。
+ * 线程安全需求：调用者持有node的写锁。
+ */
+static bool box_keep_empty(box_meta_t *meta, box_head_t *node)
+{
+    if (meta->ext.empty_keep == 0)
+        return false;
+    if (node->slots.kept_empty)
+        return true;
+    if (atomic_fetch_add(&meta->ext.empty_kept, 1) >= meta->ext.empty_keep)
     {
-        if (i == 0)
-        {
-            node->used_slots[target_slot + i].state = OBJ_START;
-        }
-        else
-        {
-            node->used_slots[target_slot + i].state = OBJ_CONTINUED;
-        }
-        node->used_slots[target_slot + i].continue_max = 0;
+        atomic_fetch_sub(&meta->ext.empty_kept, 1);
+        return false;
     }
+    node->slots.kept_empty = 1;
+    return true;
+}
 
-    uint8_t continuous_max = box_continuous_max(node);
-
-    void *boxhead=(void*)meta+sizeof(box_meta_t);
-    if (node->max_obj_capacity != continuous_max)
+// 保留的空节点重新被使用，归还名额。调用者持有node的写锁。
+static void box_unkeep(box_meta_t *meta, box_head_t *node)
+{
+    if (node->slots.kept_empty)
     {
-        // 发生变化，递归更新parent的child
-        node->max_obj_capacity = continuous_max;
-        box_head_t *parent = boxhead + blockdata_offset(&meta->blocks, node->parent);
-        update_parent(meta, parent, false, true);
+        node->slots.kept_empty = 0;
+        atomic_fetch_sub(&meta->ext.empty_kept, 1);
     }
-    return target_slot;
 }
 
-#define BOX_FAILED (uint64_t)-1
+// 节点已全部空闲且未被保留，需要通知parent回收
+static bool box_node_reclaimable(box_head_t *node)
+{
+    return box_node_empty(node) && !node->slots.kept_empty;
+}
 
 /*
-box内存分配模型，最小单元为8byte，按16为比例分割和分配内存
-其有2块区域
-meta区，存放box_meta和box_head数组
-data区，存放实际的box数据，完全分配给obj（需要向上对齐），不会存放任何结构体的meta信息
-
+ * child全部空闲时，把它从node中摘除并归还block。
  * 线程安全需求：
- * - 需要写锁：修改节点状态（分配子节点或槽位）。
- * - 锁粒度：node 级，递归获取当前节点的写锁。
- * - 锁顺序：从根到叶逐级获取锁。
- * - 并发性：不同分支可以并发查找/分配。
+ * - 需要写锁：调用者持有node的写锁，本函数获取child的写锁。
+ * - 锁顺序：从父到子。
+ * - 回收条件：child没有obj和子节点，且没有线程pin住child（见 lock_pin）。
+ *   其它线程只能经过node的锁或pin到达child，因此释放后不会再有线程访问这个block。
  */
-static uint64_t box_find_alloc(box_meta_t *meta, box_head_t *node, box_head_t *parent, obj_usage objsize)
+static bool box_reclaim_child(box_meta_t *meta, box_head_t *node, box_head_t *child)
 {
-    if (!node)
-    {
-        LOG("[ERROR] node is NULL");
-        return BOX_FAILED; // 表示分配失败
-    }
-    void *boxhead=(void *)meta+sizeof(box_meta_t);
-    if (node->state == BOX_FORMATTED)
+    int32_t child_id = box_node_id(meta, child);
+    int slot = -1;
+    for (int i = 0; i < node->avliable_slot; i++)
     {
-        if (objsize.level == node->objlevel)
+        if (node->childs_blockid[i] == child_id && box_slot_state(node, i) == BOX_FORMATTED)
         {
-            // 目标体量属于当前level，且剩余slots满足obj，直接在当前node的slots中分配
-
-            uint8_t target_slot = put_slots(meta, node, objsize);
-            uint64_t offset= obj_offset((obj_usage){
-                .level = node->objlevel,
-                .multiple = target_slot,
-            });
-            LOG("[INFO] allocated at level %d, slot [%d,%d],size %lu",node->objlevel, target_slot, target_slot+objsize.multiple - 1, obj_offset(objsize));
-            
-            return offset;
+            slot = i;
+            break;
         }
-        else if (objsize.level < node->objlevel)
-        {
-            // 目标体量<当前level，继续查找子节点
-            // TODO，slots
-            box_head_t *child = NULL;
-            for (int i = 0; i < node->avliable_slot; i++)
-            {
-                if (node->childs_blockid[i] >= 0)
-                {
-                    child = boxhead + blockdata_offset(&meta->blocks, node->childs_blockid[i]);
-                    obj_usage child_max = box_and_child_max_obj_capacity(child);
-                    if (compare_obj_usage(child_max, objsize) >= 0)
-                    {
-                        uint64_t offset = obj_offset((obj_usage){
-                            .level = node->objlevel,
-                            .multiple = i,
-                        });
-                        uint64_t target_box= box_find_alloc(meta, child, node, objsize);
-                        if (target_box == BOX_FAILED)
-                        {
-                            LOG("[ERROR] box_find_alloc failed");
-                            return BOX_FAILED;
-                        }
-                        return offset + target_box;
-                    }
-                }
-                else if (node->used_slots[i].state == BOX_UNUSED) // 添加检查：确保slot空闲
-                {
-                    // 需要新建child box_head_t
-                    int64_t child_block_id = blocks_alloc(&(meta->blocks), boxhead);
-                    if (child_block_id < 0)
-                    {
-                        LOG("[ERROR] failed to create box_head for child");
-                        return BOX_FAILED;
-                    }
-                    node->childs_blockid[i] = child_block_id;
-
-                    child = boxhead+ blockdata_offset(&meta->blocks, node->childs_blockid[i]);
-
-                    int64_t cur_block_id = blockid_bydataoffset(&meta->blocks, (void *)node - boxhead);
-                    box_format(meta, child, node->objlevel - 1, 16, cur_block_id);
-
-                    // 更新node中的child信息
-                    node->used_slots[i].state = BOX_FORMATTED;
-                    node->used_slots[i].continue_max = 0;
-                    // 更新node中的max_obj_capacity
-                    uint8_t new_max = box_continuous_max(node);
-                    if (node->max_obj_capacity != new_max)
-                    {
-                        node->max_obj_capacity = new_max;
-                        if (parent) {
-                            update_parent(meta, parent, true, false);
-                        }
-                    }
-
-                    // 判断新child box的容量
-
-                    obj_usage child_max = (obj_usage){
-                        .level = child->objlevel + 1,
-                        .multiple = 1,
-                    };
-                    if (compare_obj_usage(child_max, objsize) >= 0)
-                    {
-                        uint64_t offset = obj_offset((obj_usage){
-                            .level = node->objlevel,
-                            .multiple = i,
-                        });
-                        uint64_t target_box= box_find_alloc(meta, child, node, objsize);
-                        if (target_box == BOX_FAILED)
-                        {
-                            LOG("[ERROR]:box_find_alloc failed");
-                            return BOX_FAILED;
-                        }
-                        return offset + target_box;
-                    }
-                }
-            }
+    }
+    // child已经被其它线程回收（block可能已被复用）
+    if (slot < 0)
+        return false;
 
-            LOG("[ERROR] bug happen,but should not happen");
-            return BOX_FAILED;
+    lock(&child->rw_lock);
+    bool reclaim = box_node_empty(child) && lock_waiters(&child->rw_lock) == 0 && !box_keep_empty(meta, child);
+    box_journal_slot_t *j = NULL;
+    if (reclaim)
+    {
+        j = box_journal_begin(meta);
+        box_journal_save(meta, j, node, sizeof(*node));
+        box_journal_save(meta, j, child, sizeof(*child));
+        // 通过索引找到这个block的线程据此判断已失效
+        child->state = BOX_UNUSED;
+        // 未登记的节点（超出索引范围）不能清除别的节点的索引项
+        atomic_int_least32_t *index = box_index(meta);
+        if (index && child->objlevel == meta->ext.index_level - 1)
+        {
+            int_least32_t expected = child_id;
+            atomic_compare_exchange_strong_explicit(&index[child->slots.index_chunk], &expected, -1,
+                                                    memory_order_relaxed, memory_order_relaxed);
         }
     }
+    unlock(&child->rw_lock);
+    if (!reclaim)
+        return false;
 
-    // 如果执行到这里,需要联系开发者
-    LOG("[ERROR] bug happen,but should not happen");
-    return BOX_FAILED;
+    node->childs_blockid[slot] = -1;
+    box_set_slot_state(node, slot, BOX_UNUSED);
+    node->child_cap[slot] = 0;
+    box_count_node(meta, child, -1);
+    box_journal_commit(j, child_id);
+    box_blocks_free(meta, child_id);
+    box_journal_end(meta, j);
+    LOG("[INFO] reclaimed empty box_head block %d", child_id);
+    return true;
 }
 
-uint64_t box_alloc(void *metaptr, const size_t size)
+/*
+ * 线程安全需求：
+ * - 需要写锁：修改父节点状态。
+ * - 锁粒度：node 级，递归获取当前节点的写锁。
+ * - 锁顺序：从叶到根逐级获取锁，同一时刻只持有一个节点的锁，不会与自上而下的 box_find_alloc 形成环。
+ *   调用者在释放child的锁之前已经pin住node，本函数用 lock_pinned 取得写锁；向上递归前同样先pin住parent。
+ * - 并发性：不同分支的更新可以并发。
+ * child全部空闲时在这里回收，node因此全部空闲时继续通知parent回收node。
+ */
+static void update_parent(box_meta_t *meta, box_head_t *node, box_head_t *child, bool slotstate_changed, bool slot_max_obj_capacity_changed)
 {
-    if (!metaptr)
+    box_instr_propagate();
+    lock_pinned(&node->rw_lock);
+    obj_usage before = box_and_child_max_obj_capacity(node);
+
+    if (child && box_reclaim_child(meta, node, child))
+    {
+        slotstate_changed = true;
+    }
+    if (slotstate_changed)
+    {
+        box_update_max(meta, node);
+    }
+    if (slot_max_obj_capacity_changed)
+    {
+        // 总是从子节点重新汇总，而不是增量修改：并发更新时，最后一个经过的线程看到的一定是最新值
+        node->child_max_obj_capacity = box_childs_max_obj_capacity(meta, node, child);
+    }
+
+    obj_usage after = box_and_child_max_obj_capacity(node);
+    box_head_t *parent = NULL;
+    // 本节点对外的容量不变，且无需回收时，parent无需更新
+    if (node->parent >= 0 && (compare_obj_usage(before, after) != 0 || box_node_reclaimable(node)))
+    {
+        parent = box_node(meta, node->parent);
+        lock_pin(&parent->rw_lock);
+    }
+    unlock(&node->rw_lock);
+
+    if (parent)
+        update_parent(meta, parent, node, false, true);
+}
+void box_unpin(box_meta_t *meta, box_head_t *node)
+{
+    rlock(&node->rw_lock);
+    box_head_t *parent = NULL;
+    if (node->parent >= 0 && box_node_reclaimable(node))
+    {
+        parent = box_node(meta, node->parent);
+        lock_pin(&parent->rw_lock);
+    }
+    lock_unpin(&node->rw_lock);
+    runlock(&node->rw_lock);
+
+    if (parent)
+        update_parent(meta, parent, node, false, true);
+}
+
+#define BOX_ALL_SLOTS 0xffff
+
+/*
+ * 在node中放置objsize：起始槽位限于allowed，且离hint_slot最近；
+ * hint_slot<0时按policy选择：BOX_FIRST_FIT取第一个，BOX_BEST_FIT取所在的连续空闲槽位最短的一个。
+ * 返回起始槽位，没有满足条件的连续空闲槽位时返回-1。
+ * 线程安全需求：
+ * - 需要写锁：修改节点的槽位状态。
+ * - 锁粒度：node 级，调用者持有当前节点的写锁。
+ * - 锁顺序：单个节点，无递归；容量变化由调用者在释放锁后通过 update_parent 向上传递。
+ * - 并发性：不同节点的 put_slots 可以并发。
+ */
+static int put_slots(box_meta_t *meta, box_head_t *node, obj_usage objsize, uint16_t allowed, int hint_slot, box_policy_t policy)
+{
+    uint16_t free = box_free_mask(node);
+    uint32_t starts = bitmap_run_starts(free, objsize.multiple) & allowed;
+    int start = policy == BOX_BEST_FIT && hint_slot < 0 ? bitmap_best_start(free, starts) : bitmap_nearest(starts, hint_slot);
+    if (start < 0)
+    {
+        // 无约束时通常不会执行到这里，因为调用此函数前，已经确保有足够的连续空闲槽
+        LOG("[ERROR] not enough continuous free slots");
+        return -1;
+    }
+    box_journal_slot_t *j = box_journal_begin(meta);
+    box_journal_save(meta, j, node, sizeof(*node));
+    box_unkeep(meta, node);
+
+    uint16_t run = (uint16_t)(((1u << objsize.multiple) - 1) << start);
+    node->slots.free_mask &= ~run;
+    node->slots.start_mask |= (uint16_t)(1u << start);
+    box_update_max(meta, node);
+    box_count_obj(meta, node->objlevel, objsize.multiple, 1);
+    box_journal_commit(j, -1);
+    box_journal_end(meta, j);
+    return start;
+}
+
+#define BOX_RETRY (uint64_t)-2 // 内部使用：并发下容量信息过期，需要从根重新查找
+
+/*
+ * 可能容纳objsize的槽位：容量足够的子节点和空闲槽位，按槽位顺序排列。
+ * 线程安全需求：调用者持有node的写锁。
+ */
+static uint16_t box_candidate_slots(box_head_t *node, obj_usage objsize)
+{
+    uint16_t fit = caps_fit_mask(node->child_cap, obj_usage_key(objsize));
+    return (fit & node->slots.formatted_mask) | node->slots.free_mask;
+}
+
+/*
+ * 从candidates中选出下一个尝试的槽位。
+ * BOX_FIRST_FIT：槽位顺序。
+ * BOX_BEST_FIT：容量最小（超出请求最少）的已格式化子节点优先，最后才在空闲槽位上新建子节点，
+ *               尽量不拆分能容纳大obj的空闲槽位。
+ * 线程安全需求：调用者持有node的写锁。
+ */
+static int box_pick_candidate(box_head_t *node, uint16_t candidates, box_policy_t policy)
+{
+    if (policy != BOX_BEST_FIT)
+        return __builtin_ctz(candidates);
+    uint16_t formatted = candidates & box_formatted_mask(node);
+    if (!formatted)
+        return __builtin_ctz(candidates);
+
+    int best = -1;
+    int best_key = 256;
+    while (formatted)
+    {
+        int i = __builtin_ctz(formatted);
+        formatted &= formatted - 1;
+        int key = node->child_cap[i];
+        if (key < best_key)
+        {
+            best = i;
+            best_key = key;
+        }
+    }
+    return best;
+}
+
+/*
+ * node的objlevel为index_level-1时，把它登记为起始于base的chunk的节点。
+ * box_extend_obj 扩展出的区域超出索引范围，不登记。
+ * 线程安全需求：调用者持有node的写锁。
+ */
+static void box_index_node(box_meta_t *meta, box_head_t *node, int64_t block_id, uint64_t base)
+{
+    atomic_int_least32_t *index = box_index(meta);
+    if (!index || node->objlevel != meta->ext.index_level - 1)
+        return;
+    uint64_t chunk = base >> (4 * meta->ext.index_level + 3);
+    if (chunk >= meta->ext.index_entries)
+        return;
+    node->slots.index_chunk = (uint32_t)chunk;
+    atomic_store_explicit(&index[chunk], (int32_t)block_id, memory_order_release);
+}
+
+/*
+ * 在node（起始于base）的第i个槽位上取得能容纳objsize的子节点：已格式化的子节点需要容量足够，空闲槽位则新建子节点。
+ * 线程安全需求：
+ * - 需要写锁：调用者持有node的写锁；成功时返回已加写锁的子节点。
+ * - 锁顺序：从父到子。
+ * meta区耗尽时置位 *meta_exhausted，返回NULL。
+ */
+static box_head_t *box_lock_child(box_meta_t *meta, box_head_t *node, uint64_t base, int i, obj_usage objsize, bool *meta_exhausted)
+{
+    uint8_t state = box_slot_state(node, i);
+    if (state == BOX_FORMATTED)
+    {
+        box_head_t *candidate = box_node(meta, node->childs_blockid[i]);
+        // 先用缓存的child_cap预判，持锁后再确认
+        if (compare_obj_usage(obj_usage_from_key(node->child_cap[i]), objsize) < 0)
+            return NULL;
+        lock(&candidate->rw_lock);
+        obj_usage actual = box_and_child_max_obj_capacity(candidate);
+        node->child_cap[i] = obj_usage_key(actual);
+        if (compare_obj_usage(actual, objsize) >= 0)
+            return candidate;
+        unlock(&candidate->rw_lock);
+        return NULL;
+    }
+    if (state != BOX_UNUSED) // 添加检查：确保slot空闲
+        return NULL;
+
+    // 需要新建child box_head_t
+    box_journal_slot_t *j = box_journal_begin(meta);
+    box_journal_save(meta, j, node, sizeof(*node));
+    box_unkeep(meta, node);
+    int64_t child_block_id = box_blocks_alloc(meta);
+    if (child_block_id < 0)
+    {
+        box_journal_commit(j, -1);
+        box_journal_end(meta, j);
+        LOG("[ERROR] failed to create box_head for child");
+        *meta_exhausted = true;
+        return NULL;
+    }
+    box_journal_alloc(j, child_block_id);
+    box_head_t *child = box_node(meta, child_block_id);
+
+    int64_t cur_block_id = box_node_id(meta, node);
+    // 新child只可能被通过索引找到旧block的线程短暂读锁住，先加锁再格式化；没有索引时直接初始化锁
+    if (!box_index(meta))
+        atomic_init(&child->rw_lock, 0);
+    lock(&child->rw_lock);
+    box_format(meta, child, node->objlevel - 1, 16, cur_block_id);
+    box_index_node(meta, child, child_block_id, base + obj_offset((obj_usage){.level = node->objlevel, .multiple = i}));
+
+    // 更新node中的child信息
+    node->childs_blockid[i] = child_block_id;
+    box_set_slot_state(node, i, BOX_FORMATTED);
+    obj_usage child_capacity = box_and_child_max_obj_capacity(child);
+    node->child_cap[i] = obj_usage_key(child_capacity);
+    // 空闲槽位变成了子节点，node对外的容量可能改由这个子节点提供
+    if (compare_obj_usage(child_capacity, node->child_max_obj_capacity) > 0)
+        node->child_max_obj_capacity = child_capacity;
+    // 更新node中的max_obj_capacity
+    box_update_max(meta, node);
+    box_journal_commit(j, -1);
+    box_journal_end(meta, j);
+    return child;
+}
+
+/*
+box内存分配模型，最小单元为8byte，按16为比例分割和分配内存
+其有2块区域
+meta区，存放box_meta和box_head数组
+data区，存放实际的box数据，完全分配给obj（需要向上对齐），不会存放任何结构体的meta信息
+
+ * 线程安全需求：
+ * - 需要写锁：修改节点状态（分配子节点或槽位）。
+ * - 锁粒度：node 级，进入时调用者已持有node的写锁，返回前释放。
+ * - 锁顺序：从根到叶逐级获取锁（hand-over-hand：先锁child，再释放node）。
+ * - 并发性：不同分支可以并发查找/分配。
+ */
+static uint64_t box_find_alloc(box_meta_t *meta, box_head_t *node, box_head_t *parent, uint64_t base, obj_usage objsize, box_policy_t policy)
+{
+    if (!node)
+    {
+        LOG("[ERROR] node is NULL");
+        return BOX_FAILED; // 表示分配失败
+    }
+    box_instr_descend();
+    uint8_t objlevel = node->objlevel;
+    obj_usage before = box_and_child_max_obj_capacity(node);
+
+    if (objsize.level == objlevel)
+    {
+        // 目标体量属于当前level，且剩余slots满足obj，直接在当前node的slots中分配
+        if (node->max_obj_capacity < objsize.multiple)
+        {
+            // 持锁前读到的容量已过期
+            unlock(&node->rw_lock);
+            return BOX_RETRY;
+        }
+        int target_slot = put_slots(meta, node, objsize, BOX_ALL_SLOTS, -1, policy);
+        obj_usage after = box_and_child_max_obj_capacity(node);
+        bool changed = parent && compare_obj_usage(before, after) != 0;
+        if (changed)
+            lock_pin(&parent->rw_lock);
+        unlock(&node->rw_lock);
+
+        if (changed)
+        {
+            // 发生变化，递归更新parent的child
+            update_parent(meta, parent, node, false, true);
+        }
+        uint64_t offset= obj_offset((obj_usage){
+            .level = objlevel,
+            .multiple = target_slot,
+        });
+        LOG("[INFO] allocated at level %d, slot [%d,%d],size %lu",objlevel, target_slot, target_slot+objsize.multiple - 1, obj_offset(objsize));
+
+        return offset;
+    }
+    else if (objsize.level < objlevel)
+    {
+        // 目标体量<当前level，继续查找子节点
+        box_head_t *child = NULL;
+        int slot = -1;
+        bool meta_exhausted = false;
+        uint16_t candidates = box_candidate_slots(node, objsize);
+        while (candidates)
+        {
+            int i = box_pick_candidate(node, candidates, policy);
+            candidates &= ~(uint16_t)(1u << i);
+            box_instr_scan();
+            child = box_lock_child(meta, node, base, i, objsize, &meta_exhausted);
+            if (child)
+            {
+                slot = i;
+                break;
+            }
+        }
+
+        if (!child)
+        {
+            // 持锁前读到的容量已过期，或meta区已耗尽：重新汇总本节点，修正上层的容量
+            node->child_max_obj_capacity = box_childs_max_obj_capacity(meta, node, NULL);
+            obj_usage after = box_and_child_max_obj_capacity(node);
+            // 新建的node在下层失败时仍是空的，交给parent回收
+            bool changed = parent && (compare_obj_usage(before, after) != 0 || box_node_reclaimable(node));
+            if (changed)
+                lock_pin(&parent->rw_lock);
+            unlock(&node->rw_lock);
+            if (changed)
+                update_parent(meta, parent, node, false, true);
+            return meta_exhausted ? BOX_FAILED : BOX_RETRY;
+        }
+
+        obj_usage after = box_and_child_max_obj_capacity(node);
+        // 新建child占用了本节点的槽位，待下层更新完成后再通知parent；
+        // 在此之前pin住parent，下层失败时parent也不会被回收
+        bool changed = parent && compare_obj_usage(before, after) != 0;
+        if (changed)
+            lock_pin(&parent->rw_lock);
+        unlock(&node->rw_lock);
+
+        uint64_t offset = obj_offset((obj_usage){
+            .level = objlevel,
+            .multiple = slot,
+        });
+        uint64_t target_box = box_find_alloc(meta, child, node, base + offset, objsize, policy);
+
+        if (changed)
+            update_parent(meta, parent, node, false, true);
+
+        if (target_box == BOX_FAILED || target_box == BOX_RETRY)
+        {
+            LOG("[ERROR] box_find_alloc failed");
+            return target_box;
+        }
+        return offset + target_box;
+    }
+
+    // 如果执行到这里,需要联系开发者
+    unlock(&node->rw_lock);
+    LOG("[ERROR] bug happen,but should not happen");
+    return BOX_FAILED;
+}
+
+box_head_t *box_lock_root(box_meta_t *meta, bool exclusive)
+{
+    while (true)
+    {
+        box_head_t *root = box_node(meta, box_root_id(meta));
+        if (exclusive)
+            lock(&root->rw_lock);
+        else
+            rlock(&root->rw_lock);
+        if (root->parent < 0)
+            return root;
+        if (exclusive)
+            unlock(&root->rw_lock);
+        else
+            runlock(&root->rw_lock);
+    }
+}
+
+uint64_t box_alloc(void *metaptr, const size_t size)
+{
+    if (!metaptr)
+    {
+        LOG("[ERROR] root must not NULL");
+        return BOX_FAILED;
+    };
+    box_meta_t *meta = metaptr;
+    return box_alloc_policy(metaptr, size, meta->ext.policy);
+}
+
+uint64_t box_alloc_policy(void *metaptr, const size_t size, const box_policy_t policy)
+{
+    if (!metaptr)
     {
         LOG("[ERROR] root must not NULL");
         return BOX_FAILED;
     };
 
-    obj_usage aligned_objsize = align_to((size + 8 - 1) / 8);
+    obj_usage aligned_objsize = box_request_usage(size);
 
     box_meta_t *meta = metaptr;
-    void *boxhead=(void*)meta+sizeof(box_meta_t);
-    box_head_t *root = boxhead+ blockdata_offset(&meta->blocks, 0);
-    
-    obj_usage max_capacity = box_and_child_max_obj_capacity(root);
+    uint64_t instr = box_instr_begin();
 
-    if (compare_obj_usage(aligned_objsize, max_capacity) > 0)
+    uint64_t offset = 0;
+    do
     {
-        LOG("[ERROR] requested size[%u*%u] is too large for the box[8*16^%u * %u]", aligned_objsize.level,aligned_objsize.multiple,max_capacity.level, max_capacity.multiple);
-        return BOX_FAILED;
-    }
-    uint64_t offset = box_find_alloc(meta, root, NULL, aligned_objsize);
+        if (offset == BOX_RETRY)
+            box_instr_count(BOX_INSTR_WORD(retries));
+        box_head_t *root = box_lock_root(meta, true);
+        obj_usage max_capacity = box_and_child_max_obj_capacity(root);
+
+        if (compare_obj_usage(aligned_objsize, max_capacity) > 0)
+        {
+            unlock(&root->rw_lock);
+            LOG("[ERROR] requested size[%u*%u] is too large for the box[8*16^%u * %u]", aligned_objsize.level,aligned_objsize.multiple,max_capacity.level, max_capacity.multiple);
+            box_trace(metaptr, BOX_TRACE_ALLOC, size, BOX_FAILED);
+            // 比整个box还大，或者当前没有足够长的连续空闲槽位
+            if (instr)
+                box_instr_alloc_end(instr, obj_offset(aligned_objsize) > meta->box_bytessize ? BOX_INSTR_TOO_LARGE : BOX_INSTR_NO_RUN);
+            return BOX_FAILED;
+        }
+        offset = box_find_alloc(meta, root, NULL, 0, aligned_objsize, policy);
+    } while (offset == BOX_RETRY);
+
+    box_trace(metaptr, BOX_TRACE_ALLOC, size, offset);
+    // box_find_alloc 只在meta区耗尽时返回 BOX_FAILED
+    if (instr)
+        box_instr_alloc_end(instr, offset == BOX_FAILED ? BOX_INSTR_META : BOX_INSTR_OK);
     if (offset == BOX_FAILED)
         return BOX_FAILED;
+    box_count_request(meta, size, aligned_objsize, 1);
     LOG("[INFO] object allocated at offset %lu", offset);
     return  offset;
 }
+/*
+ * 放置约束：
+ * align 为obj起始offset的对齐字节数（2的幂），不超过8时不限制；
+ * hint 为希望靠近的offset，BOX_FAILED 表示不限制。
+ */
+typedef struct
+{
+    uint64_t align;
+    uint64_t hint;
+} box_place_t;
+
+/*
+ * level层node中满足对齐的槽位。
+ * 槽位小于align时，只有序号是 align/槽位大小 的倍数的槽位对齐（超过16时只有槽位0）；
+ * 祖先节点按同样的规则选择，node本身的起始offset已经对齐。
+ */
+static uint16_t box_place_allowed(const box_place_t *place, uint8_t level)
+{
+    if (!place)
+        return BOX_ALL_SLOTS;
+    uint64_t slot_bytes = obj_offset((obj_usage){.level = level, .multiple = 1});
+    if (place->align <= slot_bytes)
+        return BOX_ALL_SLOTS;
+    switch (place->align / slot_bytes)
+    {
+    case 2:
+        return 0x5555;
+    case 4:
+        return 0x1111;
+    case 8:
+        return 0x0101;
+    default:
+        return 0x0001;
+    }
+}
+
+// level层、起始于base的node中离hint最近的槽位，无hint时返回-1
+static int box_place_hint_slot(const box_place_t *place, uint8_t level, uint64_t base)
+{
+    if (!place || place->hint == BOX_FAILED)
+        return -1;
+    if (place->hint < base)
+        return 0;
+    uint64_t slot_bytes = obj_offset((obj_usage){.level = level, .multiple = 1});
+    uint64_t slot = (place->hint - base) / slot_bytes;
+    return slot > 15 ? 15 : (int)slot;
+}
+
+/*
+ * 深度优先的批量分配：一次下降，把经过的每个节点的空闲槽位都填满后再返回上层；
+ * 子树放不下（容量信息过期、不满足place约束）时回到本节点尝试下一个槽位。
+ * place 为NULL时不限制位置，否则按对齐过滤槽位、按离hint的距离排序；没有hint时按policy选择槽位。
+ * 线程安全需求：
+ * - 需要写锁：进入时调用者持有node的写锁，返回前释放。
+ * - 锁粒度：node 级，与 box_find_alloc 相同地hand-over-hand：锁住子节点后pin住node并释放，
+ *   子树完成后用 lock_pinned 取回node的写锁，汇总该子节点的容量（全部空闲时回收）再尝试下一个槽位。
+ *   同一时刻只持有一个节点的写锁，其它线程的分配可以经过本批已经离开的节点。
+ * - 锁顺序：从根到叶；pin住的祖先节点不会被回收。node的容量变化由调用者取回node的父节点时汇总，不调用 update_parent。
+ */
+static size_t box_find_alloc_n(box_meta_t *meta, box_head_t *node, obj_usage objsize, uint64_t base, size_t count, uint64_t *out,
+                               const box_place_t *place, box_policy_t policy)
+{
+    uint8_t objlevel = node->objlevel;
+    uint16_t allowed = box_place_allowed(place, objlevel);
+    int hint_slot = box_place_hint_slot(place, objlevel, base);
+    size_t done = 0;
+
+    if (objsize.level == objlevel)
+    {
+        while (done < count && node->max_obj_capacity >= objsize.multiple)
+        {
+            int target_slot = put_slots(meta, node, objsize, allowed, hint_slot, policy);
+            if (target_slot < 0)
+                break;
+            out[done++] = base + obj_offset((obj_usage){
+                .level = objlevel,
+                .multiple = target_slot,
+            });
+        }
+        unlock(&node->rw_lock);
+        return done;
+    }
+
+    bool meta_exhausted = false;
+    uint16_t tried = 0;
+    while (done < count)
+    {
+        // 每次取回node后重新计算：释放期间其它线程可能改变了槽位和子节点的容量
+        uint16_t candidates = box_candidate_slots(node, objsize) & allowed & ~tried;
+        if (!candidates)
+            break;
+        int i = hint_slot < 0 ? box_pick_candidate(node, candidates, policy) : bitmap_nearest(candidates, hint_slot);
+        tried |= (uint16_t)(1u << i);
+        box_head_t *child = box_lock_child(meta, node, base, i, objsize, &meta_exhausted);
+        if (!child)
+            continue;
+        lock_pin(&node->rw_lock);
+        unlock(&node->rw_lock);
+
+        uint64_t offset = obj_offset((obj_usage){
+            .level = objlevel,
+            .multiple = i,
+        });
+        done += box_find_alloc_n(meta, child, objsize, base + offset, count - done, out + done, place, policy);
+
+        lock_pinned(&node->rw_lock);
+        // 新建的child在下层失败时仍是空的，在此回收
+        if (box_reclaim_child(meta, node, child))
+            box_update_max(meta, node);
+        node->child_max_obj_capacity = box_childs_max_obj_capacity(meta, node, child);
+    }
+    unlock(&node->rw_lock);
+    return done;
+}
+
+size_t box_alloc_n(void *metaptr, const size_t size, const size_t count, uint64_t *out)
+{
+    if (!metaptr || !out)
+    {
+        LOG("[ERROR] root must not NULL");
+        return 0;
+    }
+    if (count == 0)
+        return 0;
+
+    obj_usage aligned_objsize = box_request_usage(size);
+
+    box_meta_t *meta = metaptr;
+    box_policy_t policy = meta->ext.policy;
+    box_head_t *root = box_lock_root(meta, true);
+    if (compare_obj_usage(aligned_objsize, box_and_child_max_obj_capacity(root)) > 0)
+    {
+        unlock(&root->rw_lock);
+        LOG("[ERROR] requested size[%u*%u] is too large for the box", aligned_objsize.level, aligned_objsize.multiple);
+        return 0;
+    }
+    size_t done = box_find_alloc_n(meta, root, aligned_objsize, 0, count, out, NULL, policy);
+    box_count_request(meta, size, aligned_objsize, done);
+    for (size_t i = 0; i < done; i++)
+        box_trace(metaptr, BOX_TRACE_ALLOC, size, out[i]);
+
+    // 并发下容量信息可能过期，剩余部分逐个分配
+    while (done < count)
+    {
+        uint64_t offset = box_alloc(metaptr, size);
+        if (offset == BOX_FAILED)
+            break;
+        out[done++] = offset;
+    }
+    LOG("[INFO] %zu/%zu objects allocated", done, count);
+    return done;
+}
+
+static uint64_t box_place_alloc(void *metaptr, const size_t size, const box_place_t *place)
+{
+    if (!metaptr)
+    {
+        LOG("[ERROR] root must not NULL");
+        return BOX_FAILED;
+    }
+
+    obj_usage aligned_objsize = box_request_usage(size);
+
+    box_meta_t *meta = metaptr;
+    box_head_t *root = box_lock_root(meta, true);
+    if (compare_obj_usage(aligned_objsize, box_and_child_max_obj_capacity(root)) > 0)
+    {
+        unlock(&root->rw_lock);
+        LOG("[ERROR] requested size[%u*%u] is too large for the box", aligned_objsize.level, aligned_objsize.multiple);
+        return BOX_FAILED;
+    }
+    uint64_t offset;
+    if (box_find_alloc_n(meta, root, aligned_objsize, 0, 1, &offset, place, meta->ext.policy) != 1)
+    {
+        LOG("[ERROR] no free slots satisfy align %lu hint %lu", place->align, place->hint);
+        box_trace(metaptr, BOX_TRACE_ALLOC, size, BOX_FAILED);
+        return BOX_FAILED;
+    }
+    box_count_request(meta, size, aligned_objsize, 1);
+    box_trace(metaptr, BOX_TRACE_ALLOC, size, offset);
+    LOG("[INFO] object allocated at offset %lu", offset);
+    return offset;
+}
+
+uint64_t box_alloc_aligned(void *metaptr, const size_t size, const size_t align)
+{
+    if (align == 0 || (align & (align - 1)) != 0)
+    {
+        LOG("[ERROR] align must be a power of 2. Given align: %zu", align);
+        return BOX_FAILED;
+    }
+    return box_place_alloc(metaptr, size, &(box_place_t){.align = align, .hint = BOX_FAILED});
+}
+
+uint64_t box_alloc_near(void *metaptr, const size_t size, const uint64_t hint_offset)
+{
+    return box_place_alloc(metaptr, size, &(box_place_t){.align = 0, .hint = hint_offset});
+}
+/*
+ * 通过索引找到覆盖obj_offset的、objlevel为index_level-1的节点，返回时持有其读锁；没有索引或该处没有这一层的节点时返回NULL。
+ * 线程安全需求：
+ * - 索引中的block可能已被回收甚至复用，加读锁后确认节点仍是这个chunk的节点。
+ *   回收方在写锁内把state置为BOX_UNUSED，新建方在写锁内格式化，因此读锁内看到的内容是一致的。
+ */
+static box_head_t *box_index_lookup(box_meta_t *meta, const uint64_t obj_offset)
+{
+    atomic_int_least32_t *index = box_index(meta);
+    if (!index)
+        return NULL;
+    uint64_t chunk = obj_offset >> (4 * meta->ext.index_level + 3);
+    if (chunk >= meta->ext.index_entries)
+        return NULL;
+    int32_t block_id = atomic_load_explicit(&index[chunk], memory_order_acquire);
+    if (block_id < 0)
+        return NULL;
+
+    box_head_t *node = box_node(meta, block_id);
+    rlock(&node->rw_lock);
+    if (node->state == BOX_FORMATTED && node->objlevel == meta->ext.index_level - 1 && node->slots.index_chunk == chunk)
+        return node;
+    runlock(&node->rw_lock);
+    return NULL;
+}
+
 /*
  * 线程安全需求：
  * - 需要读锁：只读取节点状态，不修改。
- * - 锁粒度：node 级，递归获取从根到目标节点的读锁。
+ * - 锁粒度：node 级，hand-over-hand 获取从根（或索引找到的节点）到目标节点的读锁。
  * - 锁顺序：从根到叶逐级获取锁。
  * - 并发性：允许多个线程同时查找同一分支。
+ * 返回时持有目标节点的锁：exclusive 为真时是写锁，否则是读锁。
  */
-static box_head_t *find_obj_node(box_meta_t *meta, const uint64_t obj_offset, uint8_t *out_slot_index)
+static box_head_t *find_obj_node(box_meta_t *meta, const uint64_t obj_offset, uint8_t *out_slot_index, bool exclusive)
 {
     // 转换为8字节单位的偏移量
     uint64_t unit_offset = obj_offset / 8;
 
-    // 获取根节点
-    void *boxhead=(void*)meta+sizeof(box_meta_t);
-    box_head_t *node = boxhead + blockdata_offset(&meta->blocks, 0);
+    // 有索引时直接从被索引的节点开始，否则从根节点开始
+    box_head_t *node = box_index_lookup(meta, obj_offset);
+    box_head_t *parent = NULL;
     if (!node)
-    {
-        LOG("[ERROR] root node is NULL");
-        return NULL;
-    }
+        node = box_lock_root(meta, false);
 
     // 计算根节点的level
     uint8_t current_level = node->objlevel;
 
     // 从高位向低位逐层查找
-    while (node && node->state == BOX_FORMATTED)
+    while (node->state == BOX_FORMATTED)
     {
-        // 计算当前层级的槽位索引
-        uint64_t divisor = 1;
-        for (int i = 0; i < current_level; i++)
-        {
-            divisor *= 16;
-        }
-
-        uint8_t slot_index = (unit_offset / divisor) % 16;
+        // 槽位索引是8字节单位offset的第current_level个4bit
+        uint8_t slot_index = (unit_offset >> (4 * current_level)) & 0xf;
 
         // 检查该槽位的状态
-        if (node->used_slots[slot_index].state == OBJ_START)
+        uint8_t state = box_slot_state(node, slot_index);
+        if (state == OBJ_START && (unit_offset & (int_pow16(current_level) - 1)) != 0)
+        {
+            // 指向obj内部，不是obj的起始offset
+            break;
+        }
+        if (state == OBJ_START)
         {
             // 找到了对象的起始位置
+            if (exclusive)
+            {
+                // 升级为写锁：先pin住node再释放读锁，node不会在此期间被回收
+                lock_pin(&node->rw_lock);
+                runlock(&node->rw_lock);
+                lock_pinned(&node->rw_lock);
+                if (box_slot_state(node, slot_index) != OBJ_START)
+                {
+                    unlock(&node->rw_lock);
+                    if (parent)
+                        runlock(&parent->rw_lock);
+                    LOG("[ERROR] object+%lu released concurrently", obj_offset);
+                    return NULL;
+                }
+            }
+            if (parent)
+                runlock(&parent->rw_lock);
             *out_slot_index = slot_index;
             return node;
         }
-        else if (node->used_slots[slot_index].state == BOX_FORMATTED)
+        else if (state == BOX_FORMATTED)
         {
             // 进入子节点继续查找
-            node = boxhead + blockdata_offset(&meta->blocks, node->childs_blockid[slot_index]);
+            box_head_t *child = box_node(meta, node->childs_blockid[slot_index]);
+            rlock(&child->rw_lock);
+            if (parent)
+                runlock(&parent->rw_lock);
+            parent = node;
+            node = child;
             current_level--;
         }
         else
         {
             // 该位置不是对象起始位置也不是子节点
             LOG("[ERROR] bug happen,invalid state %d at slot %d, level %d",
-                node->used_slots[slot_index].state, slot_index, current_level);
-            return NULL;
+                state, slot_index, current_level);
+            break;
         }
     }
 
+    runlock(&node->rw_lock);
+    if (parent)
+        runlock(&parent->rw_lock);
     // 如果遍历完所有层级仍未找到对象
     LOG("[ERROR] object+%lu not found", obj_offset);
     return NULL;
 }
+/*
+ * 线程安全需求：
+ * - 需要写锁：调用者持有node的写锁。
+ */
+static void box_release_slots(box_meta_t *meta, box_head_t *node, uint8_t slot_index)
+{
+    uint8_t count = 1 + bitmap_run_after(box_slots_continued(node), slot_index);
+    uint16_t run = (uint16_t)(((1u << count) - 1) << slot_index);
+    // 两个mask须同时生效，崩溃时不能只留下一半
+    box_journal_slot_t *j = box_journal_begin(meta);
+    box_journal_save(meta, j, &node->slots, sizeof(node->slots));
+    node->slots.free_mask |= run;
+    node->slots.dirty_mask |= run;
+    node->slots.start_mask &= ~(uint16_t)(1u << slot_index);
+    box_journal_commit(j, -1);
+    box_journal_end(meta, j);
+    box_count_obj(meta, node->objlevel, count, -1);
+}
+
+/*
+ * 槽位修改完成后：重新计算node的容量，释放写锁，容量变化或node已全部空闲时通知parent（由parent回收）。
+ * 线程安全需求：
+ * - 调用者持有node的写锁，before为修改前的 box_and_child_max_obj_capacity。
+ * - 释放node之前pin住parent，见 update_parent。
+ */
+static void box_unlock_update(box_meta_t *meta, box_head_t *node, obj_usage before)
+{
+    box_update_max(meta, node);
+    obj_usage after = box_and_child_max_obj_capacity(node);
+    box_head_t *parent = NULL;
+    if (node->parent >= 0 && (compare_obj_usage(before, after) != 0 || box_node_reclaimable(node)))
+    {
+        parent = box_node(meta, node->parent);
+        lock_pin(&parent->rw_lock);
+    }
+    unlock(&node->rw_lock);
+
+    if (parent)
+        update_parent(meta, parent, node, false, true);
+}
+
 void box_free(void *metaptr, const uint64_t obj_offset)
 {
     box_meta_t *meta = metaptr;
     uint8_t slot_index = 0;
+    box_trace(metaptr, BOX_TRACE_FREE, 0, obj_offset);
+    uint64_t instr = box_instr_begin();
 
     // 查找对象所在的节点和槽位
 
-    box_head_t *node = find_obj_node(meta, obj_offset, &slot_index);
+    box_head_t *node = find_obj_node(meta, obj_offset, &slot_index, true);
 
     if (!node)
     {
         LOG("[ERROR] free failed: object+%lu not found", obj_offset);
+        if (instr)
+            box_instr_free_end(instr);
         return;
     }
+    obj_usage before = box_and_child_max_obj_capacity(node);
+
+    box_release_slots(meta, node, slot_index);
+    box_unlock_update(meta, node, before);
+    if (instr)
+        box_instr_free_end(instr);
 
-    // 释放槽位
-    node->used_slots[slot_index].state = BOX_UNUSED;
-    node->used_slots[slot_index].continue_max = 16;
+    LOG("[INFO] object+%lu freed", obj_offset);
+}
 
-    // 释放连续的OBJ_CONTINUED槽位
-    for (int i = slot_index + 1; i < node->avliable_slot; i++)
+static int compare_offset(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+void box_free_n(void *metaptr, uint64_t *offsets, const size_t count)
+{
+    if (!metaptr || !offsets)
+        return;
+    box_meta_t *meta = metaptr;
+    for (size_t i = 0; i < count; i++)
+        box_trace(metaptr, BOX_TRACE_FREE, 0, offsets[i]);
+
+    // 排序后，同一节点内的obj相邻，每个节点只加锁、更新一次
+    qsort(offsets, count, sizeof(uint64_t), compare_offset);
+
+    size_t i = 0;
+    while (i < count)
     {
-        if (node->used_slots[i].state == OBJ_CONTINUED)
+        uint8_t slot_index = 0;
+        box_head_t *node = find_obj_node(meta, offsets[i], &slot_index, true);
+        if (!node)
         {
-            node->used_slots[i].state = BOX_UNUSED;
-            node->used_slots[i].continue_max = 16;
+            LOG("[ERROR] free failed: object+%lu not found", offsets[i]);
+            i++;
+            continue;
         }
-        else
+        obj_usage before = box_and_child_max_obj_capacity(node);
+        uint64_t slot_bytes = obj_offset((obj_usage){
+            .level = node->objlevel,
+            .multiple = 1,
+        });
+        uint64_t window = offsets[i] / slot_bytes / 16;
+
+        box_release_slots(meta, node, slot_index);
+        i++;
+
+        // 同一节点范围内、且起始于本节点槽位的后续obj
+        while (i < count && offsets[i] / slot_bytes / 16 == window && offsets[i] % slot_bytes == 0)
         {
-            break;
+            uint8_t slot = (offsets[i] / slot_bytes) % 16;
+            if (box_slot_state(node, slot) != OBJ_START)
+                break;
+            box_release_slots(meta, node, slot);
+            i++;
         }
+
+        box_unlock_update(meta, node, before);
+    }
+    LOG("[INFO] %zu objects freed", count);
+}
+
+uint64_t box_realloc(void *metaptr, const uint64_t obj_offset, const size_t new_size)
+{
+    if (!metaptr)
+        return BOX_FAILED;
+
+    box_meta_t *meta = metaptr;
+    uint8_t slot_index = 0;
+    box_head_t *node = find_obj_node(meta, obj_offset, &slot_index, true);
+    if (!node)
+    {
+        LOG("[ERROR] realloc failed: object+%lu not found", obj_offset);
+        return BOX_FAILED;
     }
 
-    // 更新连续最大空闲槽位计数
-    uint8_t new_max = box_continuous_max(node);
-    void *boxhead=(void*)meta+sizeof(box_meta_t);
-    if (node->max_obj_capacity != new_max)
+    obj_usage aligned_objsize = box_request_usage(new_size);
+    uint8_t count = box_obj_slots(node, slot_index);
+    // 超出本节点的槽位粒度时wanted为0，只能搬移
+    uint8_t wanted = 0;
+    if (aligned_objsize.level < node->objlevel)
+        wanted = 1; // 不足一个槽位，保留起始槽位
+    else if (aligned_objsize.level == node->objlevel)
+        wanted = aligned_objsize.multiple;
+
+    if (wanted && wanted <= count)
     {
-        node->max_obj_capacity = new_max;
-        if (node->parent >= 0)
-        {
-            box_head_t *parent =boxhead + blockdata_offset(&meta->blocks, node->parent);
-            update_parent(meta, parent, false, true);
-        }
+        // 原地缩小：释放尾部的OBJ_CONTINUED槽位
+        obj_usage before = box_and_child_max_obj_capacity(node);
+        box_journal_slot_t *j = box_journal_begin(meta);
+        box_journal_save(meta, j, node, sizeof(*node));
+        for (int i = slot_index + wanted; i < slot_index + count; i++)
+            box_set_slot_state(node, i, BOX_UNUSED);
+        box_journal_commit(j, -1);
+        box_journal_end(meta, j);
+        box_count_obj(meta, node->objlevel, count, -1);
+        box_count_obj(meta, node->objlevel, wanted, 1);
+        box_count_request(meta, new_size, (obj_usage){.level = node->objlevel, .multiple = wanted}, 1);
+        box_unlock_update(meta, node, before);
+        LOG("[INFO] object+%lu shrunk in place, %d -> %d slots", obj_offset, count, wanted);
+        return obj_offset;
     }
 
-    LOG("[INFO] object+%lu freed", obj_offset);
+    bool fits = wanted && slot_index + wanted <= node->avliable_slot;
+    for (int i = slot_index + count; fits && i < slot_index + wanted; i++)
+        fits = box_slot_state(node, i) == BOX_UNUSED;
+    if (fits)
+    {
+        // 原地扩大：后续槽位空闲，标记为OBJ_CONTINUED
+        obj_usage before = box_and_child_max_obj_capacity(node);
+        box_journal_slot_t *j = box_journal_begin(meta);
+        box_journal_save(meta, j, node, sizeof(*node));
+        for (int i = slot_index + count; i < slot_index + wanted; i++)
+            box_set_slot_state(node, i, OBJ_CONTINUED);
+        box_journal_commit(j, -1);
+        box_journal_end(meta, j);
+        box_count_obj(meta, node->objlevel, count, -1);
+        box_count_obj(meta, node->objlevel, wanted, 1);
+        box_count_request(meta, new_size, (obj_usage){.level = node->objlevel, .multiple = wanted}, 1);
+        box_unlock_update(meta, node, before);
+        LOG("[INFO] object+%lu grown in place, %d -> %d slots", obj_offset, count, wanted);
+        return obj_offset;
+    }
+    unlock(&node->rw_lock);
+
+    // 需要搬移：旧obj保持不变，由调用者复制数据后释放
+    uint64_t offset = box_alloc(metaptr, new_size);
+    LOG("[INFO] object+%lu relocated to object+%lu", obj_offset, offset);
+    return offset;
 }
 
 uint64_t box_allocated_size(void *metaptr, const uint64_t obj_off)
@@ -594,19 +1565,15 @@ uint64_t box_allocated_size(void *metaptr, const uint64_t obj_off)
 
     box_meta_t *meta = metaptr;
     uint8_t slot_index = 0;
-    box_head_t *node = find_obj_node(meta, obj_off, &slot_index);
+    box_head_t *node = find_obj_node(meta, obj_off, &slot_index, false);
     if (!node)
+    {
+        box_trace(metaptr, BOX_TRACE_SIZE, 0, obj_off);
         return 0; // 未找到
+    }
 
     // 计算该对象占据的连续槽位数
-    uint8_t count = 1;
-    for (int i = slot_index + 1; i < node->avliable_slot; i++)
-    {
-        if (node->used_slots[i].state == OBJ_CONTINUED)
-            count++;
-        else
-            break;
-    }
+    uint8_t count = box_obj_slots(node, slot_index);
 
     // 使用 obj_usage + obj_offset 复用对齐/计算逻辑
     obj_usage usage;
@@ -618,6 +1585,372 @@ uint64_t box_allocated_size(void *metaptr, const uint64_t obj_off)
         usage.level = node->objlevel;
         usage.multiple = count;
     }
+    runlock(&node->rw_lock);
 
+    box_trace(metaptr, BOX_TRACE_SIZE, obj_offset(usage), obj_off);
     return obj_offset(usage);
 }
+
+int box_extend_meta(void *metaptr, const size_t new_boxhead_bytessize)
+{
+    if (!metaptr || box_check_magic(metaptr) != 0)
+    {
+        LOG("[ERROR] box_meta_t not initialized");
+        return -1;
+    }
+    box_meta_t *meta = metaptr;
+
+    lock(&meta->blocks_lock);
+    unsigned k = box_extents(meta);
+    uint64_t offset = (meta->boxhead_bytessize + 7) / 8 * 8;
+    size_t header = (sizeof(blocks_meta_t) + 7) / 8 * 8;
+    if (k >= BOX_META_EXTENTS || new_boxhead_bytessize < offset + header + sizeof(box_head_t))
+    {
+        unlock(&meta->blocks_lock);
+        LOG("[ERROR] cannot extend meta from %lu to %zu bytes (%u extents)", meta->boxhead_bytessize, new_boxhead_bytessize, k);
+        return -1;
+    }
+
+    // 新池的id接在上一个池之后：每个block至少占 sizeof(box_head_t) 字节，据此得到上一个池id的上界
+    uint8_t *prev_data = k == 0 ? box_boxhead(meta) : box_extent_data(meta, k - 1);
+    size_t prev_bytes = (uint8_t *)meta + meta->boxhead_bytessize - prev_data;
+    int64_t first_id = (k == 0 ? 0 : meta->ext.extent_first_id[k - 1]) + prev_bytes / sizeof(box_head_t) + 1;
+    size_t data_bytes = new_boxhead_bytessize - offset - header;
+    if (first_id + data_bytes / sizeof(box_head_t) > INT32_MAX)
+    {
+        unlock(&meta->blocks_lock);
+        LOG("[ERROR] block id overflow extending meta to %zu bytes", new_boxhead_bytessize);
+        return -1;
+    }
+
+    meta->ext.extent_offset[k] = offset;
+    meta->ext.extent_first_id[k] = first_id;
+    blocks_meta_t *pool = (blocks_meta_t *)((uint8_t *)meta + offset);
+    // 与box_init相同：有索引时block的锁字不能在复用时重置，新池先清零
+    if (box_index(meta))
+        memset(box_extent_data(meta, k), 0, data_bytes);
+    blocks_init(pool, data_bytes, sizeof(box_head_t));
+    meta->boxhead_bytessize = new_boxhead_bytessize;
+    atomic_store_explicit(&meta->ext.extents, k + 1, memory_order_release);
+    unlock(&meta->blocks_lock);
+    LOG("[INFO] meta extended to %zu bytes, block ids from %ld", new_boxhead_bytessize, first_id);
+    return 0;
+}
+
+/*
+ * 把node的可用槽位扩展到slots个，新增的槽位为空闲。
+ * 线程安全需求：调用者持有node的写锁。
+ */
+static void box_extend_slots(box_meta_t *meta, box_head_t *node, uint8_t slots)
+{
+    for (int i = node->avliable_slot; i < slots; i++)
+        box_set_slot_state(node, i, BOX_UNUSED);
+    node->avliable_slot = slots;
+    box_update_max(meta, node);
+}
+
+/*
+ * 线程安全需求：
+ * - 持有根节点的写锁完成扩展，新建的上层节点在发布前已加写锁。
+ * - 原根节点在写锁内得到parent，此后它的容量变化正常向上传递；
+ *   加锁前读到旧root_id的线程由 box_lock_root 发现节点已有parent后重新读取。
+ */
+int box_extend_obj(void *metaptr, const size_t new_box_bytessize)
+{
+    if (!metaptr || box_check_magic(metaptr) != 0)
+    {
+        LOG("[ERROR] box_meta_t not initialized");
+        return -1;
+    }
+    box_meta_t *meta = metaptr;
+    obj_usage newsize = align_to(new_box_bytessize / 8);
+    if (new_box_bytessize % 8 != 0 || new_box_bytessize != obj_offset(newsize))
+    {
+        LOG("[ERROR] box_bytessize must be 8*16^n*x, x=[1,15]. Given size: %zu", new_box_bytessize);
+        return -1;
+    }
+
+    box_head_t *root = box_lock_root(meta, true);
+    obj_usage oldsize = {.level = root->objlevel, .multiple = root->avliable_slot};
+    if (compare_obj_usage(newsize, oldsize) <= 0)
+    {
+        unlock(&root->rw_lock);
+        if (compare_obj_usage(newsize, oldsize) == 0)
+            return 0;
+        LOG("[ERROR] box cannot shrink from %lu to %zu bytes", obj_offset(oldsize), new_box_bytessize);
+        return -1;
+    }
+
+    box_journal_slot_t *j = box_journal_begin(meta);
+    box_journal_save(meta, j, root, sizeof(*root));
+    box_journal_save(meta, j, &meta->box_bytessize, sizeof(meta->box_bytessize));
+    box_journal_save(meta, j, &meta->ext.root_id, sizeof(meta->ext.root_id));
+    if (newsize.level == oldsize.level)
+    {
+        // 同一层：根节点增加槽位即可
+        box_extend_slots(meta, root, newsize.multiple);
+        meta->box_bytessize = new_box_bytessize;
+        box_journal_commit(j, -1);
+        box_journal_end(meta, j);
+        unlock(&root->rw_lock);
+        LOG("[INFO] box extended to %zu bytes", new_box_bytessize);
+        return 0;
+    }
+
+    // 自下而上新建 objlevel 为 oldsize.level+1 ~ newsize.level 的节点，每个节点的slot 0是下一层的节点
+    int64_t ids[16];
+    box_head_t *nodes[16];
+    int n = 0;
+    for (uint8_t level = oldsize.level + 1; level <= newsize.level; level++)
+    {
+        ids[n] = box_blocks_alloc(meta);
+        if (ids[n] < 0)
+        {
+            // 根节点还没有修改，提交后逐个归还：崩溃时至多泄漏，不会重复归还
+            box_journal_commit(j, -1);
+            while (n-- > 0)
+            {
+                unlock(&nodes[n]->rw_lock);
+                box_blocks_free(meta, ids[n]);
+            }
+            box_journal_end(meta, j);
+            unlock(&root->rw_lock);
+            LOG("[ERROR] meta exhausted extending box to %zu bytes", new_box_bytessize);
+            return -1;
+        }
+        box_journal_alloc(j, ids[n]);
+        nodes[n] = box_node(meta, ids[n]);
+        if (!box_index(meta))
+            atomic_init(&nodes[n]->rw_lock, 0);
+        lock(&nodes[n]->rw_lock);
+        box_format(meta, nodes[n], level, level == newsize.level ? newsize.multiple : 16, -1);
+        n++;
+    }
+
+    // 原根节点扩展到16个槽位，成为slot 0：原有的offset不变
+    box_extend_slots(meta, root, 16);
+    box_head_t *child = root;
+    int64_t child_id = box_node_id(meta, root);
+    for (int i = 0; i < n; i++)
+    {
+        child->parent = (int32_t)ids[i];
+        obj_usage capacity = box_and_child_max_obj_capacity(child);
+        nodes[i]->childs_blockid[0] = (int32_t)child_id;
+        box_set_slot_state(nodes[i], 0, BOX_FORMATTED);
+        nodes[i]->child_cap[0] = obj_usage_key(capacity);
+        nodes[i]->child_max_obj_capacity = capacity;
+        box_update_max(meta, nodes[i]);
+        child = nodes[i];
+        child_id = ids[i];
+    }
+
+    meta->box_bytessize = new_box_bytessize;
+    atomic_store_explicit(&meta->ext.root_id, (int32_t)child_id, memory_order_release);
+    box_journal_commit(j, -1);
+    box_journal_end(meta, j);
+    for (int i = n; i-- > 0;)
+        unlock(&nodes[i]->rw_lock);
+    unlock(&root->rw_lock);
+    LOG("[INFO] box extended to %zu bytes, new root block %ld", new_box_bytessize, child_id);
+    return 0;
+}
+
+/*
+ * 崩溃后从node（起始于base）向下遍历：清除残留的锁，自下而上重新汇总容量，统计保留的空节点和 box_stats 的计数器，重建索引。
+ * 线程安全需求：只在 box_attach 中调用，此时没有其它线程访问meta区。
+ */
+static void box_recover_node(box_meta_t *meta, box_head_t *node, uint64_t base, unsigned *kept)
+{
+    atomic_store_explicit(&node->rw_lock, 0, memory_order_relaxed);
+    obj_usage child_max = {0, 0};
+    memset(node->child_cap, 0, sizeof(node->child_cap));
+    uint16_t formatted = box_formatted_mask(node);
+    while (formatted)
+    {
+        int i = __builtin_ctz(formatted);
+        formatted &= formatted - 1;
+        box_head_t *child = box_node(meta, node->childs_blockid[i]);
+        box_recover_node(meta, child, base + obj_offset((obj_usage){.level = node->objlevel, .multiple = i}), kept);
+        obj_usage capacity = box_and_child_max_obj_capacity(child);
+        node->child_cap[i] = obj_usage_key(capacity);
+        if (compare_obj_usage(capacity, child_max) > 0)
+            child_max = capacity;
+    }
+    node->child_max_obj_capacity = child_max;
+    node->max_obj_capacity = box_continuous_max(node);
+    box_count_node(meta, node, 1);
+    for (int i = 0; i < node->avliable_slot; i++)
+    {
+        if (box_slot_state(node, i) == OBJ_START)
+            box_count_obj(meta, node->objlevel, box_obj_slots(node, i), 1);
+    }
+    if (node->slots.kept_empty)
+        (*kept)++;
+    box_index_node(meta, node, box_node_id(meta, node), base);
+}
+
+/*
+ * 有索引时，空闲block的锁字在复用时不会重置（见box_init），崩溃时残留在空闲block上的锁须逐个清除。
+ * 线程安全需求：只在 box_attach 中调用。
+ */
+static void box_recover_block_locks(box_meta_t *meta)
+{
+    unsigned extents = box_extents(meta);
+    for (unsigned k = 0; k <= extents; k++)
+    {
+        blocks_meta_t *pool = k == 0 ? &meta->blocks : (blocks_meta_t *)((uint8_t *)meta + meta->ext.extent_offset[k - 1]);
+        uint8_t *data = k == 0 ? box_boxhead(meta) : box_extent_data(meta, k - 1);
+        uint8_t *end = (uint8_t *)meta + (k < extents ? meta->ext.extent_offset[k] : meta->boxhead_bytessize);
+        for (int64_t id = 0; data + blockdata_offset(pool, id) + sizeof(box_head_t) <= end; id++)
+        {
+            box_head_t *node = (box_head_t *)(data + blockdata_offset(pool, id));
+            atomic_store_explicit(&node->rw_lock, 0, memory_order_relaxed);
+        }
+    }
+}
+
+/*
+ * 撤销未提交的修改、补做已提交的归还，再遍历整棵树重建运行时状态。
+ * 日志槽在处理完后才清除，本身崩溃时下次 box_attach 重做即可。
+ */
+static void box_recover(box_meta_t *meta)
+{
+    box_journal_slot_t *slots = box_journal(meta);
+    for (uint32_t k = 0; slots && k < meta->ext.journal_slots; k++)
+    {
+        box_journal_slot_t *j = &slots[k];
+        if (atomic_load_explicit(&j->active, memory_order_acquire))
+        {
+            for (unsigned n = atomic_load_explicit(&j->images, memory_order_acquire); n-- > 0;)
+                memcpy((uint8_t *)meta + j->image[n].offset, j->image[n].data, j->image[n].bytes);
+            for (uint32_t b = 0; b < j->blocks; b++)
+                box_blocks_free(meta, j->alloc_ids[b]);
+            LOG("[INFO] journal slot %u rolled back: %u images, %u blocks", k, atomic_load(&j->images), j->blocks);
+        }
+        else if (j->free_id >= 0)
+        {
+            box_blocks_free(meta, j->free_id);
+            LOG("[INFO] journal slot %u redone: block %d freed", k, j->free_id);
+        }
+        j->blocks = 0;
+        j->free_id = -1;
+        atomic_store_explicit(&j->images, 0, memory_order_relaxed);
+        atomic_store_explicit(&j->active, 0, memory_order_release);
+    }
+
+    atomic_int_least32_t *index = box_index(meta);
+    if (index)
+    {
+        box_recover_block_locks(meta);
+        for (uint64_t i = 0; i < meta->ext.index_entries; i++)
+            atomic_store_explicit(&index[i], -1, memory_order_relaxed);
+    }
+    // 累计值无法从树中得到，保持不变
+    box_counters_t *counters = &meta->ext.counters;
+    atomic_store_explicit(&counters->allocated_bytes, 0, memory_order_relaxed);
+    atomic_store_explicit(&counters->nodes, 0, memory_order_relaxed);
+    for (int i = 0; i < 16; i++)
+        atomic_store_explicit(&counters->objects[i], 0, memory_order_relaxed);
+    for (int i = 0; i <= 16; i++)
+        atomic_store_explicit(&counters->free_runs[i], 0, memory_order_relaxed);
+    unsigned kept = 0;
+    box_recover_node(meta, box_node(meta, box_root_id(meta)), 0, &kept);
+    atomic_store_explicit(&meta->ext.empty_kept, kept, memory_order_relaxed);
+    LOG("[INFO] box recovered, %u empty nodes kept", kept);
+}
+
+int box_attach(void *metaptr)
+{
+    if (!metaptr || box_check_magic(metaptr) != 0)
+    {
+        LOG("[ERROR] box_meta_t not initialized");
+        return -1;
+    }
+    box_meta_t *meta = metaptr;
+    // 只接受当前布局：其它版本的字段位置不同，不能按当前布局读取
+    if (meta->layout_version != BOX_LAYOUT_VERSION || meta->ext.ext_bytessize != sizeof(meta->ext))
+    {
+        LOG("[ERROR] unsupported layout version %u", meta->layout_version);
+        return -1;
+    }
+    if (meta->ext.checksum != box_meta_checksum(meta))
+    {
+        LOG("[ERROR] box_meta_t checksum mismatch");
+        return -1;
+    }
+
+    atomic_store_explicit(&meta->blocks_lock, 0, memory_order_relaxed);
+    atomic_store_explicit(&meta->ext.journal_busy, 0, memory_order_relaxed);
+    if (meta->ext.open_state != BOX_CLOSED)
+        box_recover(meta);
+    meta->ext.open_state = BOX_OPEN;
+    atomic_thread_fence(memory_order_seq_cst);
+    LOG("[INFO] box_attach success");
+    return 0;
+}
+
+int box_detach(void *metaptr)
+{
+    if (!metaptr || box_check_magic(metaptr) != 0)
+    {
+        LOG("[ERROR] box_meta_t not initialized");
+        return -1;
+    }
+    box_meta_t *meta = metaptr;
+    if (atomic_load_explicit(&meta->ext.journal_busy, memory_order_acquire) != 0)
+    {
+        LOG("[ERROR] box_detach while modifications are in progress");
+        return -1;
+    }
+    meta->ext.open_state = BOX_CLOSED;
+    return 0;
+}
+
+// 各block池能容纳的box_head_t数之和，按首个block的位置和block的跨度计算
+static uint64_t box_nodes_capacity(box_meta_t *meta)
+{
+    uint64_t capacity = 0;
+    unsigned extents = box_extents(meta);
+    for (unsigned k = 0; k <= extents; k++)
+    {
+        blocks_meta_t *pool = k == 0 ? &meta->blocks : (blocks_meta_t *)((uint8_t *)meta + meta->ext.extent_offset[k - 1]);
+        uint8_t *data = k == 0 ? box_boxhead(meta) : box_extent_data(meta, k - 1);
+        uint8_t *end = (uint8_t *)meta + (k < extents ? meta->ext.extent_offset[k] : meta->boxhead_bytessize);
+        size_t first = blockdata_offset(pool, 0);
+        size_t stride = blockdata_offset(pool, 1) - first;
+        if (end >= data + first + sizeof(box_head_t))
+            capacity += (end - data - first - sizeof(box_head_t)) / stride + 1;
+    }
+    return capacity;
+}
+
+int box_stats(void *metaptr, box_stats_t *out)
+{
+    if (!metaptr || !out || box_check_magic(metaptr) != 0)
+    {
+        LOG("[ERROR] box_meta_t not initialized");
+        return -1;
+    }
+    box_meta_t *meta = metaptr;
+    box_counters_t *counters = &meta->ext.counters;
+
+    memset(out, 0, sizeof(*out));
+    out->box_bytessize = meta->box_bytessize;
+    out->allocated_bytes = atomic_load_explicit(&counters->allocated_bytes, memory_order_relaxed);
+    out->requested_total = atomic_load_explicit(&counters->requested_total, memory_order_relaxed);
+    out->rounded_total = atomic_load_explicit(&counters->rounded_total, memory_order_relaxed);
+    for (int i = 0; i < BOX_STATS_LEVELS; i++)
+        out->objects[i] = atomic_load_explicit(&counters->objects[i], memory_order_relaxed);
+    out->nodes = atomic_load_explicit(&counters->nodes, memory_order_relaxed);
+    out->nodes_capacity = box_nodes_capacity(meta);
+    for (int i = 0; i <= 16; i++)
+        out->free_runs[i] = atomic_load_explicit(&counters->free_runs[i], memory_order_relaxed);
+
+    // 根节点自身的槽位或子树中最大的连续空闲空间
+    box_head_t *root = box_lock_root(meta, false);
+    uint64_t own = obj_offset((obj_usage){.level = root->objlevel, .multiple = root->max_obj_capacity});
+    uint64_t child = obj_offset(root->child_max_obj_capacity);
+    runlock(&root->rw_lock);
+    out->largest_free = own > child ? own : child;
+    return 0;
+}
@@ -1,27 +1,199 @@
 #ifndef LOCK_H
 #define LOCK_H
 
+#include <stdint.h>
 #include <stdatomic.h>
+#include <sched.h>
 
-static void rlock(atomic_int_fast64_t *lock) {
-    int_fast64_t expected = 0;
-    while (!atomic_compare_exchange_weak(lock, &expected, 1)) {
-        expected = 0;  // 重置 expected
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// linux下自旋和让出CPU都拿不到锁时，在futex上睡眠；其它平台只用sched_yield
+#if defined(__linux__) && !defined(BOX_LOCK_NO_FUTEX)
+#define BOX_LOCK_FUTEX
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+/*
+读写锁，占用box_head_t中8字节的rw_lock
+bit[0,29]  持有读锁的线程数
+bit30      写锁已被持有
+bit31      有线程在futex上睡眠，解锁时需要唤醒
+bit[32,47] 等待中的写者数，不为0时新的读者不能进入（写者优先）
+bit[48,62] pin住节点、稍后才来获取写锁的线程数，不阻止读者（见 lock_pin）
+
+低32位是futex的等待字。
+*/
+#define RW_READER (INT64_C(1))
+#define RW_READER_MASK (INT64_C(0x3fffffff))
+#define RW_WRITER (INT64_C(1) << 30)
+#define RW_SLEEPER (INT64_C(1) << 31)
+#define RW_WAITING_WRITER (INT64_C(1) << 32)
+#define RW_WAITING_MASK (INT64_C(0xffff) << 32)
+#define RW_PIN (INT64_C(1) << 48)
+
+// 指数退避：前 BOX_LOCK_SPIN_LIMIT 次每次pause 2^n 次，之后 sched_yield，
+// 再超过 BOX_LOCK_YIELD_LIMIT 次后在futex上睡眠
+#ifndef BOX_LOCK_SPIN_LIMIT
+#define BOX_LOCK_SPIN_LIMIT 10
+#endif
+#ifndef BOX_LOCK_YIELD_LIMIT
+#define BOX_LOCK_YIELD_LIMIT 20
+#endif
+
+static inline void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+#ifdef BOX_LOCK_FUTEX
+static inline uint32_t *futex_word(atomic_int_fast64_t *lock)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    return (uint32_t *)lock + 1;
+#else
+    return (uint32_t *)lock;
+#endif
+}
+
+static inline void futex_sleep(atomic_int_fast64_t *lock, int_fast64_t expected)
+{
+    // 标记有睡眠者，然后只在锁状态未变化时睡眠
+    if (!(expected & RW_SLEEPER) &&
+        !atomic_compare_exchange_strong(lock, &expected, expected | RW_SLEEPER))
+        return;
+    syscall(SYS_futex, futex_word(lock), FUTEX_WAIT_PRIVATE, (uint32_t)(expected | RW_SLEEPER), NULL, NULL, 0);
+}
+
+static inline void futex_wakeup(atomic_int_fast64_t *lock)
+{
+    syscall(SYS_futex, futex_word(lock), FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+#endif
+
+static inline void lock_backoff(atomic_int_fast64_t *lock, int_fast64_t observed, uint32_t *spins)
+{
+    uint32_t n = (*spins)++;
+    if (n < BOX_LOCK_SPIN_LIMIT)
+    {
+        for (uint32_t i = 0; i < (1u << n); i++)
+            cpu_relax();
+        return;
+    }
+#ifdef BOX_LOCK_FUTEX
+    if (n >= BOX_LOCK_YIELD_LIMIT)
+    {
+        futex_sleep(lock, observed);
+        return;
+    }
+#else
+    (void)lock;
+    (void)observed;
+#endif
+    sched_yield();
+}
+
+// 释放后如果有睡眠者，清除标记并全部唤醒
+static inline void lock_wake(atomic_int_fast64_t *lock, int_fast64_t prev)
+{
+#ifdef BOX_LOCK_FUTEX
+    if (prev & RW_SLEEPER)
+    {
+        atomic_fetch_and_explicit(lock, ~RW_SLEEPER, memory_order_relaxed);
+        futex_wakeup(lock);
+    }
+#else
+    (void)lock;
+    (void)prev;
+#endif
+}
+
+static inline void rlock(atomic_int_fast64_t *lock) {
+    uint32_t spins = 0;
+    for (;;)
+    {
+        int_fast64_t v = atomic_load_explicit(lock, memory_order_relaxed);
+        // 无写者持有，也无写者等待
+        if (!(v & (RW_WRITER | RW_WAITING_MASK)))
+        {
+            if (atomic_compare_exchange_weak_explicit(lock, &v, v + RW_READER,
+                                                      memory_order_acquire, memory_order_relaxed))
+                return;
+            continue;
+        }
+        lock_backoff(lock, v, &spins);
     }
 }
 
-static void runlock(atomic_int_fast64_t *lock) {
-    atomic_store(lock, 0);
+static inline void runlock(atomic_int_fast64_t *lock) {
+    int_fast64_t prev = atomic_fetch_sub_explicit(lock, RW_READER, memory_order_release);
+    // 最后一个读者负责唤醒
+    if ((prev & RW_READER_MASK) == RW_READER)
+        lock_wake(lock, prev);
+}
+
+/*
+pin住节点，之后必须用 lock_pinned 取得写锁。
+持有子节点的锁时pin住父节点，再释放子节点、等待父节点的写锁：
+pin期间父节点的 lock_waiters 不为0，回收方据此跳过该节点，节点不会在等待期间被释放。
+pin不阻止读者，同一线程pin住祖先节点后仍可以读取它。
+*/
+static inline void lock_pin(atomic_int_fast64_t *lock) {
+    atomic_fetch_add_explicit(lock, RW_PIN, memory_order_relaxed);
 }
 
-static void lock(atomic_int_fast64_t *lock) {
-    int_fast64_t expected = 0;
-    while (!atomic_compare_exchange_weak(lock, &expected, 2)) {
-        expected = 0;
+/*
+不取写锁、撤销pin。只读的遍历同样pin住父节点、释放父节点的读锁后访问子节点，
+回来时先 rlock 再 lock_unpin，节点在两者之间不会被回收。
+*/
+static inline void lock_unpin(atomic_int_fast64_t *lock) {
+    atomic_fetch_sub_explicit(lock, RW_PIN, memory_order_relaxed);
+}
+
+static inline void lock_acquire(atomic_int_fast64_t *lock) {
+    uint32_t spins = 0;
+    for (;;)
+    {
+        int_fast64_t v = atomic_load_explicit(lock, memory_order_relaxed);
+        if (!(v & (RW_READER_MASK | RW_WRITER)))
+        {
+            if (atomic_compare_exchange_weak_explicit(lock, &v, (v - RW_WAITING_WRITER) | RW_WRITER,
+                                                      memory_order_acquire, memory_order_relaxed))
+                return;
+            continue;
+        }
+        lock_backoff(lock, v, &spins);
     }
 }
 
-static void unlock(atomic_int_fast64_t *lock) {
-    atomic_store(lock, 0);
+static inline void lock_pinned(atomic_int_fast64_t *lock) {
+    // pin转为等待写者
+    atomic_fetch_add_explicit(lock, RW_WAITING_WRITER - RW_PIN, memory_order_relaxed);
+    lock_acquire(lock);
+}
+
+static inline void lock(atomic_int_fast64_t *lock) {
+    // 先登记为等待写者，阻止新的读者进入
+    atomic_fetch_add_explicit(lock, RW_WAITING_WRITER, memory_order_relaxed);
+    lock_acquire(lock);
+}
+
+// 等待中和已pin的写者数
+static inline int_fast64_t lock_waiters(atomic_int_fast64_t *lock) {
+    int_fast64_t v = atomic_load_explicit(lock, memory_order_relaxed);
+    return ((v & RW_WAITING_MASK) / RW_WAITING_WRITER) + v / RW_PIN;
+}
+
+static inline void unlock(atomic_int_fast64_t *lock) {
+    int_fast64_t prev = atomic_fetch_and_explicit(lock, ~RW_WRITER, memory_order_release);
+    lock_wake(lock, prev);
 }
 #endif // LOCK_H
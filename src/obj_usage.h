@@ -15,62 +15,72 @@ typedef struct
     uint8_t multiple : 4; // obj最长连续可用的slots [1,15],如果==0,说明无可用
 } __attribute__((packed)) obj_usage;
 
-static uint64_t int_pow(uint64_t base, uint32_t exp)
+// 16^exp，即 1<<(4*exp)
+static inline uint64_t int_pow16(uint32_t exp)
 {
-    uint64_t result = 1;
-    for (uint32_t i = 0; i < exp; i++)
-    {
-        result *= base;
-    }
-    return result;
+    return UINT64_C(1) << (4 * exp);
 }
-static uint32_t int_log(uint64_t n, uint32_t base)
+// floor(log16(n))，n>=1：最高位的位置/4
+static inline uint32_t int_log16(uint64_t n)
 {
-    uint32_t log = 0;
-    while (n >= base)
-    {
-        n /= base;
-        log++;
-    }
-    return log;
+    return (uint32_t)(63 - __builtin_clzll(n)) >> 2;
 }
-static obj_usage align_to(uint64_t n)
-{
-    uint32_t base = 16;
-    obj_usage result = {0, 0};
-    if (n < base)
-    {
-        result.multiple = n;
-        return result;
-    }
 
-    result.level = int_log(n, base);
-    uint64_t minbase = int_pow(base, result.level);
+/*
+n<256（2KB以内）的 align_to 结果，按 obj_usage_key 编码。
+n<16 时为 {0,n}；否则为 {1,ceil(n/16)}，ceil(n/16)==16 时进位为 {2,1}。
+*/
+#define ALIGN_KEY(n) ((n) < 16 ? (n) : ((n) + 15) / 16 >= 16 ? 0x21 : 0x10 | ((n) + 15) / 16)
+#define ALIGN_KEY4(n) ALIGN_KEY(n), ALIGN_KEY(n + 1), ALIGN_KEY(n + 2), ALIGN_KEY(n + 3)
+#define ALIGN_KEY16(n) ALIGN_KEY4(n), ALIGN_KEY4(n + 4), ALIGN_KEY4(n + 8), ALIGN_KEY4(n + 12)
+#define ALIGN_KEY64(n) ALIGN_KEY16(n), ALIGN_KEY16(n + 16), ALIGN_KEY16(n + 32), ALIGN_KEY16(n + 48)
+static const uint8_t align_small_keys[256] = {
+    ALIGN_KEY64(0), ALIGN_KEY64(64), ALIGN_KEY64(128), ALIGN_KEY64(192),
+};
+#undef ALIGN_KEY64
+#undef ALIGN_KEY16
+#undef ALIGN_KEY4
+#undef ALIGN_KEY
+
+// n个8字节单位向上对齐到 multiple*16^level
+static inline obj_usage align_to(uint64_t n)
+{
+    if (n < 256)
+        return (obj_usage){.level = align_small_keys[n] >> 4, .multiple = align_small_keys[n] & 0xf};
 
-    result.multiple = (n + minbase - 1) / minbase;
-    if (result.multiple >= base)
-    {
-        result.multiple = 1;
-        result.level++;
-        minbase = int_pow(base, result.level);
-    }
-    return result;
+    uint32_t level = int_log16(n);
+    uint32_t shift = 4 * level;
+    // multiple只有4bit，先用uint64_t计算，避免16被截断为0
+    uint64_t multiple = (n + (UINT64_C(1) << shift) - 1) >> shift;
+    // multiple==16 时进位到上一层
+    uint32_t carry = multiple >> 4;
+    return (obj_usage){
+        .level = level + carry,
+        .multiple = carry ? 1 : multiple,
+    };
 }
-static int8_t compare_obj_usage(const obj_usage a, obj_usage b)
+static inline int8_t compare_obj_usage(const obj_usage a, obj_usage b)
 {
     if (a.level != b.level)
         return a.level - b.level;
     return a.multiple - b.multiple;
 }
-static uint64_t obj_offset(const obj_usage a)
+// 编码为可按无符号字节比较大小的key：level在高4位，multiple在低4位
+static inline uint8_t obj_usage_key(const obj_usage a)
+{
+    return (uint8_t)(a.level << 4 | a.multiple);
+}
+static inline obj_usage obj_usage_from_key(uint8_t key)
+{
+    return (obj_usage){
+        .level = key >> 4,
+        .multiple = key & 0xf,
+    };
+}
+static inline uint64_t obj_offset(const obj_usage a)
 {
-    uint64_t offset = 8;
-    for (int i = 0; i < a.level; i++)
-    {
-        offset *= 16;
-    }
-    offset *= (a.multiple);
-    return offset;
+    // 8*16^level*multiple
+    return (uint64_t)a.multiple << (4 * a.level + 3);
 }
 
 #endif // OBJ_USAGE_H
\ No newline at end of file
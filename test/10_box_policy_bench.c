@@ -0,0 +1,141 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+// 比较 first-fit 与 best-fit：混合size反复分配/释放后的失败率，以及仍可分配的最大obj
+#define META_SIZE (8 * 1024 * 1024)
+#define DATA_SIZE (32 * 1024 * 1024)
+#define NUM_LIVE 4096
+#define NUM_OPS 300000
+
+typedef struct
+{
+    long allocs;
+    long failed;
+    uint64_t largest;
+    double ns_per_op;
+} bench_result;
+
+static uint32_t next_rand(uint32_t *seed)
+{
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *seed = x;
+}
+
+// 各种size混合
+static size_t mixed_size(uint32_t *seed)
+{
+    int r = next_rand(seed) % 100;
+    if (r < 80)
+        return 8 + next_rand(seed) % 512;
+    if (r < 97)
+        return 512 + next_rand(seed) % (64 * 1024);
+    return 64 * 1024 + next_rand(seed) % (1024 * 1024);
+}
+
+// 大量不同长度的小obj，偶尔夹杂大obj
+static size_t small_size(uint32_t *seed)
+{
+    if (next_rand(seed) % 100 < 98)
+        return 8 + next_rand(seed) % 120;
+    return 64 * 1024 + next_rand(seed) % (1024 * 1024);
+}
+
+// 从大到小尝试 multiple*16^level*8 字节，第一个成功的就是当前可分配的最大obj
+static uint64_t largest_allocatable(uint8_t *meta)
+{
+    for (int level = 5; level >= 0; level--)
+    {
+        for (int multiple = 15; multiple >= 1; multiple--)
+        {
+            uint64_t size = (uint64_t)multiple << (4 * level) << 3;
+            if (size > DATA_SIZE)
+                continue;
+            uint64_t offset = box_alloc(meta, size);
+            if (offset != (uint64_t)-1)
+            {
+                box_free(meta, offset);
+                return size;
+            }
+        }
+    }
+    return 0;
+}
+
+static int run(box_policy_t policy, size_t (*random_size)(uint32_t *), bench_result *result)
+{
+    uint8_t *meta = calloc(1, META_SIZE);
+    box_options_t options = {.policy = policy};
+    if (box_init_ex(meta, META_SIZE, DATA_SIZE, &options) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return -1;
+    }
+    uint64_t *live = malloc(NUM_LIVE * sizeof(uint64_t));
+    memset(live, 0xff, NUM_LIVE * sizeof(uint64_t));
+    uint32_t seed = 2024;
+    memset(result, 0, sizeof(*result));
+
+    struct timespec t0, t1;
+    timespec_get(&t0, TIME_UTC);
+    for (int op = 0; op < NUM_OPS; op++)
+    {
+        uint64_t *slot = &live[next_rand(&seed) % NUM_LIVE];
+        size_t size = random_size(&seed);
+        if (*slot != (uint64_t)-1)
+        {
+            box_free(meta, *slot);
+            *slot = (uint64_t)-1;
+            continue;
+        }
+        result->allocs++;
+        *slot = box_alloc(meta, size);
+        if (*slot == (uint64_t)-1)
+            result->failed++;
+    }
+    timespec_get(&t1, TIME_UTC);
+    result->ns_per_op = ((t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec)) / NUM_OPS;
+    result->largest = largest_allocatable(meta);
+
+    for (int i = 0; i < NUM_LIVE; i++)
+    {
+        if (live[i] != (uint64_t)-1)
+            box_free(meta, live[i]);
+    }
+    int ok = box_alloc(meta, DATA_SIZE) == 0;
+    free(live);
+    free(meta);
+    return ok ? 0 : -1;
+}
+
+int main()
+{
+    const char *workloads[] = {"mixed", "small"};
+    size_t (*generators[])(uint32_t *) = {mixed_size, small_size};
+    const char *names[] = {"first-fit", "best-fit"};
+    box_policy_t policies[] = {BOX_FIRST_FIT, BOX_BEST_FIT};
+    int errors = 0;
+    printf("%-8s %-10s %10s %10s %12s %10s\n", "workload", "policy", "allocs", "failed", "largest", "ns/op");
+    for (int w = 0; w < 2; w++)
+    {
+        for (int i = 0; i < 2; i++)
+        {
+            bench_result r;
+            if (run(policies[i], generators[w], &r) != 0)
+            {
+                printf("%s: tree not empty after freeing everything\n", names[i]);
+                errors++;
+            }
+            printf("%-8s %-10s %10ld %9.2f%% %12lu %10.1f\n", workloads[w], names[i], r.allocs,
+                   r.allocs ? 100.0 * r.failed / r.allocs : 0.0, r.largest, r.ns_per_op);
+        }
+    }
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+#define META_SIZE (64 * 1024 * 1024)
+#define DATA_SIZE (1024UL * 1024 * 1024)
+#define INDEX_CHUNK (32 * 1024)
+#define COUNT (64 * 1024)
+#define THREADS 4
+#define ROUNDS 200
+
+static double elapsed(struct timespec a, struct timespec b)
+{
+    return (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+}
+
+static uint64_t seed_next(uint64_t *seed)
+{
+    *seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    return *seed >> 33;
+}
+
+static size_t sizes[] = {8, 24, 100, 200, 3000, 40000, 700000};
+#define SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+typedef struct
+{
+    uint8_t *meta;
+    uint64_t seed;
+    int errors;
+} worker_t;
+
+// 每个线程反复分配/释放各种size，索引中的节点不断被新建、回收、复用
+static void *worker(void *arg)
+{
+    worker_t *w = arg;
+    uint64_t offsets[256];
+    size_t owned[256];
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        for (int i = 0; i < 256; i++)
+        {
+            owned[i] = sizes[seed_next(&w->seed) % SIZES];
+            offsets[i] = box_alloc(w->meta, owned[i]);
+            if (offsets[i] == (uint64_t)-1)
+            {
+                printf("box_alloc(%zu) failed\n", owned[i]);
+                w->errors++;
+                return NULL;
+            }
+        }
+        for (int i = 0; i < 256; i++)
+        {
+            if (box_allocated_size(w->meta, offsets[i]) < owned[i])
+            {
+                printf("object+%lu allocated_size < %zu\n", offsets[i], owned[i]);
+                w->errors++;
+            }
+            box_free(w->meta, offsets[i]);
+        }
+    }
+    return NULL;
+}
+
+// 深树上查询/释放小obj的耗时
+static double bench(uint8_t *meta, uint64_t *offsets)
+{
+    for (int i = 0; i < COUNT; i++)
+        offsets[i] = box_alloc(meta, 8);
+    struct timespec t0, t1;
+    timespec_get(&t0, TIME_UTC);
+    uint64_t total = 0;
+    for (int r = 0; r < 10; r++)
+        for (int i = 0; i < COUNT; i++)
+            total += box_allocated_size(meta, offsets[i]);
+    for (int i = 0; i < COUNT; i++)
+        box_free(meta, offsets[i]);
+    timespec_get(&t1, TIME_UTC);
+    if (total != 10UL * COUNT * 8)
+        return -1;
+    return elapsed(t0, t1) * 1e9 / (11.0 * COUNT);
+}
+
+int main()
+{
+    int errors = 0;
+    uint8_t *meta = calloc(1, META_SIZE);
+    box_options_t options = {.index_chunk = INDEX_CHUNK};
+
+    // 非法的索引粒度
+    box_options_t bad[] = {{.index_chunk = 3000}, {.index_chunk = 8}, {.index_chunk = 2 * 32768}, {.index_chunk = DATA_SIZE * 16}};
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+    {
+        if (box_init_ex(meta, META_SIZE, DATA_SIZE, &bad[i]) == 0)
+        {
+            printf("index_chunk %lu accepted\n", bad[i].index_chunk);
+            errors++;
+        }
+    }
+
+    if (box_init_ex(meta, META_SIZE, DATA_SIZE, &options) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+
+    pthread_t threads[THREADS];
+    worker_t workers[THREADS];
+    for (int i = 0; i < THREADS; i++)
+    {
+        workers[i] = (worker_t){.meta = meta, .seed = i + 1};
+        pthread_create(&threads[i], NULL, worker, &workers[i]);
+    }
+    for (int i = 0; i < THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        errors += workers[i].errors;
+    }
+
+    // 全部释放后所有节点都已回收，整个obj区可以作为一个obj分配
+    uint64_t whole = box_alloc(meta, DATA_SIZE);
+    if (whole != 0)
+    {
+        printf("box not empty after churn\n");
+        errors++;
+    }
+    box_free(meta, whole);
+
+    // 不存在的offset、obj内部的offset
+    uint64_t big = box_alloc(meta, 700000);
+    if (box_allocated_size(meta, big + INDEX_CHUNK) != 0 || box_allocated_size(meta, DATA_SIZE + INDEX_CHUNK) != 0)
+    {
+        printf("interior or out-of-range offset found\n");
+        errors++;
+    }
+    box_free(meta, big);
+
+    uint64_t *offsets = malloc(COUNT * sizeof(uint64_t));
+    double indexed = bench(meta, offsets);
+    free(meta);
+
+    meta = calloc(1, META_SIZE);
+    if (box_init(meta, META_SIZE, DATA_SIZE) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+    double plain = bench(meta, offsets);
+    if (indexed < 0 || plain < 0)
+    {
+        printf("allocated_size mismatch\n");
+        errors++;
+    }
+    printf("allocated_size+free 8 bytes: root walk %.1f ns/obj, index %.1f ns/obj\n", plain, indexed);
+
+    free(offsets);
+    free(meta);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+#define DATA_SIZE (4 * 1024 * 1024)
+// 对齐分配需要回溯，最坏情况的填充用较小的obj区
+#define WORST_DATA_SIZE (256 * 1024)
+
+int main()
+{
+    int errors = 0;
+
+    size_t worst8 = box_meta_bytes_worst_case(DATA_SIZE, 8, NULL);
+    size_t worst200 = box_meta_bytes_worst_case(DATA_SIZE, 200, NULL);
+    size_t worst_index = box_meta_bytes_worst_case(DATA_SIZE, 8, &(box_options_t){.index_chunk = 2048});
+    printf("worst case meta for %d bytes: 8-byte objs %zu, 200-byte objs %zu, with index %zu\n",
+           DATA_SIZE, worst8, worst200, worst_index);
+    if (worst8 == 0 || worst200 >= worst8 || worst_index <= worst8 || box_meta_bytes_worst_case(DATA_SIZE + 8, 8, NULL) != 0)
+    {
+        printf("unexpected worst case\n");
+        errors++;
+    }
+
+    // 最坏情况：每个最底层节点都被一个按128字节对齐的obj占住，之后剩余空间仍能全部分配出去
+    size_t worst_small = box_meta_bytes_worst_case(WORST_DATA_SIZE, 8, NULL);
+    uint8_t *meta = calloc(1, worst_small);
+    if (box_init(meta, worst_small, WORST_DATA_SIZE) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < WORST_DATA_SIZE / 128; i++)
+    {
+        if (box_alloc_aligned(meta, 8, 128) == (uint64_t)-1)
+        {
+            printf("aligned alloc %lu failed\n", i);
+            errors++;
+            break;
+        }
+        total += 8;
+    }
+    while (box_alloc(meta, 8) != (uint64_t)-1)
+        total += 8;
+    if (total != WORST_DATA_SIZE)
+    {
+        printf("worst case meta filled %lu/%d bytes\n", total, WORST_DATA_SIZE);
+        errors++;
+    }
+    free(meta);
+
+    // 按直方图估算：从大到小分配直方图中的全部obj
+    box_size_count_t histogram[] = {{40000, 20}, {3000, 300}, {200, 3000}, {24, 10000}, {8, 20000}};
+    size_t n = sizeof(histogram) / sizeof(histogram[0]);
+    size_t required = box_meta_bytes_required(DATA_SIZE, histogram, n, NULL);
+    printf("required meta for histogram: %zu\n", required);
+    if (required == 0 || required > worst8)
+    {
+        printf("unexpected required size\n");
+        errors++;
+    }
+    meta = calloc(1, required);
+    if (box_init(meta, required, DATA_SIZE) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        for (uint64_t j = 0; j < histogram[i].count; j++)
+        {
+            if (box_alloc(meta, histogram[i].size) == (uint64_t)-1)
+            {
+                printf("box_alloc(%zu) #%lu failed with estimated meta\n", histogram[i].size, j);
+                errors++;
+                break;
+            }
+        }
+    }
+    free(meta);
+
+    // obj放不下时返回0
+    box_size_count_t too_many[] = {{8, DATA_SIZE / 8 + 1}};
+    if (box_meta_bytes_required(DATA_SIZE, too_many, 1, NULL) != 0)
+    {
+        printf("oversubscribed histogram accepted\n");
+        errors++;
+    }
+
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+// meta区一开始只用前 META_SIZE 字节，后面的部分模拟mremap扩展出来的空间
+#define META_SIZE (64 * 1024)
+#define META_MAX (16 * 1024 * 1024)
+#define DATA_SIZE (1024 * 1024)
+#define THREADS 4
+#define COUNT 20000
+
+static int check_whole(uint8_t *meta, uint64_t size, const char *what)
+{
+    uint64_t whole = box_alloc(meta, size);
+    if (whole != 0)
+    {
+        printf("%s: box not empty after freeing everything\n", what);
+        return 1;
+    }
+    box_free(meta, whole);
+    return 0;
+}
+
+typedef struct
+{
+    uint8_t *meta;
+    atomic_bool *stop;
+    int errors;
+    size_t rounds;
+} worker_t;
+
+static void *worker(void *arg)
+{
+    worker_t *w = arg;
+    uint64_t offsets[512];
+    while (!atomic_load(w->stop))
+    {
+        size_t n = 0;
+        for (; n < 512; n++)
+        {
+            offsets[n] = box_alloc(w->meta, 8 + (n % 7) * 100);
+            if (offsets[n] == (uint64_t)-1)
+                break;
+        }
+        for (size_t i = 0; i < n; i++)
+        {
+            if (box_allocated_size(w->meta, offsets[i]) < 8 + (i % 7) * 100)
+            {
+                printf("object+%lu lost its size\n", offsets[i]);
+                w->errors++;
+            }
+            box_free(w->meta, offsets[i]);
+        }
+        w->rounds++;
+    }
+    return NULL;
+}
+
+int main()
+{
+    int errors = 0;
+    uint64_t *offsets = malloc(COUNT * 8 * sizeof(uint64_t));
+
+    // 扩展meta区：小meta区很快耗尽，扩展后可以继续分配
+    uint8_t *meta = calloc(1, META_MAX);
+    if (box_init(meta, META_SIZE, DATA_SIZE) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+    size_t n = 0;
+    while (n < COUNT && (offsets[n] = box_alloc(meta, 8)) != (uint64_t)-1)
+        n++;
+    size_t before = n;
+    size_t meta_size = META_SIZE;
+    while (n < COUNT)
+    {
+        meta_size *= 2;
+        if (box_extend_meta(meta, meta_size) != 0)
+        {
+            printf("box_extend_meta(%zu) failed\n", meta_size);
+            errors++;
+            break;
+        }
+        while (n < COUNT && (offsets[n] = box_alloc(meta, 8)) != (uint64_t)-1)
+            n++;
+    }
+    printf("meta %d bytes: %zu objects, extended to %zu bytes: %zu objects\n", META_SIZE, before, meta_size, n);
+    if (box_extend_meta(meta, meta_size) == 0)
+    {
+        printf("box_extend_meta accepted the same size\n");
+        errors++;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        if (box_allocated_size(meta, offsets[i]) != 8)
+        {
+            printf("object+%lu not found after box_extend_meta\n", offsets[i]);
+            errors++;
+            break;
+        }
+        box_free(meta, offsets[i]);
+    }
+    errors += check_whole(meta, DATA_SIZE, "extend_meta");
+    free(meta);
+
+    // 扩展obj区：同一层增加根节点的槽位，以及在根节点之上新建多层
+    meta = calloc(1, META_MAX);
+    if (box_init(meta, META_MAX, DATA_SIZE) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+    n = 0;
+    while ((offsets[n] = box_alloc(meta, 65536)) != (uint64_t)-1)
+        n++;
+    uint64_t sizes[] = {DATA_SIZE / 2 * 3, 16UL * 1024 * 1024, 1UL << 40};
+    for (int s = 0; s < 3; s++)
+    {
+        if (box_extend_obj(meta, sizes[s]) != 0)
+        {
+            printf("box_extend_obj(%lu) failed\n", sizes[s]);
+            errors++;
+            continue;
+        }
+        size_t grown = n;
+        while (n < COUNT * 8 && (offsets[n] = box_alloc(meta, 65536 << (4 * s))) != (uint64_t)-1)
+            n++;
+        if (n == grown)
+        {
+            printf("nothing allocated after box_extend_obj(%lu)\n", sizes[s]);
+            errors++;
+        }
+    }
+    if (box_extend_obj(meta, DATA_SIZE) == 0 || box_extend_obj(meta, 3000) == 0)
+    {
+        printf("box_extend_obj accepted a smaller or invalid size\n");
+        errors++;
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        if (box_allocated_size(meta, offsets[i]) == 0)
+        {
+            printf("object+%lu not found after box_extend_obj\n", offsets[i]);
+            errors++;
+            break;
+        }
+    }
+    for (size_t i = 0; i < n; i++)
+        box_free(meta, offsets[i]);
+    errors += check_whole(meta, 1UL << 40, "extend_obj");
+    free(meta);
+
+    // 并发：其它线程分配/释放的同时扩展meta区和obj区，带索引
+    meta = calloc(1, META_MAX);
+    box_options_t options = {.index_chunk = 32768};
+    if (box_init_ex(meta, META_SIZE, DATA_SIZE, &options) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+    atomic_bool stop = false;
+    pthread_t threads[THREADS];
+    worker_t workers[THREADS];
+    for (int i = 0; i < THREADS; i++)
+    {
+        workers[i] = (worker_t){.meta = meta, .stop = &stop};
+        pthread_create(&threads[i], NULL, worker, &workers[i]);
+    }
+    uint64_t box_size = DATA_SIZE;
+    meta_size = META_SIZE;
+    for (int i = 0; i < 6; i++)
+    {
+        meta_size *= 2;
+        box_size *= 4;
+        if (box_extend_meta(meta, meta_size) != 0 || box_extend_obj(meta, box_size) != 0)
+        {
+            printf("concurrent extend %d failed\n", i);
+            errors++;
+        }
+        for (volatile int spin = 0; spin < 1000000; spin++)
+            ;
+    }
+    atomic_store(&stop, true);
+    for (int i = 0; i < THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        errors += workers[i].errors;
+    }
+    errors += check_whole(meta, box_size, "concurrent extend");
+    free(meta);
+
+    free(offsets);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,256 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <boxmalloc/boxmalloc.h>
+#include "box_test.h"
+
+#define META_SIZE (8 * 1024 * 1024)
+#define DATA_SIZE (256 * 1024)
+#define THREADS 4
+#define SLOTS 64
+#define ROUNDS 40
+#define EMPTY UINT64_MAX
+// 被kill时每个线程至多有一个已分配、还没记入live的obj，最大的size对齐后为4K
+#define IN_FLIGHT (THREADS * 4096)
+
+static size_t sizes[] = {8, 24, 200, 3000};
+#define SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+// 子进程记录已分配的obj，放在共享内存中，被kill后父进程据此检查
+typedef struct
+{
+    _Atomic uint64_t live[THREADS][SLOTS];
+    _Atomic uint64_t pending[THREADS]; // 正在释放的obj
+} shared_log_t;
+
+typedef struct
+{
+    uint8_t *meta;
+    shared_log_t *log;
+    int id;
+} worker_t;
+
+static void *worker(void *arg)
+{
+    worker_t *w = arg;
+    uint64_t seed = getpid() * 31 + w->id;
+    while (true)
+    {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        int i = (seed >> 33) % SLOTS;
+        uint64_t offset = atomic_load(&w->log->live[w->id][i]);
+        if (offset == EMPTY)
+        {
+            offset = box_alloc(w->meta, sizes[i % SIZES]);
+            if (offset != (uint64_t)-1)
+                atomic_store(&w->log->live[w->id][i], offset);
+        }
+        else
+        {
+            atomic_store(&w->log->pending[w->id], offset);
+            atomic_store(&w->log->live[w->id][i], EMPTY);
+            box_free(w->meta, offset);
+            atomic_store(&w->log->pending[w->id], EMPTY);
+        }
+    }
+    return NULL;
+}
+
+static void churn(uint8_t *meta, shared_log_t *log)
+{
+    pthread_t threads[THREADS];
+    worker_t workers[THREADS];
+    for (int i = 0; i < THREADS; i++)
+    {
+        workers[i] = (worker_t){.meta = meta, .log = log, .id = i};
+        pthread_create(&threads[i], NULL, worker, &workers[i]);
+    }
+    pthread_join(threads[0], NULL);
+}
+
+static bool logged(shared_log_t *log, uint64_t offset)
+{
+    for (int t = 0; t < THREADS; t++)
+        for (int i = 0; i < SLOTS; i++)
+            if (atomic_load(&log->live[t][i]) == offset)
+                return true;
+    return false;
+}
+
+// 被kill后重新打开：记录的obj都还在，释放后剩余空间可以全部分配出去
+static int check_recovered(uint8_t *meta, shared_log_t *log, uint64_t *fill, int round)
+{
+    int errors = 0;
+    if (box_attach(meta) != 0)
+    {
+        printf("round %d: box_attach failed\n", round);
+        return 1;
+    }
+    for (int t = 0; t < THREADS; t++)
+    {
+        for (int i = 0; i < SLOTS; i++)
+        {
+            uint64_t offset = atomic_load(&log->live[t][i]);
+            if (offset != EMPTY && box_allocated_size(meta, offset) < sizes[i % SIZES])
+            {
+                printf("round %d: object+%lu lost after recovery\n", round, offset);
+                errors++;
+            }
+        }
+        // 释放到一半被kill：box_free 要么完成、要么没有发生
+        uint64_t pending = atomic_load(&log->pending[t]);
+        if (pending != EMPTY && !logged(log, pending) && box_allocated_size(meta, pending) != 0)
+            box_free(meta, pending);
+    }
+    for (int t = 0; t < THREADS; t++)
+    {
+        for (int i = 0; i < SLOTS; i++)
+        {
+            uint64_t offset = atomic_load(&log->live[t][i]);
+            if (offset != EMPTY)
+                box_free(meta, offset);
+        }
+    }
+
+    uint64_t n = box_test_fill(meta, 8, fill, DATA_SIZE / 8);
+    if (n * 8 + IN_FLIGHT < DATA_SIZE)
+    {
+        printf("round %d: only %lu/%d bytes allocatable after recovery\n", round, n * 8, DATA_SIZE);
+        errors++;
+    }
+    for (uint64_t i = 0; i < n; i++)
+        box_free(meta, fill[i]);
+    return errors;
+}
+
+static int crash_loop(uint8_t *meta, shared_log_t *log, const box_options_t *options)
+{
+    int errors = 0;
+    uint64_t *fill = malloc(DATA_SIZE / 8 * sizeof(uint64_t));
+    for (int round = 0; round < ROUNDS; round++)
+    {
+        memset(meta, 0, META_SIZE);
+        memset(log, 0xff, sizeof(*log));
+        if (box_init_ex(meta, META_SIZE, DATA_SIZE, options) != 0)
+        {
+            printf("Failed to initialize boxmalloc\n");
+            return 1;
+        }
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            churn(meta, log);
+            _exit(0);
+        }
+        struct timespec delay = {.tv_nsec = (1 + round % 20) * 1000000L};
+        nanosleep(&delay, NULL);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        errors += check_recovered(meta, log, fill, round);
+    }
+    free(fill);
+    return errors;
+}
+
+int main()
+{
+    int errors = 0;
+    uint8_t *meta = mmap(NULL, META_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    shared_log_t *log = mmap(NULL, sizeof(shared_log_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (meta == MAP_FAILED || log == MAP_FAILED)
+    {
+        printf("mmap failed\n");
+        return 1;
+    }
+
+    if (box_init_ex(meta, META_SIZE, DATA_SIZE, &(box_options_t){.journal_slots = 65}) == 0)
+    {
+        printf("journal_slots 65 accepted\n");
+        errors++;
+    }
+
+    // 正常关闭后重新打开：obj不变，可以继续分配
+    box_options_t options = {.journal_slots = 8};
+    if (box_init_ex(meta, META_SIZE, DATA_SIZE, &options) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+    uint64_t a = box_alloc(meta, 3000);
+    uint64_t b = box_alloc(meta, 8);
+    if (box_detach(meta) != 0 || box_attach(meta) != 0)
+    {
+        printf("detach/attach failed\n");
+        errors++;
+    }
+    if (box_allocated_size(meta, a) != 4096 || box_allocated_size(meta, b) != 8 || box_alloc(meta, 8) == (uint64_t)-1)
+    {
+        printf("objects changed across detach/attach\n");
+        errors++;
+    }
+
+    // 已初始化的meta区不能再 box_init；magic或校验和不符时 box_attach 失败
+    if (box_init_ex(meta, META_SIZE, DATA_SIZE, &options) == 0)
+    {
+        printf("box_init accepted an initialized meta\n");
+        errors++;
+    }
+    meta[0] ^= 1;
+    if (box_attach(meta) == 0)
+    {
+        printf("box_attach accepted a corrupted magic\n");
+        errors++;
+    }
+    meta[0] ^= 1;
+    if (box_attach(meta) != 0)
+    {
+        printf("box_attach rejected a valid meta\n");
+        errors++;
+    }
+    // 布局版本紧跟在12字节的magic之后，其它版本（包括以前的版本）一律拒绝
+    uint32_t layout_version;
+    memcpy(&layout_version, meta + 12, 4);
+    memcpy(meta + 12, &(uint32_t){layout_version - 1}, 4);
+    if (box_attach(meta) == 0)
+    {
+        printf("box_attach accepted layout version %u\n", layout_version - 1);
+        errors++;
+    }
+    memcpy(meta + 12, &layout_version, 4);
+
+    // 最初版本的meta区：16字节的magic"boxmalloc"，其后是boxhead_bytessize、box_bytessize
+    uint8_t *old = calloc(1, 4096);
+    memcpy(old, "boxmalloc", 9);
+    memcpy(old + 16, &(uint64_t){4096}, 8);
+    memcpy(old + 24, &(uint64_t){DATA_SIZE}, 8);
+    if (box_attach(old) == 0)
+    {
+        printf("box_attach accepted a baseline-format meta\n");
+        errors++;
+    }
+    free(old);
+
+    // 多线程分配/释放时被kill，重新打开后检查
+    box_options_t crash_options[] = {
+        {.journal_slots = 8},
+        {.journal_slots = 2, .empty_keep = 4},
+        {.journal_slots = 8, .index_chunk = 32768},
+    };
+    for (size_t i = 0; i < sizeof(crash_options) / sizeof(crash_options[0]); i++)
+        errors += crash_loop(meta, log, &crash_options[i]);
+
+    munmap(log, sizeof(shared_log_t));
+    munmap(meta, META_SIZE);
+    return errors ? 1 : 0;
+}
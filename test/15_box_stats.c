@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+#define META_SIZE (16 * 1024 * 1024)
+#define DATA_SIZE (16 * 1024 * 1024)
+#define THREADS 4
+#define COUNT 1000
+
+static int check_empty(uint8_t *meta, const char *what)
+{
+    box_stats_t stats;
+    if (box_stats(meta, &stats) != 0)
+    {
+        printf("%s: box_stats failed\n", what);
+        return 1;
+    }
+    uint64_t objects = 0;
+    for (int i = 0; i < BOX_STATS_LEVELS; i++)
+        objects += stats.objects[i];
+    uint64_t nodes_by_run = 0;
+    for (int i = 0; i <= 16; i++)
+        nodes_by_run += stats.free_runs[i];
+    // 全部释放后只剩根节点，根节点的槽位全部空闲
+    if (stats.allocated_bytes != 0 || objects != 0 || stats.nodes != 1 || nodes_by_run != 1 ||
+        stats.largest_free != DATA_SIZE)
+    {
+        printf("%s: allocated %lu, objects %lu, nodes %lu, largest %lu after freeing everything\n",
+               what, stats.allocated_bytes, objects, stats.nodes, stats.largest_free);
+        return 1;
+    }
+    return 0;
+}
+
+static void *worker(void *arg)
+{
+    uint8_t *meta = arg;
+    uint64_t offsets[COUNT];
+    for (int r = 0; r < 20; r++)
+    {
+        for (int i = 0; i < COUNT; i++)
+            offsets[i] = box_alloc(meta, 8 + (i % 13) * 300);
+        for (int i = 0; i < COUNT; i += 2)
+        {
+            uint64_t moved = box_realloc(meta, offsets[i], 4000);
+            if (moved != offsets[i] && moved != (uint64_t)-1)
+            {
+                box_free(meta, offsets[i]);
+                offsets[i] = moved;
+            }
+        }
+        box_free_n(meta, offsets, COUNT);
+    }
+    return NULL;
+}
+
+int main()
+{
+    int errors = 0;
+    uint8_t *meta = calloc(1, META_SIZE);
+    if (box_init(meta, META_SIZE, DATA_SIZE) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+    errors += check_empty(meta, "init");
+
+    // 100字节对齐到13*8字节（level 0），3000字节对齐到2*16^2*8字节（level 2）
+    uint64_t a = box_alloc(meta, 100);
+    uint64_t b = box_alloc(meta, 3000);
+    uint64_t c[3];
+    box_alloc_n(meta, 8, 3, c);
+    box_stats_t stats;
+    box_stats(meta, &stats);
+    uint64_t allocated = box_allocated_size(meta, a) + box_allocated_size(meta, b) + 3 * 8;
+    printf("allocated %lu, requested %lu, rounded %lu, nodes %lu/%lu, largest free %lu\n",
+           stats.allocated_bytes, stats.requested_total, stats.rounded_total, stats.nodes, stats.nodes_capacity, stats.largest_free);
+    if (stats.allocated_bytes != allocated || stats.requested_total != 100 + 3000 + 24 || stats.rounded_total != allocated ||
+        stats.objects[0] != 4 || stats.objects[1] != 0 || stats.objects[2] != 1)
+    {
+        printf("unexpected object counters\n");
+        errors++;
+    }
+    if (stats.nodes < 2 || stats.nodes_capacity < stats.nodes || stats.largest_free >= DATA_SIZE || stats.largest_free == 0)
+    {
+        printf("unexpected node counters\n");
+        errors++;
+    }
+    uint64_t nodes_by_run = 0;
+    for (int i = 0; i <= 16; i++)
+        nodes_by_run += stats.free_runs[i];
+    if (nodes_by_run != stats.nodes)
+    {
+        printf("free_runs covers %lu of %lu nodes\n", nodes_by_run, stats.nodes);
+        errors++;
+    }
+
+    // 原地扩大后按新的大小统计
+    if (box_realloc(meta, b, 6000) == b)
+    {
+        box_stats(meta, &stats);
+        if (stats.allocated_bytes != allocated - 4096 + box_allocated_size(meta, b))
+        {
+            printf("realloc not reflected in allocated_bytes\n");
+            errors++;
+        }
+    }
+    box_free(meta, a);
+    box_free(meta, b);
+    box_free_n(meta, c, 3);
+    errors += check_empty(meta, "single thread");
+
+    // 并发分配/释放后计数器回到初始状态
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; i++)
+        pthread_create(&threads[i], NULL, worker, meta);
+    for (int i = 0; i < THREADS; i++)
+        pthread_join(threads[i], NULL);
+    errors += check_empty(meta, "threads");
+    box_stats(meta, &stats);
+    if (stats.rounded_total < stats.requested_total)
+    {
+        printf("rounded_total < requested_total\n");
+        errors++;
+    }
+    printf("internal waste %.1f%%\n", 100.0 * (stats.rounded_total - stats.requested_total) / stats.rounded_total);
+
+    free(meta);
+    return errors ? 1 : 0;
+}
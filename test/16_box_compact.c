@@ -0,0 +1,111 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <boxmalloc/boxmalloc.h>
+#include "box_test.h"
+
+#define META_SIZE (16 * 1024 * 1024)
+#define DATA_SIZE (1024 * 1024)
+#define KEEP_EVERY (32 * 1024)
+#define TARGET (64 * 1024)
+#define MAX_MOVES 64
+
+int main()
+{
+    int errors = 0;
+    uint8_t *meta = calloc(1, META_SIZE);
+    // 模拟obj区，搬移时复制其中的数据
+    uint8_t *data = calloc(1, DATA_SIZE);
+    uint64_t *offsets = malloc(DATA_SIZE / 8 * sizeof(uint64_t));
+    if (box_init(meta, META_SIZE, DATA_SIZE) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+    box_move_t moves[MAX_MOVES];
+    if (box_compact_plan(meta, TARGET, moves, MAX_MOVES) != 0 ||
+        box_compact_plan(meta, DATA_SIZE * 2, moves, MAX_MOVES) != BOX_COMPACT_FAILED)
+    {
+        printf("unexpected plan on an empty box\n");
+        errors++;
+    }
+
+    // 填满8字节的obj，每32K只保留一个：空闲的字节很多，但没有64K的连续空间
+    size_t n = box_test_fill(meta, 8, offsets, DATA_SIZE / 8);
+    size_t kept = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (offsets[i] % KEEP_EVERY == KEEP_EVERY / 2)
+        {
+            offsets[kept++] = offsets[i];
+            memcpy(data + offsets[i], &offsets[i], 8);
+        }
+        else
+        {
+            box_free(meta, offsets[i]);
+        }
+    }
+    uint64_t big = box_alloc(meta, TARGET);
+    if (big != (uint64_t)-1)
+    {
+        printf("%d bytes allocated before compaction\n", TARGET);
+        errors++;
+        box_free(meta, big);
+    }
+
+    if (box_compact_plan(meta, TARGET, moves, 1) != BOX_COMPACT_FAILED)
+    {
+        printf("plan accepted with too few moves\n");
+        errors++;
+    }
+    size_t count = box_compact_plan(meta, TARGET, moves, MAX_MOVES);
+    printf("%zu objects kept, plan moves %zu\n", kept, count);
+    if (count == BOX_COMPACT_FAILED || count == 0)
+    {
+        printf("no compaction plan\n");
+        return 1;
+    }
+    for (size_t i = 0; i < count; i++)
+    {
+        memcpy(data + moves[i].new_offset, data + moves[i].old_offset, moves[i].size);
+        if (box_commit_move(meta, &moves[i]) != 0)
+        {
+            printf("commit object+%lu -> object+%lu failed\n", moves[i].old_offset, moves[i].new_offset);
+            errors++;
+        }
+        for (size_t k = 0; k < kept; k++)
+            if (offsets[k] == moves[i].old_offset)
+                offsets[k] = moves[i].new_offset;
+    }
+    if (box_commit_move(meta, &moves[0]) == 0)
+    {
+        printf("move committed twice\n");
+        errors++;
+    }
+
+    big = box_alloc(meta, TARGET);
+    if (big == (uint64_t)-1)
+    {
+        printf("%d bytes still not allocatable after compaction\n", TARGET);
+        errors++;
+    }
+    // 搬移后的obj数据完整，且不与新分配的大obj重叠
+    for (size_t k = 0; k < kept; k++)
+    {
+        uint64_t value;
+        memcpy(&value, data + offsets[k], 8);
+        if (box_allocated_size(meta, offsets[k]) != 8 || (value % KEEP_EVERY) != KEEP_EVERY / 2 ||
+            (big != (uint64_t)-1 && offsets[k] >= big && offsets[k] < big + TARGET))
+        {
+            printf("object+%lu damaged by compaction\n", offsets[k]);
+            errors++;
+        }
+    }
+
+    free(offsets);
+    free(data);
+    free(meta);
+    return errors ? 1 : 0;
+}
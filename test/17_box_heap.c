@@ -0,0 +1,134 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+#define META_SIZE (16 * 1024 * 1024)
+#define DATA_SIZE (16 * 1024 * 1024)
+#define COUNT 1000
+
+int main()
+{
+    int errors = 0;
+    uint8_t *meta = calloc(1, META_SIZE);
+    uint8_t *data = aligned_alloc(4096, DATA_SIZE);
+    box_heap_t *heap = box_heap_create(meta, META_SIZE, data, DATA_SIZE, NULL);
+    if (!heap)
+    {
+        printf("Failed to create heap\n");
+        return 1;
+    }
+
+    // 大于8字节的分配按16字节对齐，可用大小不小于请求
+    void *ptrs[COUNT];
+    for (int i = 0; i < COUNT; i++)
+    {
+        size_t size = 1 + (size_t)i * 7 % 300;
+        ptrs[i] = box_heap_malloc(heap, size);
+        if (!ptrs[i] || !box_heap_contains(heap, ptrs[i]))
+        {
+            printf("malloc %zu failed\n", size);
+            return 1;
+        }
+        if (size > 8 && (uintptr_t)ptrs[i] % 16 != 0)
+        {
+            printf("malloc %zu returned %p, not 16-byte aligned\n", size, ptrs[i]);
+            errors++;
+        }
+        if (box_heap_usable_size(heap, ptrs[i]) < size)
+        {
+            printf("usable size of %zu-byte object is %zu\n", size, box_heap_usable_size(heap, ptrs[i]));
+            errors++;
+        }
+        memset(ptrs[i], i & 0xff, size);
+    }
+
+    // realloc 扩大、缩小都保留原有数据
+    for (int i = 0; i < COUNT; i++)
+    {
+        size_t size = 1 + (size_t)i * 7 % 300;
+        size_t grown = size * 3 + 5;
+        ptrs[i] = box_heap_realloc(heap, ptrs[i], grown);
+        if (!ptrs[i] || (uintptr_t)ptrs[i] % 16 != 0)
+        {
+            printf("realloc %zu -> %zu returned %p\n", size, grown, ptrs[i]);
+            return 1;
+        }
+        for (size_t j = 0; j < size; j++)
+        {
+            if (((uint8_t *)ptrs[i])[j] != (i & 0xff))
+            {
+                printf("realloc %zu -> %zu lost data\n", size, grown);
+                errors++;
+                break;
+            }
+        }
+        ptrs[i] = box_heap_realloc(heap, ptrs[i], 9);
+        if (!ptrs[i] || ((uint8_t *)ptrs[i])[0] != (i & 0xff))
+        {
+            printf("shrinking realloc lost data\n");
+            errors++;
+        }
+    }
+    for (int i = 0; i < COUNT; i++)
+        box_heap_free(heap, ptrs[i]);
+
+    void *page = box_heap_aligned_alloc(heap, 4096, 100);
+    if (!page || (uintptr_t)page % 4096 != 0)
+    {
+        printf("aligned_alloc 4096 returned %p\n", page);
+        errors++;
+    }
+    box_heap_free(heap, page);
+    if (box_heap_aligned_alloc(heap, 24, 100) != NULL)
+    {
+        printf("aligned_alloc accepted a non power of two alignment\n");
+        errors++;
+    }
+
+    // 大于4096的对齐：obj区按64K对齐时可以满足，只按4096对齐时须拒绝，不能返回未对齐的指针
+    uint8_t *aligned_meta = calloc(1, META_SIZE);
+    uint8_t *aligned_data = aligned_alloc(64 * 1024, DATA_SIZE + 64 * 1024);
+    for (size_t shift = 0; shift <= 4096; shift += 4096)
+    {
+        memset(aligned_meta, 0, META_SIZE);
+        box_heap_t *h = box_heap_create(aligned_meta, META_SIZE, aligned_data + shift, DATA_SIZE, NULL);
+        box_heap_malloc(h, 24);
+        void *big = box_heap_aligned_alloc(h, 64 * 1024, 100);
+        if (shift == 0 ? !big || (uintptr_t)big % (64 * 1024) != 0 : big != NULL)
+        {
+            printf("aligned_alloc 64K with base %p returned %p\n", (void *)(aligned_data + shift), big);
+            errors++;
+        }
+    }
+    free(aligned_data);
+    free(aligned_meta);
+
+    // NULL 与区外指针
+    box_heap_free(heap, NULL);
+    void *p = box_heap_realloc(heap, NULL, 40);
+    if (!p)
+    {
+        printf("realloc of NULL failed\n");
+        errors++;
+    }
+    box_heap_free(heap, p);
+    if (box_heap_contains(heap, &errors) || box_heap_usable_size(heap, &errors) != 0)
+    {
+        printf("pointer outside the heap accepted\n");
+        errors++;
+    }
+
+    box_stats_t stats;
+    if (box_stats(box_heap_meta(heap), &stats) != 0 || stats.allocated_bytes != 0)
+    {
+        printf("%lu bytes still allocated\n", stats.allocated_bytes);
+        errors++;
+    }
+
+    free(data);
+    free(meta);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,100 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <malloc.h>
+#include <dlfcn.h>
+#include <pthread.h>
+
+// 在 LD_PRELOAD=libboxmalloc_preload.so 下运行，malloc 等函数来自boxmalloc
+#define THREADS 4
+#define COUNT 10000
+
+static void *worker(void *arg)
+{
+    (void)arg;
+    void *ptrs[64] = {0};
+    for (int i = 0; i < COUNT; i++)
+    {
+        int j = i % 64;
+        free(ptrs[j]);
+        size_t size = 1 + (size_t)i * 13 % 2000;
+        ptrs[j] = malloc(size);
+        if (!ptrs[j] || (size > 8 && (uintptr_t)ptrs[j] % 16 != 0))
+            return (void *)1;
+        memset(ptrs[j], 0x5a, size);
+    }
+    for (int j = 0; j < 64; j++)
+        free(ptrs[j]);
+    return NULL;
+}
+
+int main()
+{
+    int errors = 0;
+    if (!dlsym(RTLD_DEFAULT, "box_heap_malloc"))
+    {
+        printf("libboxmalloc_preload.so is not preloaded\n");
+        return 1;
+    }
+
+    int *zero = calloc(1000, sizeof(int));
+    for (int i = 0; zero && i < 1000; i++)
+    {
+        if (zero[i] != 0)
+        {
+            printf("calloc returned dirty memory\n");
+            errors++;
+            break;
+        }
+    }
+    free(zero);
+    volatile size_t huge = SIZE_MAX / 2;
+    if (calloc(huge, 4) != NULL)
+    {
+        printf("calloc overflow not detected\n");
+        errors++;
+    }
+
+    char *s = strdup("boxmalloc");
+    s = realloc(s, 4000);
+    if (!s || strcmp(s, "boxmalloc") != 0 || malloc_usable_size(s) < 4000)
+    {
+        printf("realloc lost data\n");
+        errors++;
+    }
+    free(s);
+
+    void *aligned = NULL;
+    if (posix_memalign(&aligned, 4096, 100) != 0 || (uintptr_t)aligned % 4096 != 0)
+    {
+        printf("posix_memalign failed\n");
+        errors++;
+    }
+    free(aligned);
+    // 大于页大小、也大于内核对大块映射自动的2M对齐
+    if (posix_memalign(&aligned, 64 * 1024 * 1024, 100) != 0 || (uintptr_t)aligned % (64 * 1024 * 1024) != 0)
+    {
+        printf("posix_memalign 64M returned %p\n", aligned);
+        errors++;
+    }
+    free(aligned);
+
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; i++)
+        pthread_create(&threads[i], NULL, worker, NULL);
+    for (int i = 0; i < THREADS; i++)
+    {
+        void *ret;
+        pthread_join(threads[i], &ret);
+        if (ret)
+        {
+            printf("thread %d: malloc failed\n", i);
+            errors++;
+        }
+    }
+
+    printf("preload %s\n", errors ? "failed" : "ok");
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+#define META_SIZE (16 * 1024 * 1024)
+#define DATA_SIZE (16 * 1024 * 1024)
+#define ARENAS 4
+#define THREADS 8
+#define OPS 20000
+#define LIVE 256
+
+static uint8_t *data;
+static box_arena_t *arena;
+
+typedef struct
+{
+    uint32_t seed;
+    long errors;
+} worker_t;
+
+static void *worker(void *arg)
+{
+    worker_t *w = arg;
+    uint64_t offsets[LIVE];
+    size_t sizes[LIVE];
+    uint8_t tags[LIVE];
+    memset(offsets, 0xff, sizeof(offsets));
+    for (int op = 0; op < OPS; op++)
+    {
+        w->seed = w->seed * 1103515245 + 12345;
+        int i = (w->seed >> 8) % LIVE;
+        if (offsets[i] != (uint64_t)-1)
+        {
+            // 内容被改写说明同一区域被其它线程重复分配
+            for (size_t j = 0; j < sizes[i]; j++)
+            {
+                if (data[offsets[i] + j] != tags[i])
+                {
+                    w->errors++;
+                    break;
+                }
+            }
+            box_arena_free(arena, offsets[i]);
+            offsets[i] = (uint64_t)-1;
+            continue;
+        }
+        sizes[i] = 1 + (w->seed >> 12) % 3000;
+        offsets[i] = box_arena_alloc(arena, sizes[i]);
+        if (offsets[i] == (uint64_t)-1)
+            continue;
+        if (box_arena_allocated_size(arena, offsets[i]) < sizes[i])
+            w->errors++;
+        tags[i] = (uint8_t)op;
+        memset(data + offsets[i], tags[i], sizes[i]);
+    }
+    for (int i = 0; i < LIVE; i++)
+        if (offsets[i] != (uint64_t)-1)
+            box_arena_free(arena, offsets[i]);
+    return NULL;
+}
+
+static uint64_t allocated_bytes(void)
+{
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < box_arena_count(arena); i++)
+    {
+        box_stats_t stats;
+        if (box_stats(box_arena_meta(arena, i), &stats) == 0)
+            total += stats.allocated_bytes;
+    }
+    return total;
+}
+
+int main()
+{
+    int errors = 0;
+    uint8_t *meta = calloc(1, META_SIZE);
+    data = malloc(DATA_SIZE);
+    arena = box_arena_create(meta, META_SIZE, DATA_SIZE, ARENAS, NULL);
+    if (!arena || box_arena_count(arena) != ARENAS)
+    {
+        printf("Failed to create arenas\n");
+        return 1;
+    }
+
+    // 每个arena恰好放得下一个4M的obj：自己的arena用完后依次使用其它arena
+    uint64_t big[ARENAS];
+    uint64_t seen = 0;
+    for (int i = 0; i < ARENAS; i++)
+    {
+        big[i] = box_arena_alloc(arena, DATA_SIZE / ARENAS);
+        if (big[i] == (uint64_t)-1 || big[i] % (DATA_SIZE / ARENAS) != 0)
+        {
+            printf("alloc %d of an arena-sized object returned %lu\n", i, big[i]);
+            return 1;
+        }
+        seen |= 1 << (big[i] / (DATA_SIZE / ARENAS));
+    }
+    if (seen != (1 << ARENAS) - 1 || box_arena_alloc(arena, 8) != (uint64_t)-1)
+    {
+        printf("arena fallback did not use every arena exactly once\n");
+        errors++;
+    }
+    for (int i = 0; i < ARENAS; i++)
+        box_arena_free(arena, big[i]);
+
+    // 超出范围的offset
+    box_arena_free(arena, DATA_SIZE);
+    if (box_arena_allocated_size(arena, DATA_SIZE) != 0)
+    {
+        printf("offset outside the arenas accepted\n");
+        errors++;
+    }
+
+    pthread_t threads[THREADS];
+    worker_t workers[THREADS];
+    for (int i = 0; i < THREADS; i++)
+    {
+        workers[i] = (worker_t){.seed = 17 + i * 7919};
+        pthread_create(&threads[i], NULL, worker, &workers[i]);
+    }
+    for (int i = 0; i < THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        if (workers[i].errors)
+        {
+            printf("thread %d: %ld overlapping objects\n", i, workers[i].errors);
+            errors++;
+        }
+    }
+    if (allocated_bytes() != 0)
+    {
+        printf("%lu bytes still allocated\n", allocated_bytes());
+        errors++;
+    }
+
+    // obj区不能整除时，每段向下取整到 8*16^n*x：16M/6 取整为 2.5M
+    memset(meta, 0, META_SIZE);
+    arena = box_arena_create(meta, META_SIZE, DATA_SIZE, 6, NULL);
+    if (!arena)
+    {
+        printf("Failed to create 6 arenas\n");
+        return 1;
+    }
+    for (int i = 0; i < 6; i++)
+    {
+        if (box_arena_alloc(arena, 5 * 512 * 1024) == (uint64_t)-1)
+        {
+            printf("6 arenas: alloc %d failed\n", i);
+            errors++;
+        }
+    }
+    if (box_arena_alloc(arena, 8) != (uint64_t)-1)
+    {
+        printf("6 arenas: space beyond the slices allocated\n");
+        errors++;
+    }
+
+    free(data);
+    free(meta);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,227 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+#define META_SIZE (16 * 1024 * 1024)
+#define DATA_SIZE (16 * 1024 * 1024)
+#define BIG (64 * 1024)
+#define COUNT 64
+#define THREADS 4
+#define OPS 20000
+
+typedef struct
+{
+    int n;
+    uint64_t offset[64];
+    uint64_t bytes[64];
+} ranges_t;
+
+static uint64_t record(void *ctx, const uint64_t offset, const uint64_t bytes)
+{
+    ranges_t *r = ctx;
+    if (r->n < 64)
+    {
+        r->offset[r->n] = offset;
+        r->bytes[r->n] = bytes;
+    }
+    r->n++;
+    return bytes;
+}
+
+static bool covered(const ranges_t *r, uint64_t offset, uint64_t bytes)
+{
+    for (int i = 0; i < r->n && i < 64; i++)
+        if (r->offset[i] <= offset && offset + bytes <= r->offset[i] + r->bytes[i])
+            return true;
+    return false;
+}
+
+static size_t resident_pages(uint8_t *p, size_t bytes)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t pages = bytes / page, n = 0;
+    unsigned char *vec = malloc(pages);
+    mincore(p, bytes, vec);
+    for (size_t i = 0; i < pages; i++)
+        n += vec[i] & 1;
+    free(vec);
+    return n;
+}
+
+static uint8_t *meta;
+static uint8_t *data;
+static atomic_bool stop;
+
+static void *purger(void *arg)
+{
+    (void)arg;
+    while (!atomic_load(&stop))
+        box_purge(meta, 4096, box_purge_madvise, data);
+    return NULL;
+}
+
+// 交还与分配并发：已分配的obj内容不能被清零
+static void *worker(void *arg)
+{
+    long *errors = arg;
+    uint64_t offsets[32];
+    uint8_t tags[32];
+    memset(offsets, 0xff, sizeof(offsets));
+    uint32_t seed = (uint32_t)(uintptr_t)arg;
+    for (int op = 0; op < OPS; op++)
+    {
+        seed = seed * 1103515245 + 12345;
+        int i = (seed >> 8) % 32;
+        if (offsets[i] != (uint64_t)-1)
+        {
+            if (data[offsets[i]] != tags[i] || data[offsets[i] + 8191] != tags[i])
+                (*errors)++;
+            box_free(meta, offsets[i]);
+            offsets[i] = (uint64_t)-1;
+            continue;
+        }
+        offsets[i] = box_alloc(meta, 8192);
+        if (offsets[i] == (uint64_t)-1)
+            continue;
+        tags[i] = (uint8_t)(op | 1);
+        memset(data + offsets[i], tags[i], 8192);
+    }
+    for (int i = 0; i < 32; i++)
+        if (offsets[i] != (uint64_t)-1)
+            box_free(meta, offsets[i]);
+    return NULL;
+}
+
+int main()
+{
+    int errors = 0;
+    meta = calloc(1, META_SIZE);
+    data = mmap(NULL, DATA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (box_init(meta, META_SIZE, DATA_SIZE) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+
+    uint64_t big[COUNT];
+    for (int i = 0; i < COUNT; i++)
+    {
+        big[i] = box_alloc(meta, BIG);
+        memset(data + big[i], 0x5a, BIG);
+    }
+    ranges_t r = {0};
+    box_purge(meta, BIG, record, &r);
+    r = (ranges_t){0};
+    if (box_purge(meta, BIG, record, &r) != 0 || r.n != 0)
+    {
+        printf("second purge reported %d ranges\n", r.n);
+        errors++;
+    }
+
+    // 释放的obj在下一次 box_purge 时报告一次
+    box_free(meta, big[3]);
+    box_free(meta, big[4]);
+    r = (ranges_t){0};
+    size_t purged = box_purge(meta, BIG, record, &r);
+    if (!covered(&r, big[3], BIG) || !covered(&r, big[4], BIG) || purged < 2 * BIG)
+    {
+        printf("freed objects not purged: %d ranges, %zu bytes\n", r.n, purged);
+        errors++;
+    }
+    r = (ranges_t){0};
+    if (box_purge(meta, BIG, record, &r) != 0)
+    {
+        printf("purged range reported again\n");
+        errors++;
+    }
+
+    // 小于min_bytes的区域保留记录，以后仍可交还
+    // 另一个obj使所在节点不被回收
+    uint64_t small = box_alloc(meta, 8);
+    uint64_t keep = box_alloc(meta, 8);
+    box_purge(meta, 8, record, &(ranges_t){0});
+    box_free(meta, small);
+    r = (ranges_t){0};
+    box_purge(meta, 4096, record, &r);
+    if (covered(&r, small, 8))
+    {
+        printf("8-byte range reported with min_bytes 4096\n");
+        errors++;
+    }
+    r = (ranges_t){0};
+    box_purge(meta, 8, record, &r);
+    if (!covered(&r, small, 8))
+    {
+        printf("8-byte range lost\n");
+        errors++;
+    }
+
+    // 不含整页的区域 box_purge_madvise 交还不了：不计入返回值，保留记录
+    small = box_alloc(meta, 8);
+    box_free(meta, small);
+    if (box_purge(meta, 8, box_purge_madvise, data) != 0)
+    {
+        printf("sub-page range counted as purged\n");
+        errors++;
+    }
+    r = (ranges_t){0};
+    box_purge(meta, 8, record, &r);
+    if (!covered(&r, small, 8))
+    {
+        printf("sub-page range dropped by madvise\n");
+        errors++;
+    }
+    box_free(meta, keep);
+
+    // madvise 后释放的区域不再驻留，仍分配着的obj不受影响（big[3]、big[4]已释放）
+    for (int i = 6; i < COUNT; i += 2)
+        box_free(meta, big[i]);
+    box_purge(meta, 4096, box_purge_madvise, data);
+    for (int i = 5; i < COUNT; i++)
+    {
+        if (i % 2 == 0 && resident_pages(data + big[i], BIG) != 0)
+        {
+            printf("object %d still resident after purge\n", i);
+            errors++;
+        }
+        if (i % 2 == 1 && (data[big[i]] != 0x5a || data[big[i] + BIG - 1] != 0x5a))
+        {
+            printf("live object %d cleared by purge\n", i);
+            errors++;
+        }
+    }
+    for (int i = 0; i < 3; i++)
+        box_free(meta, big[i]);
+    for (int i = 5; i < COUNT; i += 2)
+        box_free(meta, big[i]);
+
+    pthread_t threads[THREADS], purge_thread;
+    long thread_errors[THREADS] = {0};
+    pthread_create(&purge_thread, NULL, purger, NULL);
+    for (int i = 0; i < THREADS; i++)
+        pthread_create(&threads[i], NULL, worker, &thread_errors[i]);
+    for (int i = 0; i < THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        if (thread_errors[i])
+        {
+            printf("thread %d: %ld objects cleared by a concurrent purge\n", i, thread_errors[i]);
+            errors++;
+        }
+    }
+    atomic_store(&stop, true);
+    pthread_join(purge_thread, NULL);
+
+    munmap(data, DATA_SIZE);
+    free(meta);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,354 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+/*
+boxmalloc 与 glibc malloc 在同一组操作序列（trace）上的对比：
+- fixed：64字节的obj反复分配/释放
+- powerlaw：size服从幂律分布，大量小obj、少量大obj
+- mixed：与 10_box_policy_bench 相同的混合size
+- mt：THREADS个线程在同一个meta区上各自重放一个mixed trace，obj总数与单线程时相同
+- fill：按幂律size一直分配到失败，看obj区能用到多少（只有boxmalloc）
+每种trace报告 ns/op 和单次操作延迟的 p50/p99/p999；boxmalloc另外报告已分配字节数最高时的
+meta区节点数（及按meta区大小折算的字节数）和obj区利用率（请求的字节数/对齐后占用的字节数）。
+参数 --quick 把操作数减为1/20，用于ctest。
+*/
+#define META_SIZE (64 * 1024 * 1024)
+#define DATA_SIZE (256 * 1024 * 1024)
+#define FILL_SIZE (32 * 1024 * 1024)
+#define NUM_LIVE 8192
+#define NUM_OPS 1000000
+#define THREADS 4
+#define SAMPLE 4096 // 每SAMPLE次操作读一次 box_stats
+#define EMPTY UINT64_MAX
+
+typedef struct
+{
+    uint32_t slot;
+    uint32_t size; // 0=释放slot中的obj
+} trace_op;
+
+typedef struct
+{
+    trace_op *ops;
+    size_t n;
+} trace_t;
+
+typedef struct
+{
+    double ns_per_op;
+    uint32_t p50, p99, p999;
+    long failed;
+    uint64_t peak_allocated;
+    uint64_t peak_nodes;
+    uint64_t peak_meta_bytes; // 按 meta区大小/nodes_capacity 折算
+    double peak_util;
+} bench_result;
+
+static uint32_t next_rand(uint32_t *seed)
+{
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *seed = x;
+}
+
+static size_t fixed_size(uint32_t *seed)
+{
+    (void)seed;
+    return 64;
+}
+
+// P(size>x) ∝ x^-1.2，[8, 1M]
+static size_t powerlaw_size(uint32_t *seed)
+{
+    double u = (next_rand(seed) + 1.0) / 4294967296.0;
+    double size = 8 * pow(u, -1 / 1.2);
+    return size > 1024 * 1024 ? 1024 * 1024 : (size_t)size;
+}
+
+static size_t mixed_size(uint32_t *seed)
+{
+    int r = next_rand(seed) % 100;
+    if (r < 80)
+        return 8 + next_rand(seed) % 512;
+    if (r < 97)
+        return 512 + next_rand(seed) % (64 * 1024);
+    return 64 * 1024 + next_rand(seed) % (1024 * 1024);
+}
+
+// 在slots个slot中随机选择：slot为空时分配，否则释放
+static trace_t make_trace(size_t (*random_size)(uint32_t *), size_t n, uint32_t slots, uint32_t seed)
+{
+    trace_t trace = {.ops = malloc(n * sizeof(trace_op)), .n = n};
+    uint8_t *live = calloc(NUM_LIVE, 1);
+    for (size_t i = 0; i < n; i++)
+    {
+        uint32_t slot = next_rand(&seed) % slots;
+        trace.ops[i] = (trace_op){.slot = slot, .size = live[slot] ? 0 : (uint32_t)random_size(&seed)};
+        live[slot] = !live[slot];
+    }
+    free(live);
+    return trace;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec t;
+    timespec_get(&t, TIME_UTC);
+    return (uint64_t)t.tv_sec * 1000000000 + t.tv_nsec;
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void percentiles(uint32_t *lat, size_t n, bench_result *r)
+{
+    qsort(lat, n, sizeof(uint32_t), compare_u32);
+    r->p50 = lat[n / 2];
+    r->p99 = lat[n * 99 / 100];
+    r->p999 = lat[n * 999 / 1000];
+}
+
+typedef struct
+{
+    uint8_t *meta; // NULL=glibc malloc
+    uint8_t *data;
+    const trace_t *trace;
+    uint32_t *lat;
+    long failed;
+    uint64_t requested; // 当前已分配obj的请求字节数
+    bench_result *peak;  // 单线程时记录峰值
+} replay_t;
+
+static void sample_peak(replay_t *r)
+{
+    box_stats_t stats;
+    if (box_stats(r->meta, &stats) != 0 || stats.allocated_bytes <= r->peak->peak_allocated)
+        return;
+    r->peak->peak_allocated = stats.allocated_bytes;
+    r->peak->peak_nodes = stats.nodes;
+    r->peak->peak_meta_bytes = stats.nodes * (META_SIZE / stats.nodes_capacity);
+    r->peak->peak_util = (double)r->requested / stats.allocated_bytes;
+}
+
+// 每次分配都写obj的前8字节，与malloc写chunk头的开销相当
+static void *replay(void *arg)
+{
+    replay_t *r = arg;
+    uint64_t *live = malloc(NUM_LIVE * sizeof(uint64_t));
+    void **ptrs = calloc(NUM_LIVE, sizeof(void *));
+    uint32_t *sizes = calloc(NUM_LIVE, sizeof(uint32_t));
+    memset(live, 0xff, NUM_LIVE * sizeof(uint64_t));
+    for (size_t i = 0; i < r->trace->n; i++)
+    {
+        const trace_op *op = &r->trace->ops[i];
+        uint64_t t0 = now_ns();
+        if (!r->meta)
+        {
+            if (op->size == 0)
+                free(ptrs[op->slot]);
+            else if ((ptrs[op->slot] = malloc(op->size)))
+                *(uint64_t *)ptrs[op->slot] = i;
+        }
+        else if (op->size == 0)
+        {
+            if (live[op->slot] != EMPTY)
+                box_free(r->meta, live[op->slot]);
+        }
+        else if ((live[op->slot] = box_alloc(r->meta, op->size)) != EMPTY)
+            *(uint64_t *)(r->data + live[op->slot]) = i;
+        r->lat[i] = (uint32_t)(now_ns() - t0);
+
+        bool ok = r->meta ? live[op->slot] != EMPTY : ptrs[op->slot] != NULL;
+        if (op->size == 0)
+        {
+            if (ok)
+                r->requested -= sizes[op->slot];
+            live[op->slot] = EMPTY;
+            ptrs[op->slot] = NULL;
+        }
+        else if (!ok)
+            r->failed++;
+        else
+            r->requested += sizes[op->slot] = op->size;
+        if (r->meta && r->peak && i % SAMPLE == 0)
+            sample_peak(r);
+    }
+    for (int i = 0; i < NUM_LIVE; i++)
+    {
+        if (live[i] != EMPTY)
+            box_free(r->meta, live[i]);
+        free(ptrs[i]);
+    }
+    free(sizes);
+    free(ptrs);
+    free(live);
+    return NULL;
+}
+
+static uint8_t *meta;
+static uint8_t *data;
+
+static void reset_box(size_t bytes)
+{
+    memset(meta, 0, META_SIZE);
+    if (box_init(meta, META_SIZE, bytes) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        exit(1);
+    }
+}
+
+// threads个线程各自重放traces[i]；use_box为false时用glibc malloc
+static void run(const trace_t *traces, int threads, bool use_box, bench_result *result)
+{
+    memset(result, 0, sizeof(*result));
+    if (use_box)
+        reset_box(DATA_SIZE);
+    size_t total = 0;
+    for (int t = 0; t < threads; t++)
+        total += traces[t].n;
+    uint32_t *lat = malloc(total * sizeof(uint32_t));
+    replay_t replays[THREADS];
+    pthread_t tids[THREADS];
+    uint32_t *next = lat;
+    for (int t = 0; t < threads; t++)
+    {
+        replays[t] = (replay_t){.meta = use_box ? meta : NULL, .data = data, .trace = &traces[t], .lat = next,
+                                .peak = threads == 1 ? result : NULL};
+        next += traces[t].n;
+    }
+
+    uint64_t t0 = now_ns();
+    if (threads == 1)
+        replay(&replays[0]);
+    else
+    {
+        for (int t = 0; t < threads; t++)
+            pthread_create(&tids[t], NULL, replay, &replays[t]);
+        for (int t = 0; t < threads; t++)
+            pthread_join(tids[t], NULL);
+    }
+    // 多线程时为总吞吐折算的每次操作耗时
+    result->ns_per_op = (double)(now_ns() - t0) / total;
+    for (int t = 0; t < threads; t++)
+        result->failed += replays[t].failed;
+    percentiles(lat, total, result);
+    free(lat);
+}
+
+static void print_result(const char *workload, const char *allocator, const bench_result *r)
+{
+    printf("%-9s %-6s %8.1f %6u %6u %7u %7ld", workload, allocator, r->ns_per_op, r->p50, r->p99, r->p999, r->failed);
+    if (r->peak_nodes)
+        printf(" %8lu %9luK %6.1f%%", r->peak_nodes, r->peak_meta_bytes / 1024, r->peak_util * 100);
+    printf("\n");
+}
+
+// 在FILL_SIZE的obj区上按幂律size一直分配到失败（obj区或meta区耗尽）
+static int fill(void)
+{
+    size_t max_ops = FILL_SIZE / 8;
+    reset_box(FILL_SIZE);
+    uint64_t *offsets = malloc(max_ops * sizeof(uint64_t));
+    uint32_t *lat = malloc(max_ops * sizeof(uint32_t));
+    uint32_t seed = 7;
+    uint64_t requested = 0;
+    size_t n = 0;
+    uint64_t t0 = now_ns();
+    while (n < max_ops)
+    {
+        size_t size = powerlaw_size(&seed);
+        uint64_t t = now_ns();
+        offsets[n] = box_alloc(meta, size);
+        lat[n] = (uint32_t)(now_ns() - t);
+        if (offsets[n] == EMPTY)
+            break;
+        *(uint64_t *)(data + offsets[n]) = n;
+        requested += size;
+        n++;
+    }
+    bench_result r = {.ns_per_op = (double)(now_ns() - t0) / (n + 1)};
+    box_stats_t stats;
+    box_stats(meta, &stats);
+    r.peak_nodes = stats.nodes;
+    r.peak_meta_bytes = stats.nodes * (META_SIZE / stats.nodes_capacity);
+    r.peak_util = (double)requested / stats.allocated_bytes;
+    percentiles(lat, n + 1, &r);
+    print_result("fill", "box", &r);
+    printf("fill: %zu objects, %.1f%% of the obj region allocated, %.1f%% requested, %s exhausted\n", n,
+           100.0 * stats.allocated_bytes / FILL_SIZE, 100.0 * requested / FILL_SIZE,
+           stats.nodes == stats.nodes_capacity ? "meta" : "obj");
+
+    for (size_t i = 0; i < n; i++)
+        box_free(meta, offsets[i]);
+    int ok = box_alloc(meta, FILL_SIZE) == 0 && n > 0;
+    free(lat);
+    free(offsets);
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    size_t ops = NUM_OPS;
+    if (argc > 1 && strcmp(argv[1], "--quick") == 0)
+        ops /= 20;
+    meta = calloc(1, META_SIZE);
+    // obj区只在写入时占用物理页
+    data = mmap(NULL, DATA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (!meta || data == MAP_FAILED)
+    {
+        printf("Failed to allocate the meta or obj region\n");
+        return 1;
+    }
+
+    const char *names[] = {"fixed", "powerlaw", "mixed"};
+    size_t (*sizes[])(uint32_t *) = {fixed_size, powerlaw_size, mixed_size};
+    printf("%-9s %-6s %8s %6s %6s %7s %7s %8s %10s %7s\n", "workload", "alloc", "ns/op", "p50", "p99", "p999",
+           "failed", "nodes", "meta", "util");
+    int errors = 0;
+    for (int w = 0; w < 3; w++)
+    {
+        trace_t trace = make_trace(sizes[w], ops, NUM_LIVE, 2024 + w);
+        bench_result box, glibc;
+        run(&trace, 1, true, &box);
+        run(&trace, 1, false, &glibc);
+        print_result(names[w], "box", &box);
+        print_result(names[w], "glibc", &glibc);
+        errors += box.failed != 0;
+        free(trace.ops);
+    }
+
+    // 各线程的obj总数与单线程时相同
+    trace_t traces[THREADS];
+    for (int t = 0; t < THREADS; t++)
+        traces[t] = make_trace(mixed_size, ops, NUM_LIVE / THREADS, 4096 + t);
+    bench_result box, glibc;
+    run(traces, THREADS, true, &box);
+    run(traces, THREADS, false, &glibc);
+    print_result("mt", "box", &box);
+    print_result("mt", "glibc", &glibc);
+    errors += box.failed != 0;
+    for (int t = 0; t < THREADS; t++)
+        free(traces[t].ops);
+
+    errors += fill();
+
+    munmap(data, DATA_SIZE);
+    free(meta);
+    return errors ? 1 : 0;
+}
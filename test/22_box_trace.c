@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+#define META_SIZE (16 * 1024 * 1024)
+#define DATA_SIZE (16 * 1024 * 1024)
+#define THREADS 4
+#define OPS 5000
+#define LIVE 64
+// 写在当前目录，供 box_replay 的测试使用
+#define TRACE_PATH "box_trace.bin"
+
+static uint8_t *meta;
+
+static void *worker(void *arg)
+{
+    uint32_t seed = (uint32_t)(uintptr_t)arg * 2654435761u + 1;
+    uint64_t offsets[LIVE];
+    memset(offsets, 0xff, sizeof(offsets));
+    for (int op = 0; op < OPS; op++)
+    {
+        seed = seed * 1103515245 + 12345;
+        int i = (seed >> 8) % LIVE;
+        if (offsets[i] == (uint64_t)-1)
+            offsets[i] = box_alloc(meta, 1 + (seed >> 12) % 4000);
+        else
+        {
+            box_allocated_size(meta, offsets[i]);
+            box_free(meta, offsets[i]);
+            offsets[i] = (uint64_t)-1;
+        }
+    }
+    uint64_t batch[16];
+    size_t n = box_alloc_n(meta, 24, 16, batch);
+    box_free_n(meta, batch, n);
+    for (int i = 0; i < LIVE; i++)
+        if (offsets[i] != (uint64_t)-1)
+            box_free(meta, offsets[i]);
+    return NULL;
+}
+
+static int check_trace(uint64_t expected)
+{
+    FILE *f = fopen(TRACE_PATH, "rb");
+    box_trace_header_t header;
+    if (!f || fread(&header, sizeof(header), 1, f) != 1 || memcmp(header.magic, BOX_TRACE_MAGIC, 8) != 0 ||
+        header.box_bytessize != DATA_SIZE || header.boxhead_bytessize != META_SIZE)
+    {
+        printf("bad trace header\n");
+        return 1;
+    }
+    if (header.records != expected || header.dropped != 0)
+    {
+        printf("trace has %lu records, %lu dropped, expected %lu\n", header.records, header.dropped, expected);
+        return 1;
+    }
+    box_trace_record_t *records = malloc(expected * sizeof(box_trace_record_t));
+    if (fread(records, sizeof(box_trace_record_t), expected, f) != expected)
+    {
+        printf("truncated trace\n");
+        return 1;
+    }
+    fclose(f);
+
+    // 每个offset的记录必须是 ALLOC (SIZE)* FREE 交替：释放记录不会早于分配记录
+    int errors = 0;
+    uint64_t allocs = 0, frees = 0, sizes = 0;
+    uint8_t *live = calloc(DATA_SIZE / 8, 1);
+    for (uint64_t i = 0; i < expected; i++)
+    {
+        box_trace_record_t *r = &records[i];
+        uint64_t slot = r->offset / 8;
+        if (r->op == BOX_TRACE_ALLOC)
+        {
+            allocs++;
+            if (r->offset != (uint64_t)-1 && live[slot]++)
+                errors++;
+        }
+        else if (r->op == BOX_TRACE_FREE)
+        {
+            frees++;
+            if (!live[slot]--)
+                errors++;
+        }
+        else if (r->op == BOX_TRACE_SIZE)
+        {
+            sizes++;
+            if (!live[slot] || r->size == 0)
+                errors++;
+        }
+        else
+            errors++;
+    }
+    if (errors || allocs != frees || sizes == 0)
+    {
+        printf("%d inconsistent records: %lu allocs, %lu frees, %lu sizes\n", errors, allocs, frees, sizes);
+        errors++;
+    }
+    free(live);
+    free(records);
+    return errors ? 1 : 0;
+}
+
+int main()
+{
+    int errors = 0;
+    meta = calloc(1, META_SIZE);
+    if (box_init(meta, META_SIZE, DATA_SIZE) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+
+    // 跟踪开始之前的调用不记录
+    uint64_t before = box_alloc(meta, 100);
+    if (box_trace_start(meta, TRACE_PATH, 1000000) != 0)
+    {
+        printf("box_trace_start failed\n");
+        return 1;
+    }
+    if (box_trace_start(meta, TRACE_PATH, 10) == 0)
+    {
+        printf("second box_trace_start accepted\n");
+        errors++;
+    }
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; i++)
+        pthread_create(&threads[i], NULL, worker, (void *)(uintptr_t)i);
+    for (int i = 0; i < THREADS; i++)
+        pthread_join(threads[i], NULL);
+    uint64_t records = box_trace_stop();
+    box_free(meta, before);
+
+    // 每个线程 OPS 次操作，释放时另有一次SIZE，最后批量分配/释放16个，再释放剩余的obj
+    if (records < (uint64_t)THREADS * (OPS + 32))
+    {
+        printf("only %lu records\n", records);
+        errors++;
+    }
+    errors += check_trace(records);
+
+    // 超出max_records的记录丢弃
+    if (box_trace_start(meta, "box_trace_small.bin", 10) != 0)
+    {
+        printf("box_trace_start failed\n");
+        return 1;
+    }
+    for (int i = 0; i < 20; i++)
+        box_free(meta, box_alloc(meta, 8));
+    if (box_trace_stop() != 10)
+    {
+        printf("max_records not enforced\n");
+        errors++;
+    }
+    remove("box_trace_small.bin");
+
+    free(meta);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,154 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <boxmalloc/boxmalloc.h>
+#include "box_test.h"
+
+#define META_SIZE (4 * 1024 * 1024)
+#define DATA_SIZE (64 * 1024)
+#define THREADS 4
+#define OPS 2000
+
+static uint8_t *meta;
+
+static uint64_t sum(const uint64_t *hist, size_t n)
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < n; i++)
+        total += hist[i];
+    return total;
+}
+
+static void *worker(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < OPS; i++)
+    {
+        uint64_t offset = box_alloc(meta, 8 + i % 500);
+        if (offset != (uint64_t)-1)
+            box_free(meta, offset);
+    }
+    return NULL;
+}
+
+int main()
+{
+    int errors = 0;
+    meta = calloc(1, META_SIZE);
+    if (!meta || box_init(meta, META_SIZE, DATA_SIZE) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+    box_instr_t s;
+
+    // 未开启时不计数
+    box_instr_reset();
+    box_free(meta, box_alloc(meta, 24));
+    box_instr_snapshot(&s);
+    if (s.allocs != 0 || s.frees != 0)
+    {
+        printf("counted while disabled: %lu allocs, %lu frees\n", s.allocs, s.frees);
+        errors++;
+    }
+
+    // 多个线程的计数，线程退出后仍计入
+    box_instr_enable(true);
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; i++)
+        pthread_create(&threads[i], NULL, worker, NULL);
+    for (int i = 0; i < THREADS; i++)
+        pthread_join(threads[i], NULL);
+    box_instr_snapshot(&s);
+    uint64_t expected = (uint64_t)THREADS * OPS;
+    if (s.allocs != expected || s.frees != expected)
+    {
+        printf("expected %lu allocs/frees, got %lu/%lu\n", expected, s.allocs, s.frees);
+        errors++;
+    }
+    if (sum(s.alloc_ns, BOX_INSTR_BUCKETS) != s.allocs || sum(s.free_ns, BOX_INSTR_BUCKETS) != s.frees ||
+        sum(s.depth, BOX_INSTR_LEVELS) != s.allocs || sum(s.scanned, BOX_INSTR_BUCKETS) != s.allocs ||
+        sum(s.propagation, BOX_INSTR_LEVELS) != s.allocs + s.frees)
+    {
+        printf("histogram totals do not match the counters\n");
+        errors++;
+    }
+    if (s.depth[0] != 0 || s.blocks_alloc == 0 || s.fail_too_large + s.fail_no_run + s.fail_meta != 0)
+    {
+        printf("unexpected depth[0]=%lu blocks_alloc=%lu failures=%lu\n", s.depth[0], s.blocks_alloc,
+               s.fail_too_large + s.fail_no_run + s.fail_meta);
+        errors++;
+    }
+
+    // 失败原因：比box大、没有连续空间
+    box_instr_reset();
+    box_alloc(meta, DATA_SIZE * 2);
+    // 多留一项，保证以一次失败的分配结束
+    uint64_t *fill = malloc((DATA_SIZE / 8 + 1) * sizeof(uint64_t));
+    size_t n = box_test_fill(meta, 8, fill, DATA_SIZE / 8 + 1);
+    box_instr_snapshot(&s);
+    if (s.fail_too_large != 1 || s.fail_no_run != 1 || s.fail_meta != 0 || s.allocs != n + 2)
+    {
+        printf("expected 1 too-large and 1 no-run failure, got %lu/%lu/%lu in %lu allocs\n",
+               s.fail_too_large, s.fail_no_run, s.fail_meta, s.allocs);
+        errors++;
+    }
+    for (size_t i = 0; i < n; i++)
+        box_free(meta, fill[i]);
+    free(fill);
+
+    // meta区耗尽
+    uint8_t *small = calloc(1, 4096);
+    if (box_init(small, 4096, 16 * 1024 * 1024) != 0)
+    {
+        printf("Failed to initialize the small meta\n");
+        errors++;
+    }
+    else
+    {
+        box_instr_reset();
+        for (int i = 0; i < 4096 && box_alloc(small, 8) != (uint64_t)-1; i++)
+            ;
+        box_instr_snapshot(&s);
+        if (s.fail_meta == 0)
+        {
+            printf("meta exhaustion not counted\n");
+            errors++;
+        }
+    }
+    free(small);
+
+    // 找不到obj的释放同样计数，直方图与计数一致
+    box_instr_reset();
+    box_free(meta, 8);
+    box_instr_snapshot(&s);
+    if (s.frees != 1 || sum(s.free_ns, BOX_INSTR_BUCKETS) != 1)
+    {
+        printf("failed free counted as %lu frees, %lu timings\n", s.frees, sum(s.free_ns, BOX_INSTR_BUCKETS));
+        errors++;
+    }
+
+    // reset 后清零，关闭后不再计数
+    box_instr_reset();
+    box_instr_snapshot(&s);
+    if (s.allocs != 0 || s.frees != 0 || s.blocks_alloc != 0 || sum(s.alloc_ns, BOX_INSTR_BUCKETS) != 0)
+    {
+        printf("counters not cleared by reset\n");
+        errors++;
+    }
+    box_instr_enable(false);
+    box_free(meta, box_alloc(meta, 24));
+    box_instr_snapshot(&s);
+    if (s.allocs != 0 || s.frees != 0)
+    {
+        printf("counted after disable\n");
+        errors++;
+    }
+
+    free(meta);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,129 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <boxmalloc/boxmalloc.h>
+// 白盒测试：直接改写节点，构造不一致的meta区
+#include "box.h"
+
+#define META_SIZE (32 * 1024 * 1024)
+#define DATA_SIZE (64 * 1024 * 1024)
+#define LIVE 20000
+#define OPS 200000
+
+static int expect(uint8_t *meta, unsigned threads, bool repair, int ret, uint64_t violations, uint32_t kind, const char *what)
+{
+    box_verify_report_t report;
+    int r = box_verify(meta, threads, repair, &report);
+    if (r != ret || report.violations != violations || (violations && report.error[0].kind != kind))
+    {
+        printf("%s: box_verify returned %d with %lu violations (kind %u), expected %d/%lu/%u\n", what, r,
+               report.violations, report.reported ? report.error[0].kind : 0, ret, violations, kind);
+        return 1;
+    }
+    return 0;
+}
+
+int main()
+{
+    int errors = 0;
+    uint8_t *meta = calloc(1, META_SIZE);
+    uint64_t *live = malloc(LIVE * sizeof(uint64_t));
+    if (!meta || !live || box_init(meta, META_SIZE, DATA_SIZE) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+
+    // 随机分配/释放之后树是一致的，单线程与多线程检查的节点数相同
+    memset(live, 0xff, LIVE * sizeof(uint64_t));
+    uint32_t seed = 12345;
+    for (int op = 0; op < OPS; op++)
+    {
+        seed = seed * 1103515245 + 12345;
+        int i = (seed >> 8) % LIVE;
+        if (live[i] == (uint64_t)-1)
+            live[i] = box_alloc(meta, 1 + (seed >> 4) % ((seed & 7) ? 512 : 65536));
+        else
+        {
+            box_free(meta, live[i]);
+            live[i] = (uint64_t)-1;
+        }
+    }
+    box_stats_t stats;
+    box_verify_report_t report;
+    box_stats(meta, &stats);
+    unsigned threads[] = {1, 4, 0};
+    for (int t = 0; t < 3; t++)
+    {
+        if (box_verify(meta, threads[t], false, &report) != 0 || report.violations != 0 || report.nodes != stats.nodes)
+        {
+            printf("%u threads: %lu violations, %lu/%lu nodes\n", threads[t], report.violations, report.nodes, stats.nodes);
+            errors++;
+        }
+    }
+
+    box_meta_t *m = (box_meta_t *)meta;
+    int32_t root_id = box_root_id(m);
+    box_head_t *root = box_node(m, root_id);
+    int child_slot = __builtin_ctz(box_formatted_mask(root));
+    box_head_t *child = box_node(m, root->childs_blockid[child_slot]);
+    uint64_t child_base = obj_offset((obj_usage){.level = root->objlevel, .multiple = child_slot});
+
+    // 容量字段：报告后修复，修复后再检查没有错误
+    int8_t max = root->max_obj_capacity;
+    root->max_obj_capacity = max == 0 ? 1 : 0;
+    errors += expect(meta, 4, false, 1, 1, BOX_VERIFY_MAX_CAPACITY, "max_obj_capacity");
+    errors += expect(meta, 4, true, 0, 1, BOX_VERIFY_MAX_CAPACITY, "max_obj_capacity repair");
+    errors += expect(meta, 4, false, 0, 0, 0, "max_obj_capacity repaired");
+    if (root->max_obj_capacity != max)
+    {
+        printf("max_obj_capacity repaired to %d, expected %d\n", root->max_obj_capacity, max);
+        errors++;
+    }
+
+    root->child_cap[child_slot] ^= 1;
+    errors += expect(meta, 1, true, 0, 1, BOX_VERIFY_CHILD_CAPACITY, "child_cap repair");
+    child->child_max_obj_capacity = (obj_usage){.level = 15, .multiple = 15};
+    errors += expect(meta, 4, true, 0, 1, BOX_VERIFY_CHILD_CAPACITY, "child_max_obj_capacity repair");
+    errors += expect(meta, 4, false, 0, 0, 0, "child capacity repaired");
+
+    // 结构错误：只报告，出错的子树按没有空闲空间修复父节点
+    int32_t parent = child->parent;
+    child->parent = 12345;
+    if (box_verify(meta, 4, true, &report) != 1 || report.error[0].kind != BOX_VERIFY_LINK ||
+        report.error[0].block_id != root->childs_blockid[child_slot] || report.error[0].offset != child_base ||
+        root->child_cap[child_slot] != 0)
+    {
+        printf("broken parent link not reported\n");
+        errors++;
+    }
+    child->parent = parent;
+    errors += expect(meta, 4, true, 0, 1, BOX_VERIFY_CHILD_CAPACITY, "restored link repair");
+    errors += expect(meta, 4, false, 0, 0, 0, "restored link");
+
+    uint16_t start = root->slots.start_mask;
+    root->slots.start_mask |= (uint16_t)(1u << root->avliable_slot);
+    errors += expect(meta, 1, false, 1, 1, BOX_VERIFY_SLOTS, "slot beyond avliable_slot");
+    root->slots.start_mask = start;
+    errors += expect(meta, 1, false, 0, 0, 0, "slot restored");
+
+    // 修复后仍可正常分配、释放
+    for (int i = 0; i < LIVE; i++)
+        if (live[i] != (uint64_t)-1)
+            box_free(meta, live[i]);
+    uint64_t whole = box_alloc(meta, DATA_SIZE);
+    if (whole != 0)
+    {
+        printf("whole box not allocatable after repair\n");
+        errors++;
+    }
+    box_free(meta, whole);
+    errors += expect(meta, 0, false, 0, 0, 0, "after free");
+
+    free(live);
+    free(meta);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,198 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+#define META_SIZE (16 * 1024 * 1024)
+#define DATA_SIZE (16 * 1024 * 1024)
+#define LIVE 4000
+#define OPS 40000
+#define MAX_EXTENTS (2 * LIVE + 2)
+
+static int compare_offset(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// 从from开始遍历，返回区域数
+static size_t collect(uint8_t *meta, uint64_t from, box_extent_t *extents)
+{
+    box_iter_t iter;
+    size_t n = 0;
+    if (box_iter_begin(meta, &iter, from) != 0)
+        return 0;
+    while (n < MAX_EXTENTS && box_iter_next(&iter, &extents[n]))
+        n++;
+    box_iter_end(&iter);
+    return n;
+}
+
+// 区域按offset递增、首尾相接地覆盖[from, DATA_SIZE)，空闲区域不相邻，obj与live一一对应
+static int check_full(box_extent_t *extents, size_t n, const uint64_t *sorted, size_t live)
+{
+    uint64_t at = 0;
+    size_t objs = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (extents[i].offset != at || extents[i].bytes == 0)
+        {
+            printf("extent %zu at %lu+%lu, expected offset %lu\n", i, extents[i].offset, extents[i].bytes, at);
+            return 1;
+        }
+        if (extents[i].kind == BOX_ITER_FREE && i > 0 && extents[i - 1].kind == BOX_ITER_FREE)
+        {
+            printf("adjacent free extents at %lu\n", extents[i].offset);
+            return 1;
+        }
+        if (extents[i].kind == BOX_ITER_OBJ)
+        {
+            if (objs >= live || sorted[objs] != extents[i].offset)
+            {
+                printf("unexpected object at %lu\n", extents[i].offset);
+                return 1;
+            }
+            objs++;
+        }
+        at += extents[i].bytes;
+    }
+    if (at != DATA_SIZE || objs != live)
+    {
+        printf("iteration covered %lu bytes and %zu/%zu objects\n", at, objs, live);
+        return 1;
+    }
+    return 0;
+}
+
+int main()
+{
+    int errors = 0;
+    uint8_t *meta = calloc(1, META_SIZE);
+    uint64_t *live = malloc(LIVE * sizeof(uint64_t));
+    uint64_t *sorted = malloc(LIVE * sizeof(uint64_t));
+    box_extent_t *full = malloc(MAX_EXTENTS * sizeof(box_extent_t));
+    box_extent_t *part = malloc(MAX_EXTENTS * sizeof(box_extent_t));
+    if (!meta || !live || !sorted || !full || !part || box_init_ex(meta, META_SIZE, DATA_SIZE, &(box_options_t){.empty_keep = 4}) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+
+    // 空的box是一整段空闲区域
+    size_t n = collect(meta, 0, full);
+    if (n != 1 || full[0].kind != BOX_ITER_FREE || full[0].offset != 0 || full[0].bytes != DATA_SIZE)
+    {
+        printf("empty box: %zu extents\n", n);
+        errors++;
+    }
+
+    memset(live, 0xff, LIVE * sizeof(uint64_t));
+    uint32_t seed = 1;
+    for (int op = 0; op < OPS; op++)
+    {
+        seed = seed * 1103515245 + 12345;
+        int i = (seed >> 8) % LIVE;
+        if (live[i] == (uint64_t)-1)
+            live[i] = box_alloc(meta, 1 + (seed >> 4) % ((seed & 15) ? 300 : 20000));
+        else
+        {
+            box_free(meta, live[i]);
+            live[i] = (uint64_t)-1;
+        }
+    }
+    size_t count = 0;
+    for (int i = 0; i < LIVE; i++)
+        if (live[i] != (uint64_t)-1)
+            sorted[count++] = live[i];
+    qsort(sorted, count, sizeof(uint64_t), compare_offset);
+
+    n = collect(meta, 0, full);
+    errors += check_full(full, n, sorted, count);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (full[i].kind == BOX_ITER_OBJ && full[i].bytes != box_allocated_size(meta, full[i].offset))
+        {
+            printf("object at %lu reported %lu bytes\n", full[i].offset, full[i].bytes);
+            errors++;
+            break;
+        }
+    }
+
+    // 从区域的末尾继续：与完整遍历的后半部分相同
+    size_t k = n / 3;
+    uint64_t resume = full[k].offset + full[k].bytes;
+    size_t m = collect(meta, resume, part);
+    if (m != n - k - 1 || memcmp(part, &full[k + 1], m * sizeof(box_extent_t)) != 0)
+    {
+        printf("resume at %lu: %zu extents, expected %zu\n", resume, m, n - k - 1);
+        errors++;
+    }
+
+    // 从区域中间开始：跳过起始于from之前的obj，空闲区域从from处截断
+    for (size_t j = 0; j < n; j++)
+    {
+        if (full[j].bytes < 16)
+            continue;
+        uint64_t from = full[j].offset + 8;
+        m = collect(meta, from, part);
+        size_t expected = full[j].kind == BOX_ITER_FREE ? n - j : n - j - 1;
+        box_extent_t *first = full[j].kind == BOX_ITER_FREE ? &full[j] : &full[j + 1];
+        bool ok = m == expected;
+        if (ok && full[j].kind == BOX_ITER_FREE)
+            ok = part[0].offset == from && part[0].bytes == full[j].bytes - 8 && memcmp(&part[1], &full[j + 1], (m - 1) * sizeof(box_extent_t)) == 0;
+        else if (ok)
+            ok = memcmp(part, first, m * sizeof(box_extent_t)) == 0;
+        if (!ok)
+        {
+            printf("start inside the extent at %lu: %zu extents, expected %zu\n", full[j].offset, m, expected);
+            errors++;
+        }
+        j += n / 16;
+    }
+
+    if (collect(meta, DATA_SIZE, part) != 0)
+    {
+        printf("extents reported beyond the box\n");
+        errors++;
+    }
+
+    // 全部释放后（保留的空节点也是空闲的）又是一整段空闲区域
+    for (int i = 0; i < LIVE; i++)
+        if (live[i] != (uint64_t)-1)
+            box_free(meta, live[i]);
+    n = collect(meta, 0, full);
+    if (n != 1 || full[0].kind != BOX_ITER_FREE || full[0].bytes != DATA_SIZE)
+    {
+        printf("after freeing everything: %zu extents\n", n);
+        errors++;
+    }
+
+    // 中途停止：box_iter_end 后路径上的节点可以回收，全部释放后树中没有空节点
+    memset(meta, 0, META_SIZE);
+    box_init(meta, META_SIZE, DATA_SIZE);
+    for (int i = 0; i < 64; i++)
+        live[i] = box_alloc(meta, 8 + i % 4 * 100);
+    box_iter_t iter;
+    box_extent_t extent;
+    box_iter_begin(meta, &iter, 0);
+    for (int i = 0; i < 3; i++)
+        box_iter_next(&iter, &extent);
+    box_iter_end(&iter);
+    for (int i = 0; i < 64; i++)
+        box_free(meta, live[i]);
+    if (box_alloc(meta, DATA_SIZE) != 0)
+    {
+        printf("nodes kept after an abandoned iteration\n");
+        errors++;
+    }
+
+    free(part);
+    free(full);
+    free(sorted);
+    free(live);
+    free(meta);
+    return errors ? 1 : 0;
+}
@@ -30,7 +30,7 @@ int main()
     {
         size_t size = sizes[i % num_sizes];
         uint64_t obj_offset = box_alloc(buddy,  size);
-        if (obj_offset == UINT64_MAX-1)
+        if (obj_offset == (uint64_t)-1)
         {
             printf("box_alloc failed at iteration %d\n", i);
             return 1;
@@ -44,7 +44,11 @@ int main()
     {
  
         uint64_t actual = *(uint64_t *)(data + offsets[i]);
-        printf("stored value = %lu\n",actual);
+        if (actual != (uint64_t)i)
+        {
+            printf("object %d: stored value = %lu\n", i, actual);
+            return 1;
+        }
         box_free(buddy, offsets[i]);
     }
 
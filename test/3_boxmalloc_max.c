@@ -6,6 +6,7 @@
 #include <boxmalloc/boxmalloc.h>
 
 #define SMALL_OBJ_SIZE 8  // 小对象大小 <=8byte
+#define NUM_LOOPS 1000000 // 第二阶段的循环次数
 
 int main() {
     // 初始化 boxmalloc 的元数据和数据区，使用更大的内存池以支持高负载
@@ -38,7 +39,7 @@ int main() {
     int alloc_count = 0;
     while (1) {
         uint64_t obj_offset = box_alloc(buddy,  SMALL_OBJ_SIZE);
-        if (obj_offset == UINT64_MAX-1) {
+        if (obj_offset == (uint64_t)-1) {
             break;  // 分配失败，box已满
         }
         if (alloc_count >= capacity) {
@@ -57,13 +58,14 @@ int main() {
     }
     printf("Allocated %d small objects\n", alloc_count);
 
-    // 第二阶段：无限循环随机free和malloc
-    printf("Phase 2: Starting infinite random free/malloc loop...\n");
+    // 第二阶段：写满后随机free和malloc，每次free腾出的位置都应能立即重新分配
+    printf("Phase 2: Starting random free/malloc loop...\n");
     srand(time(NULL));  // 初始化随机种子
     long long loop_count = 0;
     clock_t start = clock();
 
-    while (1) {
+    int result = 0;
+    while (loop_count < NUM_LOOPS) {
         // 随机选择一个已分配的对象
         int random_index = rand() % alloc_count;
         void *ptr_to_free = ptrs[random_index];
@@ -74,8 +76,9 @@ int main() {
 
         // 立即 Malloc 一个新的小对象
         uint64_t new_offset = box_alloc(buddy, SMALL_OBJ_SIZE);
-        if (new_offset == UINT64_MAX-1) {
+        if (new_offset == (uint64_t)-1) {
             printf("Re-allocation failed at loop %lld\n", loop_count);
+            result = 1;
             break;  // 如果分配失败，退出循环
         }
 
@@ -85,8 +88,8 @@ int main() {
 
         loop_count++;
 
-        // 每10000次循环输出一次统计信息
-        if (loop_count % 10000 == 0) {
+        // 每100000次循环输出一次统计信息
+        if (loop_count % 100000 == 0) {
             clock_t current = clock();
             double elapsed = (double)(current - start) / CLOCKS_PER_SEC;
             printf("Loop %lld: Time elapsed %.2f seconds\n", loop_count, elapsed);
@@ -102,5 +105,5 @@ int main() {
     free(buddy);
     free(data);
     printf("Stress test completed after %lld loops.\n", loop_count);
-    return 0;
+    return result;
 }
\ No newline at end of file
@@ -0,0 +1,180 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+#define META_SIZE (16 * 1024 * 1024)
+#define DATA_SIZE (64 * 1024 * 1024)
+#define NUM_THREADS 8
+#define NUM_OPS 50000
+#define NUM_LIVE 512
+
+typedef struct
+{
+    uint64_t offset;
+    size_t size;
+    uint8_t tag;
+} live_obj;
+
+typedef struct
+{
+    int id;
+    uint32_t seed;
+    long errors;
+    long failed_allocs;
+    live_obj live[NUM_LIVE];
+} worker_ctx;
+
+static uint8_t *meta;
+static uint8_t *data;
+
+static uint32_t next_rand(uint32_t *seed)
+{
+    // xorshift32，线程私有状态
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *seed = x;
+}
+
+static size_t random_size(uint32_t *seed)
+{
+    // 大部分是小对象，偶尔夹杂大对象
+    int r = next_rand(seed) % 100;
+    if (r < 70)
+        return 1 + next_rand(seed) % 128;
+    if (r < 95)
+        return 129 + next_rand(seed) % 4096;
+    return 4097 + next_rand(seed) % (256 * 1024);
+}
+
+// 对象内容被其它线程覆盖，说明同一区域被重复分配
+static int check_obj(live_obj *obj)
+{
+    uint8_t *p = data + obj->offset;
+    for (size_t i = 0; i < obj->size; i++)
+    {
+        if (p[i] != obj->tag)
+            return -1;
+    }
+    return 0;
+}
+
+static void *worker(void *arg)
+{
+    worker_ctx *ctx = arg;
+    for (int op = 0; op < NUM_OPS; op++)
+    {
+        live_obj *obj = &ctx->live[next_rand(&ctx->seed) % NUM_LIVE];
+        if (obj->size)
+        {
+            if (check_obj(obj) != 0)
+            {
+                printf("thread %d: object+%lu corrupted\n", ctx->id, obj->offset);
+                ctx->errors++;
+            }
+            if (box_allocated_size(meta, obj->offset) < obj->size)
+            {
+                printf("thread %d: object+%lu allocated_size too small\n", ctx->id, obj->offset);
+                ctx->errors++;
+            }
+            box_free(meta, obj->offset);
+            obj->size = 0;
+            continue;
+        }
+
+        size_t size = random_size(&ctx->seed);
+        uint64_t offset = box_alloc(meta, size);
+        if (offset == (uint64_t)-1)
+        {
+            ctx->failed_allocs++;
+            continue;
+        }
+        if (offset + size > DATA_SIZE)
+        {
+            printf("thread %d: object+%lu out of range\n", ctx->id, offset);
+            ctx->errors++;
+            continue;
+        }
+        obj->offset = offset;
+        obj->size = size;
+        obj->tag = (uint8_t)(ctx->id * 31 + op);
+        memset(data + offset, obj->tag, size);
+    }
+
+    // 释放剩余对象
+    for (int i = 0; i < NUM_LIVE; i++)
+    {
+        live_obj *obj = &ctx->live[i];
+        if (!obj->size)
+            continue;
+        if (check_obj(obj) != 0)
+        {
+            printf("thread %d: object+%lu corrupted\n", ctx->id, obj->offset);
+            ctx->errors++;
+        }
+        box_free(meta, obj->offset);
+        obj->size = 0;
+    }
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    int num_threads = argc > 1 ? atoi(argv[1]) : NUM_THREADS;
+    if (num_threads < 1 || num_threads > NUM_THREADS)
+        num_threads = NUM_THREADS;
+
+    meta = calloc(1, META_SIZE);
+    data = malloc(DATA_SIZE);
+    if (!meta || !data)
+    {
+        perror("Failed to allocate memory for boxmalloc");
+        return 1;
+    }
+    if (box_init(meta, META_SIZE, DATA_SIZE) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+
+    pthread_t threads[NUM_THREADS];
+    worker_ctx *ctxs = calloc(NUM_THREADS, sizeof(worker_ctx));
+    for (int i = 0; i < num_threads; i++)
+    {
+        ctxs[i].id = i;
+        ctxs[i].seed = 12345u + i;
+        pthread_create(&threads[i], NULL, worker, &ctxs[i]);
+    }
+
+    long errors = 0;
+    long failed_allocs = 0;
+    for (int i = 0; i < num_threads; i++)
+    {
+        pthread_join(threads[i], NULL);
+        errors += ctxs[i].errors;
+        failed_allocs += ctxs[i].failed_allocs;
+    }
+    printf("%d threads x %d ops, %ld failed allocs, %ld errors\n", num_threads, NUM_OPS, failed_allocs, errors);
+
+    // 全部释放后，空节点都已回收、容量信息恢复：整个obj区可以作为一个obj分配
+    uint64_t big = box_alloc(meta, DATA_SIZE);
+    if (big == (uint64_t)-1 || box_allocated_size(meta, big) < DATA_SIZE)
+    {
+        printf("tree inconsistent: large allocation failed after all frees\n");
+        errors++;
+    }
+    else
+    {
+        box_free(meta, big);
+    }
+
+    free(ctxs);
+    free(meta);
+    free(data);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+#define META_SIZE (4 * 1024 * 1024)
+#define DATA_SIZE (16 * 1024 * 1024)
+#define NUM_THREADS 4
+#define NUM_OPS 200000
+#define NUM_LIVE 256
+
+typedef struct
+{
+    uint64_t offset;
+    size_t size;
+} live_obj;
+
+typedef struct
+{
+    int id;
+    uint32_t seed;
+    long errors;
+    live_obj live[NUM_LIVE];
+} worker_ctx;
+
+static uint8_t *meta;
+static uint8_t *data;
+
+static uint32_t next_rand(uint32_t *seed)
+{
+    uint32_t x = *seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *seed = x;
+}
+
+static void *worker(void *arg)
+{
+    worker_ctx *ctx = arg;
+    uint8_t tag = (uint8_t)(ctx->id + 1);
+    for (int op = 0; op < NUM_OPS; op++)
+    {
+        live_obj *obj = &ctx->live[next_rand(&ctx->seed) % NUM_LIVE];
+        if (obj->size)
+        {
+            for (size_t i = 0; i < obj->size; i++)
+            {
+                if (data[obj->offset + i] != tag)
+                {
+                    printf("thread %d: object+%lu corrupted\n", ctx->id, obj->offset);
+                    ctx->errors++;
+                    break;
+                }
+            }
+            box_tcache_free(meta, obj->offset, obj->size);
+            obj->size = 0;
+            continue;
+        }
+        size_t size = 1 + next_rand(&ctx->seed) % 128;
+        uint64_t offset = box_tcache_alloc(meta, size);
+        if (offset == (uint64_t)-1)
+        {
+            printf("thread %d: box_tcache_alloc failed\n", ctx->id);
+            ctx->errors++;
+            continue;
+        }
+        obj->offset = offset;
+        obj->size = size;
+        memset(data + offset, tag, size);
+    }
+    for (int i = 0; i < NUM_LIVE; i++)
+    {
+        if (ctx->live[i].size)
+            box_tcache_free(meta, ctx->live[i].offset, ctx->live[i].size);
+    }
+    // 不调用box_tcache_flush，依赖线程退出时自动归还
+    return NULL;
+}
+
+int main()
+{
+    meta = calloc(1, META_SIZE);
+    data = malloc(DATA_SIZE);
+    if (box_init(meta, META_SIZE, DATA_SIZE) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+    box_tcache_set_depth(32);
+
+    pthread_t threads[NUM_THREADS];
+    worker_ctx *ctxs = calloc(NUM_THREADS, sizeof(worker_ctx));
+    for (int i = 0; i < NUM_THREADS; i++)
+    {
+        ctxs[i].id = i;
+        ctxs[i].seed = 777u + i;
+        pthread_create(&threads[i], NULL, worker, &ctxs[i]);
+    }
+    long errors = 0;
+    for (int i = 0; i < NUM_THREADS; i++)
+    {
+        pthread_join(threads[i], NULL);
+        errors += ctxs[i].errors;
+    }
+
+    // 线程退出后缓存应已归还：最后一批对象在box树中都是空闲的
+    for (int t = 0; t < NUM_THREADS; t++)
+    {
+        for (int i = 0; i < NUM_LIVE; i++)
+        {
+            live_obj *obj = &ctxs[t].live[i];
+            if (obj->offset && box_allocated_size(meta, obj->offset) != 0)
+            {
+                printf("object+%lu still allocated after thread exit\n", obj->offset);
+                errors++;
+            }
+        }
+    }
+
+    // 主线程：缓存命中时复用同一offset
+    uint64_t a = box_tcache_alloc(meta, 24);
+    box_tcache_free(meta, a, 24);
+    uint64_t b = box_tcache_alloc(meta, 17);
+    if (a != b)
+    {
+        printf("tcache miss: %lu != %lu\n", a, b);
+        errors++;
+    }
+    box_tcache_free(meta, b, 17);
+    box_tcache_flush(meta);
+    if (box_allocated_size(meta, b) != 0)
+    {
+        printf("object+%lu still allocated after flush\n", b);
+        errors++;
+    }
+
+    printf("%d threads x %d ops, %ld errors\n", NUM_THREADS, NUM_OPS, errors);
+    free(ctxs);
+    free(meta);
+    free(data);
+    return errors ? 1 : 0;
+}
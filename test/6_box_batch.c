@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+#define META_SIZE (16 * 1024 * 1024)
+#define DATA_SIZE (64 * 1024 * 1024)
+#define BATCH 4096
+#define ROUNDS 50
+
+static int compare_offset(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// 检查批量分配的obj互不重叠、allocated_size正确
+static int check_batch(uint8_t *meta, uint64_t *offsets, size_t n, size_t size)
+{
+    uint64_t *sorted = malloc(n * sizeof(uint64_t));
+    memcpy(sorted, offsets, n * sizeof(uint64_t));
+    qsort(sorted, n, sizeof(uint64_t), compare_offset);
+    int errors = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        uint64_t allocated = box_allocated_size(meta, sorted[i]);
+        if (allocated < size)
+        {
+            printf("object+%lu allocated_size %lu < %zu\n", sorted[i], allocated, size);
+            errors++;
+        }
+        if (i > 0 && sorted[i - 1] + allocated > sorted[i])
+        {
+            printf("object+%lu overlaps object+%lu\n", sorted[i - 1], sorted[i]);
+            errors++;
+        }
+    }
+    free(sorted);
+    return errors;
+}
+
+static double elapsed(struct timespec a, struct timespec b)
+{
+    return (b.tv_sec - a.tv_sec) + (b.tv_nsec - a.tv_nsec) / 1e9;
+}
+
+int main()
+{
+    uint8_t *meta = calloc(1, META_SIZE);
+    if (box_init(meta, META_SIZE, DATA_SIZE) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+
+    int errors = 0;
+    uint64_t *offsets = malloc(BATCH * sizeof(uint64_t));
+    size_t sizes[] = {8, 24, 100, 200, 3000};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        size_t n = box_alloc_n(meta, sizes[s], BATCH, offsets);
+        if (n != BATCH)
+        {
+            printf("box_alloc_n(%zu) allocated %zu/%d\n", sizes[s], n, BATCH);
+            errors++;
+        }
+        errors += check_batch(meta, offsets, n, sizes[s]);
+        box_free_n(meta, offsets, n);
+        for (size_t i = 0; i < n; i++)
+        {
+            if (box_allocated_size(meta, offsets[i]) != 0)
+            {
+                printf("object+%lu still allocated after box_free_n\n", offsets[i]);
+                errors++;
+                break;
+            }
+        }
+    }
+
+    // size为0时按一个8字节单位分配，两次分配不能返回同一个offset
+    uint64_t zero[4] = {box_alloc(meta, 0), box_alloc(meta, 0), box_alloc(meta, 8), box_alloc_aligned(meta, 0, 16)};
+    size_t nzero = box_alloc_n(meta, 0, 4, offsets);
+    memcpy(offsets + nzero, zero, sizeof(zero));
+    if (nzero != 4 || zero[0] == zero[1])
+    {
+        printf("size 0: box_alloc returned %lu, %lu; box_alloc_n allocated %zu/4\n", zero[0], zero[1], nzero);
+        errors++;
+    }
+    errors += check_batch(meta, offsets, nzero + 4, 8);
+    box_free_n(meta, offsets, nzero + 4);
+
+    // 与逐个分配/释放对比
+    struct timespec t0, t1, t2;
+    timespec_get(&t0, TIME_UTC);
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        for (int i = 0; i < BATCH; i++)
+            offsets[i] = box_alloc(meta, 16);
+        for (int i = 0; i < BATCH; i++)
+            box_free(meta, offsets[i]);
+    }
+    timespec_get(&t1, TIME_UTC);
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        size_t n = box_alloc_n(meta, 16, BATCH, offsets);
+        box_free_n(meta, offsets, n);
+    }
+    timespec_get(&t2, TIME_UTC);
+    double loop = elapsed(t0, t1) * 1e9 / (ROUNDS * BATCH);
+    double batch = elapsed(t1, t2) * 1e9 / (ROUNDS * BATCH);
+    printf("alloc+free 16 bytes: loop %.1f ns/obj, batch %.1f ns/obj\n", loop, batch);
+
+    free(offsets);
+    free(meta);
+    return errors ? 1 : 0;
+}
@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+// meta区只够几十个box_head_t，不回收空节点时很快耗尽
+#define META_SIZE (8 * 1024)
+#define DATA_SIZE (16 * 1024 * 1024)
+#define ROUNDS 1000
+
+int main()
+{
+    int errors = 0;
+
+    // 立即回收：每轮在不同深度上新建节点，全部释放后整个obj区仍可以作为一个obj分配
+    uint8_t *meta = calloc(1, META_SIZE);
+    if (box_init(meta, META_SIZE, DATA_SIZE) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+    size_t sizes[] = {8, 200, 3000, 40000, 700000};
+    for (int r = 0; r < ROUNDS && !errors; r++)
+    {
+        uint64_t offsets[5];
+        for (int i = 0; i < 5; i++)
+        {
+            offsets[i] = box_alloc(meta, sizes[(r + i) % 5]);
+            if (offsets[i] == (uint64_t)-1)
+            {
+                printf("round %d: box_alloc(%zu) failed\n", r, sizes[(r + i) % 5]);
+                errors++;
+            }
+        }
+        for (int i = 0; i < 5; i++)
+        {
+            if (offsets[i] != (uint64_t)-1)
+                box_free(meta, offsets[i]);
+        }
+        uint64_t whole = box_alloc(meta, DATA_SIZE);
+        if (whole != 0)
+        {
+            printf("round %d: empty nodes not reclaimed\n", r);
+            errors++;
+            continue;
+        }
+        box_free(meta, whole);
+    }
+    free(meta);
+
+    // 保留空节点：在同一边界上反复分配/释放时复用同一个节点
+    meta = calloc(1, META_SIZE);
+    box_options_t options = {.empty_keep = 2};
+    if (box_init_ex(meta, META_SIZE, DATA_SIZE, &options) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+    uint64_t first = box_alloc(meta, 8);
+    box_free(meta, first);
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        uint64_t offset = box_alloc(meta, 8);
+        if (offset != first || box_allocated_size(meta, offset) != 8)
+        {
+            printf("round %d: kept node not reused, object+%lu\n", r, offset);
+            errors++;
+            break;
+        }
+        box_free(meta, offset);
+    }
+    free(meta);
+
+    printf("%d rounds, %d errors\n", ROUNDS, errors);
+    return errors ? 1 : 0;
+}
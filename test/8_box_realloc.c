@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+#define META_SIZE (1024 * 1024)
+#define DATA_SIZE (16 * 1024 * 1024)
+
+static int errors = 0;
+
+static void expect(int ok, const char *what)
+{
+    if (!ok)
+    {
+        printf("FAILED: %s\n", what);
+        errors++;
+    }
+}
+
+int main()
+{
+    uint8_t *meta = calloc(1, META_SIZE);
+    if (box_init(meta, META_SIZE, DATA_SIZE) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+
+    // 后续槽位空闲：原地扩大
+    uint64_t a = box_alloc(meta, 8);
+    expect(box_realloc(meta, a, 24) == a, "grow in place");
+    expect(box_allocated_size(meta, a) == 24, "allocated_size after grow");
+
+    // 后续槽位被占用：另行分配，旧obj保持不变
+    uint64_t b = box_alloc(meta, 8);
+    expect(b == a + 24, "neighbour placed after grown object");
+    uint64_t c = box_realloc(meta, a, 40);
+    expect(c != a && c != (uint64_t)-1, "relocate when blocked");
+    expect(box_allocated_size(meta, a) == 24, "old object kept after relocation");
+    expect(box_allocated_size(meta, c) >= 40, "allocated_size of relocated object");
+    box_free(meta, a);
+
+    // 原地缩小：释放尾部槽位，之后可以被再分配
+    expect(box_realloc(meta, c, 8) == c, "shrink in place");
+    expect(box_allocated_size(meta, c) == 8, "allocated_size after shrink");
+    uint64_t d = box_alloc(meta, 32);
+    expect(d == c + 8, "released tail slots reused");
+
+    // 缩小到低于本节点的槽位粒度：保留一个槽位
+    uint64_t x = box_alloc(meta, 3000);
+    expect(box_realloc(meta, x, 100) == x, "shrink below slot size");
+    expect(box_allocated_size(meta, x) == 2048, "one slot kept");
+    expect(box_realloc(meta, x, 0) == x, "shrink to zero keeps one slot");
+
+    // 超出本节点的槽位粒度：只能搬移
+    uint64_t y = box_realloc(meta, x, 1024 * 1024);
+    expect(y != x && box_allocated_size(meta, y) >= 1024 * 1024, "grow across levels relocates");
+
+    expect(box_realloc(meta, x + 8, 16) == (uint64_t)-1, "unknown object");
+
+    box_free(meta, x);
+    box_free(meta, y);
+    box_free(meta, b);
+    box_free(meta, c);
+    box_free(meta, d);
+    expect(box_alloc(meta, DATA_SIZE) == 0, "tree empty after frees");
+
+    printf("%d errors\n", errors);
+    free(meta);
+    return errors ? 1 : 0;
+}
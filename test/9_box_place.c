@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+#define META_SIZE (4 * 1024 * 1024)
+#define DATA_SIZE (64 * 1024 * 1024)
+#define MAX_OBJS 1024
+
+typedef struct
+{
+    uint64_t offset;
+    uint64_t size;
+} obj_t;
+
+static obj_t objs[MAX_OBJS];
+static int nobjs = 0;
+static int errors = 0;
+
+static int compare_obj(const void *a, const void *b)
+{
+    uint64_t x = ((const obj_t *)a)->offset;
+    uint64_t y = ((const obj_t *)b)->offset;
+    return (x > y) - (x < y);
+}
+
+static void record(uint8_t *meta, uint64_t offset)
+{
+    objs[nobjs].offset = offset;
+    objs[nobjs].size = box_allocated_size(meta, offset);
+    nobjs++;
+}
+
+static void check_overlap(void)
+{
+    qsort(objs, nobjs, sizeof(obj_t), compare_obj);
+    for (int i = 1; i < nobjs; i++)
+    {
+        if (objs[i - 1].offset + objs[i - 1].size > objs[i].offset)
+        {
+            printf("object+%lu overlaps object+%lu\n", objs[i - 1].offset, objs[i].offset);
+            errors++;
+        }
+    }
+}
+
+int main()
+{
+    uint8_t *meta = calloc(1, META_SIZE);
+    if (box_init(meta, META_SIZE, DATA_SIZE) != 0)
+    {
+        printf("Failed to initialize boxmalloc\n");
+        return 1;
+    }
+
+    // 对齐分配，夹杂普通分配打乱空闲槽位
+    size_t aligns[] = {4096, 64 * 1024, 2 * 1024 * 1024};
+    size_t sizes[] = {8, 100, 5000, 300000};
+    // 64MB中只有32个2M对齐的起始offset
+    for (int round = 0; round < 6; round++)
+    {
+        for (size_t a = 0; a < sizeof(aligns) / sizeof(aligns[0]); a++)
+        {
+            for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+            {
+                record(meta, box_alloc(meta, 24 + round * 8));
+                uint64_t offset = box_alloc_aligned(meta, sizes[s], aligns[a]);
+                if (offset == (uint64_t)-1 || offset % aligns[a] != 0 || box_allocated_size(meta, offset) < sizes[s])
+                {
+                    printf("box_alloc_aligned(%zu, %zu) = %lu\n", sizes[s], aligns[a], offset);
+                    errors++;
+                    continue;
+                }
+                record(meta, offset);
+            }
+        }
+    }
+    if (box_alloc_aligned(meta, 64, 3) != (uint64_t)-1)
+    {
+        printf("align 3 accepted\n");
+        errors++;
+    }
+
+    check_overlap();
+    for (int i = 0; i < nobjs; i++)
+        box_free(meta, objs[i].offset);
+    if (box_alloc(meta, DATA_SIZE) != 0)
+    {
+        printf("tree not empty after frees\n");
+        errors++;
+    }
+    printf("aligned: %d objects, %d errors\n", nobjs, errors);
+    free(meta);
+
+    meta = calloc(1, META_SIZE);
+    box_init(meta, META_SIZE, DATA_SIZE);
+    nobjs = 0;
+    record(meta, box_alloc(meta, 8));
+
+    // 靠近hint分配：空白区域内直接落在hint处，之后紧随其后
+    uint64_t hint = 40 * 1024 * 1024;
+    uint64_t first = box_alloc_near(meta, 8, hint);
+    uint64_t second = box_alloc_near(meta, 8, hint);
+    if (first != hint || second != hint + 8)
+    {
+        printf("box_alloc_near: %lu, %lu, hint %lu\n", first, second, hint);
+        errors++;
+    }
+    record(meta, first);
+    record(meta, second);
+
+    // hint处已被占用：落在附近
+    uint64_t big = box_alloc_near(meta, 100000, hint + 1024 * 1024);
+    uint64_t near = box_alloc_near(meta, 64, big + 8);
+    if (big == (uint64_t)-1 || near == (uint64_t)-1 || near < big || near - big > 256 * 1024)
+    {
+        printf("box_alloc_near around object+%lu: %lu\n", big, near);
+        errors++;
+    }
+    record(meta, big);
+    record(meta, near);
+
+    check_overlap();
+    for (int i = 0; i < nobjs; i++)
+        box_free(meta, objs[i].offset);
+    if (box_alloc(meta, DATA_SIZE) != 0)
+    {
+        printf("tree not empty after frees\n");
+        errors++;
+    }
+
+    printf("near: %d objects, %d errors\n", nobjs, errors);
+    free(meta);
+
+    // BOX_BEST_FIT 同样用于对齐分配：填满一个叶节点后空出槽位1-3和槽位10、11
+    meta = calloc(1, META_SIZE);
+    box_options_t options = {.policy = BOX_BEST_FIT};
+    box_init_ex(meta, META_SIZE, DATA_SIZE, &options);
+    uint64_t leaf[16];
+    for (int i = 0; i < 16; i++)
+        leaf[i] = box_alloc(meta, 8);
+    int freed[] = {1, 2, 3, 10, 11};
+    for (size_t i = 0; i < sizeof(freed) / sizeof(freed[0]); i++)
+        box_free(meta, leaf[freed[i]]);
+    // 最短的一段是槽位10-11；16字节对齐时该段只有槽位10可以作为起始
+    uint64_t best = box_alloc_aligned(meta, 8, 8);
+    uint64_t best16 = box_alloc_aligned(meta, 8, 16);
+    if (best != leaf[10] || best16 != leaf[2])
+    {
+        printf("best fit aligned: %lu, %lu, expected %lu, %lu\n", best, best16, leaf[10], leaf[2]);
+        errors++;
+    }
+    printf("best fit: %d errors\n", errors);
+    free(meta);
+    return errors ? 1 : 0;
+}
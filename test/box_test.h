@@ -0,0 +1,26 @@
+#ifndef BOX_TEST_H
+#define BOX_TEST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+/*
+测试共用：反复分配size字节的obj直到失败，offset依次写入out，返回分配的个数。
+out只有max项，分配满max个时停止，不会写出out的范围；需要以一次失败的分配结束时，max应比能分配的个数多1。
+*/
+static inline size_t box_test_fill(void *meta, size_t size, uint64_t *out, size_t max)
+{
+    size_t n = 0;
+    while (n < max)
+    {
+        uint64_t offset = box_alloc(meta, size);
+        if (offset == (uint64_t)-1)
+            break;
+        out[n++] = offset;
+    }
+    return n;
+}
+
+#endif // BOX_TEST_H
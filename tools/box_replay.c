@@ -0,0 +1,333 @@
+/*
+box_replay：在新初始化的meta区上重放 box_trace_start 录下的trace。
+
+用法：box_replay [-t threads] [-m meta_bytes] [-s samples] trace
+- -t：重放线程数，默认1。录制时同一线程的调用由同一个重放线程按原顺序执行（按线程id取模分配）
+- -m：meta区大小，默认与录制时相同；obj区大小总是与录制时相同
+- -s：沿trace等距采样碎片情况的次数，默认20
+
+trace中的offset是生产环境的offset，重放时的offset不同：预扫描一遍，为每个FREE/SIZE找到分配它的ALLOC，
+重放时用该ALLOC在重放中得到的offset。多线程重放时FREE/SIZE等到其ALLOC完成后再执行；
+依赖总是指向更早的记录，各线程按记录顺序前进，不会互相等待成环。
+录制时就失败的ALLOC不重放；开始录制之前分配的obj的FREE/SIZE找不到ALLOC，跳过。
+
+输出：吞吐、重放中失败的ALLOC（录制时成功）、采样点的已分配字节数/节点数/最大可分配obj/碎片率，以及meta区节点数的峰值。
+碎片率 = 1 - 最大可分配obj / 空闲字节数。
+*/
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <boxmalloc/boxmalloc.h>
+
+#define MAX_THREADS 64
+#define MAX_FAILURES 16
+#define NONE UINT64_MAX
+
+typedef struct
+{
+    uint64_t record;
+    uint64_t allocated_bytes;
+    uint64_t nodes;
+    uint64_t largest_free;
+    double fragmentation;
+} sample_t;
+
+typedef struct
+{
+    uint64_t record;
+    uint64_t size;
+} failure_t;
+
+static const box_trace_record_t *records;
+static uint64_t nrecords;
+static uint64_t *dep;       // FREE/SIZE：分配该obj的ALLOC的序号
+static uint64_t *offsets;   // ALLOC：重放得到的offset
+static atomic_uchar *done;  // ALLOC 已重放
+static uint8_t *meta;
+static uint64_t box_bytessize;
+
+static uint64_t sample_interval;
+static sample_t *samples;
+static uint64_t nsamples;
+
+static atomic_uint_fast64_t failures;
+static failure_t failure_points[MAX_FAILURES];
+static atomic_uint_fast64_t peak_nodes;
+static uint64_t nodes_capacity;
+
+typedef struct
+{
+    uint64_t *list; // 由该线程重放的记录序号
+    uint64_t n;
+} replay_thread_t;
+
+// 录制时的offset → ALLOC序号，开放寻址，删除时留墓碑
+typedef struct
+{
+    uint64_t *keys;
+    uint64_t *values;
+    uint64_t mask;
+} offset_map_t;
+
+#define MAP_EMPTY UINT64_MAX
+#define MAP_DELETED (UINT64_MAX - 1)
+
+static uint64_t hash(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return x;
+}
+
+static uint64_t *map_find(offset_map_t *map, uint64_t key, bool insert)
+{
+    uint64_t *tomb = NULL;
+    for (uint64_t i = hash(key) & map->mask;; i = (i + 1) & map->mask)
+    {
+        if (map->keys[i] == key)
+            return &map->values[i];
+        if (map->keys[i] == MAP_DELETED && !tomb)
+            tomb = &map->keys[i];
+        if (map->keys[i] == MAP_EMPTY)
+        {
+            if (!insert)
+                return NULL;
+            uint64_t *slot = tomb ? tomb : &map->keys[i];
+            *slot = key;
+            return &map->values[slot - map->keys];
+        }
+    }
+}
+
+// 为每个FREE/SIZE找到对应的ALLOC
+static void link_records(void)
+{
+    uint64_t capacity = 16;
+    while (capacity < nrecords * 2)
+        capacity *= 2;
+    offset_map_t map = {.keys = malloc(capacity * 8), .values = malloc(capacity * 8), .mask = capacity - 1};
+    memset(map.keys, 0xff, capacity * 8);
+    for (uint64_t i = 0; i < nrecords; i++)
+    {
+        const box_trace_record_t *r = &records[i];
+        dep[i] = NONE;
+        if (r->op == BOX_TRACE_ALLOC && r->offset != NONE)
+            *map_find(&map, r->offset, true) = i;
+        else if (r->op == BOX_TRACE_FREE || r->op == BOX_TRACE_SIZE)
+        {
+            uint64_t *alloc = map_find(&map, r->offset, false);
+            if (!alloc)
+                continue;
+            dep[i] = *alloc;
+            if (r->op == BOX_TRACE_FREE)
+                map.keys[alloc - map.values] = MAP_DELETED;
+        }
+    }
+    free(map.keys);
+    free(map.values);
+}
+
+static void take_sample(uint64_t i)
+{
+    box_stats_t stats;
+    if (box_stats(meta, &stats) != 0)
+        return;
+    uint64_t free_bytes = stats.box_bytessize - stats.allocated_bytes;
+    samples[i / sample_interval] = (sample_t){
+        .record = i,
+        .allocated_bytes = stats.allocated_bytes,
+        .nodes = stats.nodes,
+        .largest_free = stats.largest_free,
+        .fragmentation = free_bytes ? 1 - (double)stats.largest_free / free_bytes : 0,
+    };
+    nodes_capacity = stats.nodes_capacity;
+    uint64_t peak = atomic_load(&peak_nodes);
+    while (stats.nodes > peak && !atomic_compare_exchange_weak(&peak_nodes, &peak, stats.nodes))
+        ;
+}
+
+static void replay_record(uint64_t i)
+{
+    const box_trace_record_t *r = &records[i];
+    if (r->op == BOX_TRACE_ALLOC)
+    {
+        if (r->offset == NONE)
+            return;
+        offsets[i] = box_alloc(meta, r->size);
+        if (offsets[i] == NONE)
+        {
+            uint64_t k = atomic_fetch_add(&failures, 1);
+            if (k < MAX_FAILURES)
+                failure_points[k] = (failure_t){.record = i, .size = r->size};
+        }
+        atomic_store_explicit(&done[i], 1, memory_order_release);
+        return;
+    }
+    if (dep[i] == NONE)
+        return;
+    while (!atomic_load_explicit(&done[dep[i]], memory_order_acquire))
+        sched_yield();
+    uint64_t offset = offsets[dep[i]];
+    if (offset == NONE)
+        return;
+    if (r->op == BOX_TRACE_FREE)
+        box_free(meta, offset);
+    else
+        box_allocated_size(meta, offset);
+}
+
+static void *replay(void *arg)
+{
+    replay_thread_t *t = arg;
+    for (uint64_t k = 0; k < t->n; k++)
+    {
+        uint64_t i = t->list[k];
+        replay_record(i);
+        if (i % sample_interval == 0)
+            take_sample(i);
+    }
+    return NULL;
+}
+
+static double now_sec(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-t threads] [-m meta_bytes] [-s samples] trace\n", prog);
+    exit(2);
+}
+
+int main(int argc, char **argv)
+{
+    int threads = 1;
+    uint64_t meta_bytes = 0;
+    nsamples = 20;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:m:s:")) != -1)
+    {
+        if (opt == 't')
+            threads = atoi(optarg);
+        else if (opt == 'm')
+            meta_bytes = strtoull(optarg, NULL, 0);
+        else if (opt == 's')
+            nsamples = strtoull(optarg, NULL, 0);
+        else
+            usage(argv[0]);
+    }
+    if (optind != argc - 1 || threads < 1 || threads > MAX_THREADS || nsamples == 0)
+        usage(argv[0]);
+
+    int fd = open(argv[optind], O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(box_trace_header_t))
+    {
+        fprintf(stderr, "cannot read trace %s\n", argv[optind]);
+        return 1;
+    }
+    const uint8_t *file = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    const box_trace_header_t *header = (const box_trace_header_t *)file;
+    if (file == MAP_FAILED || memcmp(header->magic, BOX_TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != BOX_TRACE_VERSION || header->record_bytes != sizeof(box_trace_record_t))
+    {
+        fprintf(stderr, "%s is not a boxmalloc trace\n", argv[optind]);
+        return 1;
+    }
+    records = (const box_trace_record_t *)(file + sizeof(box_trace_header_t));
+    nrecords = header->records;
+    if (nrecords == 0)
+    {
+        // 没有正常停止的trace：op为0的记录之前都是有效记录
+        uint64_t max = (st.st_size - sizeof(box_trace_header_t)) / sizeof(box_trace_record_t);
+        while (nrecords < max && records[nrecords].op != 0)
+            nrecords++;
+    }
+    if (nrecords == 0)
+    {
+        fprintf(stderr, "empty trace\n");
+        return 1;
+    }
+    box_bytessize = header->box_bytessize;
+    if (meta_bytes == 0)
+        meta_bytes = header->boxhead_bytessize;
+
+    meta = calloc(1, meta_bytes);
+    if (!meta || box_init(meta, meta_bytes, box_bytessize) != 0)
+    {
+        fprintf(stderr, "box_init(%lu, %lu) failed\n", meta_bytes, box_bytessize);
+        return 1;
+    }
+    dep = malloc(nrecords * sizeof(uint64_t));
+    offsets = malloc(nrecords * sizeof(uint64_t));
+    done = calloc(nrecords, sizeof(atomic_uchar));
+    sample_interval = (nrecords + nsamples - 1) / nsamples;
+    nsamples = (nrecords + sample_interval - 1) / sample_interval;
+    samples = calloc(nsamples, sizeof(sample_t));
+    link_records();
+
+    // 按录制时的线程分给重放线程，保持每个线程内的顺序
+    replay_thread_t ts[MAX_THREADS] = {0};
+    for (int t = 0; t < threads; t++)
+        ts[t].list = malloc(nrecords * sizeof(uint64_t));
+    uint64_t skipped = 0;
+    for (uint64_t i = 0; i < nrecords; i++)
+    {
+        replay_thread_t *t = &ts[records[i].thread % threads];
+        t->list[t->n++] = i;
+        skipped += records[i].op != BOX_TRACE_ALLOC && dep[i] == NONE;
+    }
+
+    double t0 = now_sec();
+    pthread_t tids[MAX_THREADS];
+    for (int t = 0; t < threads; t++)
+        pthread_create(&tids[t], NULL, replay, &ts[t]);
+    for (int t = 0; t < threads; t++)
+        pthread_join(tids[t], NULL);
+    double seconds = now_sec() - t0;
+
+    printf("trace: %lu records (%lu dropped while recording), box %lu bytes, meta %lu bytes\n", nrecords,
+           header->dropped, box_bytessize, meta_bytes);
+    printf("replay: %d threads, %.3f s, %.0f ops/s, %.1f ns/op, %lu free/size records without a traced alloc\n",
+           threads, seconds, nrecords / seconds, seconds * 1e9 / nrecords, skipped);
+    printf("peak nodes: %lu/%lu (~%lu meta bytes)\n", atomic_load(&peak_nodes), nodes_capacity,
+           nodes_capacity ? atomic_load(&peak_nodes) * (meta_bytes / nodes_capacity) : 0);
+    uint64_t nfailures = atomic_load(&failures);
+    printf("failed allocs: %lu\n", nfailures);
+    for (uint64_t k = 0; k < nfailures && k < MAX_FAILURES; k++)
+        printf("  record %lu: %lu bytes\n", failure_points[k].record, failure_points[k].size);
+    printf("%12s %14s %10s %14s %6s\n", "record", "allocated", "nodes", "largest_free", "frag");
+    for (uint64_t k = 0; k < nsamples; k++)
+    {
+        sample_t *s = &samples[k];
+        printf("%12lu %14lu %10lu %14lu %5.1f%%\n", s->record, s->allocated_bytes, s->nodes, s->largest_free,
+               s->fragmentation * 100);
+    }
+
+    for (int t = 0; t < threads; t++)
+        free(ts[t].list);
+    free(samples);
+    free((void *)done);
+    free(offsets);
+    free(dep);
+    free(meta);
+    munmap((void *)file, st.st_size);
+    close(fd);
+    return 0;
+}